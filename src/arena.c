@@ -0,0 +1,54 @@
+#include "arena.h"
+
+#define ARENA_ALIGN(SIZE) (((SIZE) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+void arena_init(arena_t *arena) {
+	arena->block = NULL;
+}
+
+void arena_free(arena_t *arena) {
+	for (arena_block_t *block = arena->block; block != NULL;) {
+		arena_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->block = NULL;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+	size = ARENA_ALIGN(size);
+
+	arena_block_t *block = arena->block;
+	if (block == NULL || size > (size_t)(block->end - block->top)) {
+		size_t header = ARENA_ALIGN(sizeof(arena_block_t));
+		size_t cap    = size > ARENA_BLOCK - header? size : ARENA_BLOCK - header;
+
+		block = (arena_block_t*)malloc(header + cap);
+		if (block == NULL)
+			UNREACHABLE("malloc() fail");
+
+		block->top = (char*)block + header;
+		block->end = block->top + cap;
+
+		/* Blocks of big allocations go behind the current one, so its space is not lost */
+		if (arena->block != NULL && cap > ARENA_BLOCK - header) {
+			block->next        = arena->block->next;
+			arena->block->next = block;
+		} else {
+			block->next  = arena->block;
+			arena->block = block;
+		}
+	}
+
+	void *ptr   = block->top;
+	block->top += size;
+	return ptr;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+	size_t size = strlen(str) + 1;
+	char  *copy = (char*)arena_alloc(arena, size);
+	memcpy(copy, str, size);
+	return copy;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H_HEADER_GUARD
+#define ARENA_H_HEADER_GUARD
+
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* strlen, memcpy */
+#include <stddef.h> /* max_align_t */
+
+#include "common.h"
+
+/* Memory of a parsed unit. Everything is bump allocated from blocks in the order it is parsed,
+   so the nodes of one function end up next to each other, and the whole unit is released at
+   once. Nothing allocated from an arena is freed on its own */
+
+#define ARENA_BLOCK (16 * 1024)
+
+typedef struct arena_block arena_block_t;
+
+struct arena_block {
+	arena_block_t *next;
+	char          *top, *end;
+};
+
+typedef struct {
+	arena_block_t *block; /* The current one, older blocks follow it */
+} arena_t;
+
+void arena_init(arena_t *arena);
+void arena_free(arena_t *arena);
+
+void *arena_alloc( arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+
+#endif
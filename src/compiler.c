@@ -0,0 +1,765 @@
+#include "compiler.h"
+
+const char *compile_errors[ERR_COUNT] = {
+	[ERR_UNEXPECTED_RETURN]    = "Unexpected return",
+	[ERR_UNEXPECTED_BREAK]     = "Unexpected break",
+	[ERR_UNEXPECTED_CONTINUE]  = "Unexpected continue",
+	[ERR_RETURN_IN_FOR]        = "Unexpected return in for loop",
+	[ERR_RETURN_IN_FOR_STEP]   = "Unexpected return in for loop step",
+	[ERR_BREAK_IN_FOR_STEP]    = "Unexpected break in for loop step",
+	[ERR_CONTINUE_IN_FOR_STEP] = "Unexpected continue in for loop step",
+	[ERR_ASSIGN_TO_SLICE]      = "Cannot assign to a slice",
+	[ERR_ASSIGN_EXPECTED_VAR]  = "left side of '=' expected variable",
+	[ERR_INC_EXPECTED_VAR]     = "left side of '++' expected variable",
+	[ERR_DEC_EXPECTED_VAR]     = "left side of '--' expected variable",
+	[ERR_XINC_EXPECTED_VAR]    = "left side of '**' expected variable",
+	[ERR_XDEC_EXPECTED_VAR]    = "left side of '//' expected variable",
+};
+
+static_assert(ERR_COUNT == 13); /* Add new errors to the messages */
+
+static const char *decl_redeclared_msgs[DECL_COUNT] = {
+	[DECL_LET]        = "Variable '%s' redeclared",
+	[DECL_ENUM]       = "Enum constant '%s' redeclared",
+	[DECL_FUN]        = "Function '%s' redeclared",
+	[DECL_ITER_VALUE] = "Iteration value '%s' redeclared",
+	[DECL_ITERATOR]   = "Iterator '%s' redeclared",
+};
+
+static_assert(DECL_COUNT == 5); /* Add new declarations to the messages */
+
+const char *decl_redeclared_msg(int kind, bool const_) {
+	return kind == DECL_LET && const_? "Constant '%s' redeclared" : decl_redeclared_msgs[kind];
+}
+
+/* What 'return', 'break' and 'continue' jump out to */
+typedef enum {
+	TARGET_UNIT = 0,
+	TARGET_FUN,      /* Function bodies and units that can return */
+	TARGET_DEFER,
+	TARGET_DO,
+	TARGET_LOOP,
+	TARGET_FOR_INIT,
+	TARGET_FOR_STEP,
+} target_kind_t;
+
+typedef struct {
+	size_t *buf;
+	size_t  size, cap;
+} patches_t;
+
+typedef struct target {
+	target_kind_t kind;
+	size_t        depth, scopes; /* Of the compiler at the landing point */
+	void         *node;          /* Where the errors of 'for' loop parts are reported */
+
+	patches_t breaks, continues; /* Jumps of 'do' returns are in 'breaks' */
+
+	struct target *prev;
+} target_t;
+
+/* Variables declared in a scope so far, static scopes give them slots in this order */
+typedef struct {
+	uint32_t *syms;
+	size_t    count, cap;
+	bool      dynamic;
+	size_t    begin; /* The OP_SCOPE_BEGIN to patch with the slot count */
+} scope_info_t;
+
+typedef struct {
+	chunk_t  *chunk, *unit;
+	size_t    depth;
+	target_t *target;
+	symtab_t *syms;
+
+	scope_info_t *scopes; /* The first one is the scope the chunk runs in */
+	size_t        scopes_count, scopes_cap;
+} compiler_t;
+
+static chunk_t *chunk_new(void) {
+	chunk_t *chunk = (chunk_t*)malloc(sizeof(chunk_t));
+	if (chunk == NULL)
+		UNREACHABLE("malloc() fail");
+
+	memset(chunk, 0, sizeof(*chunk));
+
+	chunk->cap  = 64;
+	chunk->code = (inst_t*)malloc(sizeof(inst_t) * chunk->cap);
+	if (chunk->code == NULL)
+		UNREACHABLE("malloc() fail");
+
+	return chunk;
+}
+
+void chunk_free(chunk_t *chunk) {
+	for (size_t i = 0; i < chunk->subs_size; ++ i)
+		chunk_free(chunk->subs[i]);
+
+	if (chunk->subs != NULL)
+		free(chunk->subs);
+
+	free(chunk->code);
+	free(chunk);
+}
+
+static void chunk_add_sub(chunk_t *chunk, chunk_t *sub) {
+	if (chunk->subs_size >= chunk->subs_cap) {
+		chunk->subs_cap = chunk->subs_cap == 0? 8 : chunk->subs_cap * 2;
+		chunk->subs     = (chunk_t**)realloc(chunk->subs, sizeof(chunk_t*) * chunk->subs_cap);
+		if (chunk->subs == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	chunk->subs[chunk->subs_size ++] = sub;
+}
+
+static void patches_add(patches_t *patches, size_t at) {
+	if (patches->size >= patches->cap) {
+		patches->cap = patches->cap == 0? 8 : patches->cap * 2;
+		patches->buf = (size_t*)realloc(patches->buf, sizeof(size_t) * patches->cap);
+		if (patches->buf == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	patches->buf[patches->size ++] = at;
+}
+
+static void compiler_patch(compiler_t *c, patches_t *patches, size_t to) {
+	for (size_t i = 0; i < patches->size; ++ i)
+		c->chunk->code[patches->buf[i]].arg = to;
+
+	if (patches->buf != NULL)
+		free(patches->buf);
+
+	memset(patches, 0, sizeof(*patches));
+}
+
+static void target_begin(compiler_t *c, target_t *target, target_kind_t kind) {
+	memset(target, 0, sizeof(*target));
+	target->kind   = kind;
+	target->depth  = c->depth;
+	target->scopes = c->scopes_count;
+	target->prev   = c->target;
+
+	c->target = target;
+}
+
+static void target_end(compiler_t *c, target_t *target) {
+	assert(c->target == target);
+	c->target = target->prev;
+}
+
+static void compiler_push_scope(compiler_t *c, bool dynamic, size_t begin) {
+	if (c->scopes_count >= c->scopes_cap) {
+		c->scopes_cap = c->scopes_cap == 0? 16 : c->scopes_cap * 2;
+		c->scopes     = (scope_info_t*)realloc(c->scopes, sizeof(scope_info_t) * c->scopes_cap);
+		if (c->scopes == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	scope_info_t *scope = c->scopes + c->scopes_count ++;
+	memset(scope, 0, sizeof(*scope));
+	scope->dynamic = dynamic;
+	scope->begin   = begin;
+}
+
+static void compiler_pop_scope(compiler_t *c) {
+	scope_info_t *scope = c->scopes + -- c->scopes_count;
+	if (scope->syms != NULL)
+		free(scope->syms);
+}
+
+static void compiler_deinit(compiler_t *c) {
+	while (c->scopes_count > 0)
+		compiler_pop_scope(c);
+
+	if (c->scopes != NULL)
+		free(c->scopes);
+}
+
+/* Redeclarations are errors at compile time, even in code that would never run */
+static decl_t compiler_declare(compiler_t *c, void *node, const char *name, int kind, bool const_) {
+	scope_info_t *scope = c->scopes + c->scopes_count - 1;
+	uint32_t      sym   = symtab_intern(c->syms, name);
+
+	for (size_t i = 0; i < scope->count; ++ i) {
+		if (scope->syms[i] == sym)
+			error(*(where_t*)node, decl_redeclared_msg(kind, const_), name);
+	}
+
+	if (scope->count >= scope->cap) {
+		scope->cap  = scope->cap == 0? 8 : scope->cap * 2;
+		scope->syms = (uint32_t*)realloc(scope->syms, sizeof(uint32_t) * scope->cap);
+		if (scope->syms == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	uint32_t slot = scope->count;
+	scope->syms[scope->count ++] = sym;
+	return (decl_t){.sym = sym, .slot = scope->dynamic? SLOT_DYNAMIC : slot};
+}
+
+static void compiler_resolve(compiler_t *c, expr_id_t *id) {
+	id->sym  = symtab_intern(c->syms, id->name);
+	id->slot = SLOT_DYNAMIC;
+
+	for (size_t i = c->scopes_count; i --> 0;) {
+		scope_info_t *scope = c->scopes + i;
+		if (scope->dynamic)
+			break;
+
+		for (size_t j = 0; j < scope->count; ++ j) {
+			if (scope->syms[j] == id->sym) {
+				id->depth = c->scopes_count - 1 - i;
+				id->slot  = j;
+				return;
+			}
+		}
+	}
+}
+
+/* How many values each instruction leaves on the stack */
+static long inst_stack_effect(inst_t *inst) {
+	switch (inst->op) {
+	case OP_NIL: case OP_VALUE: case OP_FUN: case OP_GET: return 1;
+
+	case OP_POP:   return -1;
+	case OP_POPN:  return -(long)inst->arg;
+	case OP_SLIDE: return -(long)inst->arg;
+	case OP_ARR:   return 1 - (long)inst->arg;
+	case OP_MAP:   return 1 - (long)inst->arg * 2;
+	case OP_REC:   return 1 - (long)inst->arg;
+	case OP_FMT:   return 1 - (long)inst->arg;
+	case OP_CALL:  return -(long)inst->arg;
+	case OP_IDX:   return -1;
+	case OP_SLICE: return -2;
+
+	case OP_BIN_OP: return -1;
+	case OP_UN_OP:  return 0;
+	case OP_AND:    return -1;
+	case OP_OR:     return -1;
+
+	case OP_SET_IDX:    return inst->sub? -3 : -2;
+	case OP_UPDATE_IDX: return -2;
+
+	case OP_JUMP_IF_FALSE: return -1;
+	case OP_DEFINE:        return -1;
+	case OP_FOREACH_INIT:  return 2;
+	case OP_RETURN:        return -1;
+
+	default: return 0;
+	}
+}
+
+static size_t emit(compiler_t *c, opcode_t op, uint8_t sub, size_t arg, void *node) {
+	chunk_t *chunk = c->chunk;
+	if (chunk->size >= chunk->cap) {
+		chunk->cap *= 2;
+		chunk->code = (inst_t*)realloc(chunk->code, sizeof(inst_t) * chunk->cap);
+		if (chunk->code == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	inst_t *inst = chunk->code + chunk->size;
+	inst->op   = op;
+	inst->sub  = sub;
+	inst->arg  = arg;
+	inst->node = node;
+
+	c->depth += inst_stack_effect(inst);
+	if (c->depth > chunk->max_depth)
+		chunk->max_depth = c->depth;
+
+	return chunk->size ++;
+}
+
+static void compile_expr( compiler_t *c, expr_t *expr);
+static void compile_stmts(compiler_t *c, stmt_t *stmts);
+
+static void compile_body(compiler_t *c, stmt_t *stmts, target_kind_t kind) {
+	target_t target;
+	target_begin(c, &target, kind);
+
+	compile_stmts(c, stmts);
+	emit(c, OP_NIL,    0, 0, NULL);
+	emit(c, OP_RETURN, 0, 0, NULL);
+
+	target_end(c, &target);
+}
+
+/* Deferred statements run in the scope that defers them, which can have variables declared by
+   name, so they are dynamic like the top level of a unit */
+static chunk_t *compile_defer(compiler_t *c, stmt_t *stmt) {
+	chunk_t   *sub = chunk_new();
+	compiler_t sc  = {.chunk = sub, .unit = c->unit, .syms = c->syms};
+	chunk_add_sub(c->unit, sub);
+
+	compiler_push_scope(&sc, true, 0);
+	compile_body(&sc, stmt, TARGET_DEFER);
+	compiler_deinit(&sc);
+	return sub;
+}
+
+static void compile_scope_begin(compiler_t *c, void *node) {
+	compiler_push_scope(c, false, emit(c, OP_SCOPE_BEGIN, 0, 0, node));
+}
+
+static void compile_scope_end(compiler_t *c, void *node) {
+	scope_info_t *scope = c->scopes + c->scopes_count - 1;
+	c->chunk->code[scope->begin].arg = scope->count;
+
+	emit(c, OP_SCOPE_END, 0, 0, node);
+	compiler_pop_scope(c);
+}
+
+/* Ends the scopes opened since the target, without leaving them at compile time since the code
+   after a jump still belongs to them */
+static void compile_leave_scopes(compiler_t *c, target_t *target, void *node) {
+	for (size_t i = target->scopes; i < c->scopes_count; ++ i)
+		emit(c, OP_SCOPE_END, 0, 0, node);
+}
+
+static void compile_stmt_return(compiler_t *c, stmt_t *stmt) {
+	target_t *target = c->target, *for_ = NULL;
+	while (target->kind == TARGET_LOOP || target->kind == TARGET_FOR_INIT ||
+	       target->kind == TARGET_FOR_STEP) {
+		if (target->kind != TARGET_LOOP && for_ == NULL)
+			for_ = target;
+
+		target = target->prev;
+	}
+
+	/* Returning from the parts of a 'for' loop is only reported as such when there is something
+	   to return from */
+	if (target->kind == TARGET_UNIT || target->kind == TARGET_DEFER) {
+		emit(c, OP_ERROR, 0, ERR_UNEXPECTED_RETURN, stmt);
+		return;
+	} else if (for_ != NULL) {
+		emit(c, OP_ERROR, 0, for_->kind == TARGET_FOR_INIT?
+		     ERR_RETURN_IN_FOR : ERR_RETURN_IN_FOR_STEP, for_->node);
+		return;
+	}
+
+	size_t depth = c->depth;
+	compile_expr(c, stmt->as.return_.expr);
+
+	if (target->kind == TARGET_DO) {
+		if (c->depth - 1 > target->depth)
+			emit(c, OP_SLIDE, 0, c->depth - 1 - target->depth, stmt);
+
+		compile_leave_scopes(c, target, stmt);
+		patches_add(&target->breaks, emit(c, OP_JUMP, 0, 0, stmt));
+	} else {
+		compile_leave_scopes(c, target, stmt);
+		emit(c, OP_RETURN, 0, 0, stmt);
+	}
+
+	c->depth = depth;
+}
+
+static void compile_stmt_break(compiler_t *c, stmt_t *stmt, bool continue_) {
+	target_t *target = c->target;
+	while (target->kind == TARGET_DO)
+		target = target->prev;
+
+	if (target->kind == TARGET_FOR_STEP) {
+		emit(c, OP_ERROR, 0, continue_? ERR_CONTINUE_IN_FOR_STEP : ERR_BREAK_IN_FOR_STEP,
+		     target->node);
+		return;
+	} else if (target->kind != TARGET_LOOP) {
+		emit(c, OP_ERROR, 0, continue_? ERR_UNEXPECTED_CONTINUE : ERR_UNEXPECTED_BREAK, stmt);
+		return;
+	}
+
+	size_t depth = c->depth;
+	if (c->depth > target->depth)
+		emit(c, OP_POPN, 0, c->depth - target->depth, stmt);
+
+	compile_leave_scopes(c, target, stmt);
+	patches_add(continue_? &target->continues : &target->breaks, emit(c, OP_JUMP, 0, 0, stmt));
+
+	c->depth = depth;
+}
+
+static void compile_scope(compiler_t *c, stmt_t *body, void *node) {
+	compile_scope_begin(c, node);
+
+	compile_stmts(c, body);
+
+	compile_scope_end(c, node);
+}
+
+static void compile_stmt_if(compiler_t *c, stmt_t *stmt) {
+	stmt_if_t *if_ = &stmt->as.if_;
+
+	compile_expr(c, if_->cond);
+	size_t jump_else = emit(c, OP_JUMP_IF_FALSE, COND_IF, 0, stmt);
+
+	compile_scope(c, if_->body, stmt);
+
+	if (if_->next == NULL && if_->else_ == NULL) {
+		c->chunk->code[jump_else].arg = c->chunk->size;
+		return;
+	}
+
+	size_t jump_end = emit(c, OP_JUMP, 0, 0, stmt);
+	c->chunk->code[jump_else].arg = c->chunk->size;
+
+	compile_scope_begin(c, stmt);
+
+	if (if_->next != NULL)
+		compile_stmt_if(c, if_->next);
+	else
+		compile_stmts(c, if_->else_);
+
+	compile_scope_end(c, stmt);
+
+	c->chunk->code[jump_end].arg = c->chunk->size;
+}
+
+static void compile_stmt_while(compiler_t *c, stmt_t *stmt) {
+	stmt_while_t *while_ = &stmt->as.while_;
+
+	target_t loop;
+	target_begin(c, &loop, TARGET_LOOP);
+
+	size_t start = c->chunk->size;
+	compile_expr(c, while_->cond);
+	size_t jump_end = emit(c, OP_JUMP_IF_FALSE, COND_WHILE, 0, stmt);
+
+	compile_scope(c, while_->body, stmt);
+	emit(c, OP_JUMP, 0, start, stmt);
+
+	c->chunk->code[jump_end].arg = c->chunk->size;
+	compiler_patch(c, &loop.continues, start);
+	compiler_patch(c, &loop.breaks,    c->chunk->size);
+	target_end(c, &loop);
+}
+
+static void compile_stmt_for(compiler_t *c, stmt_t *stmt) {
+	stmt_for_t *for_ = &stmt->as.for_;
+
+	compile_scope_begin(c, stmt);
+
+	target_t init;
+	target_begin(c, &init, TARGET_FOR_INIT);
+	init.node = stmt;
+	compile_stmts(c, for_->init);
+	target_end(c, &init);
+
+	target_t loop;
+	target_begin(c, &loop, TARGET_LOOP);
+
+	size_t start = c->chunk->size;
+	compile_expr(c, for_->cond);
+	size_t jump_end = emit(c, OP_JUMP_IF_FALSE, COND_FOR, 0, stmt);
+
+	compile_scope(c, for_->body, stmt);
+	compiler_patch(c, &loop.continues, c->chunk->size);
+
+	target_t step;
+	target_begin(c, &step, TARGET_FOR_STEP);
+	step.node = stmt;
+	compile_stmts(c, for_->step);
+	target_end(c, &step);
+
+	emit(c, OP_JUMP, 0, start, stmt);
+
+	c->chunk->code[jump_end].arg = c->chunk->size;
+	compiler_patch(c, &loop.breaks, c->chunk->size);
+	target_end(c, &loop);
+
+	compile_scope_end(c, stmt);
+}
+
+static void compile_stmt_foreach(compiler_t *c, stmt_t *stmt) {
+	stmt_foreach_t *foreach = &stmt->as.foreach;
+
+	compile_scope_begin(c, stmt);
+
+	foreach->decl = compiler_declare(c, stmt, foreach->name, DECL_ITER_VALUE, true);
+	emit(c, OP_DECLARE, DECL_ITER_VALUE, 0, stmt);
+	if (foreach->it != NULL) {
+		foreach->it_decl = compiler_declare(c, stmt, foreach->it, DECL_ITERATOR, true);
+		emit(c, OP_DECLARE, DECL_ITERATOR, 0, stmt);
+	}
+
+	compile_expr(c, foreach->in);
+	emit(c, OP_FOREACH_INIT, 0, 0, stmt);
+
+	target_t loop;
+	target_begin(c, &loop, TARGET_LOOP);
+
+	size_t next = emit(c, OP_FOREACH_NEXT, 0, 0, stmt);
+	compile_scope(c, foreach->body, stmt);
+	emit(c, OP_JUMP, 0, next, stmt);
+
+	c->chunk->code[next].arg = c->chunk->size;
+	compiler_patch(c, &loop.continues, next);
+	compiler_patch(c, &loop.breaks,    c->chunk->size);
+	target_end(c, &loop);
+
+	emit(c, OP_POPN, 0, 3, stmt);
+
+	compile_scope_end(c, stmt);
+}
+
+static void compile_stmt(compiler_t *c, stmt_t *stmt) {
+	switch (stmt->type) {
+	case STMT_TYPE_EXPR:
+		compile_expr(c, stmt->as.expr);
+		emit(c, OP_POP, 0, 0, stmt);
+		break;
+
+	case STMT_TYPE_LET:
+		for (stmt_t *let = stmt; let != NULL; let = let->as.let.next) {
+			let->as.let.decl = compiler_declare(c, let, let->as.let.name, DECL_LET,
+			                                    let->as.let.const_);
+			emit(c, OP_DECLARE, DECL_LET, 0, let);
+			if (let->as.let.val == NULL)
+				emit(c, OP_NIL, 0, 0, let);
+			else
+				compile_expr(c, let->as.let.val);
+
+			emit(c, OP_DEFINE, DECL_LET, 0, let);
+		}
+		break;
+
+	case STMT_TYPE_ENUM: {
+		size_t val = 0;
+		for (stmt_t *enum_ = stmt; enum_ != NULL; enum_ = enum_->as.enum_.next) {
+			enum_->as.enum_.decl = compiler_declare(c, enum_, enum_->as.enum_.name, DECL_ENUM, true);
+			emit(c, OP_DECLARE, DECL_ENUM, val ++, enum_);
+		}
+	} break;
+
+	case STMT_TYPE_FUN:
+		stmt->as.fun.decl = compiler_declare(c, stmt, stmt->as.fun.name, DECL_FUN, true);
+		emit(c, OP_DECLARE, DECL_FUN, 0, stmt);
+		compile_expr(c, stmt->as.fun.def);
+		emit(c, OP_DEFINE, DECL_FUN, 0, stmt);
+		break;
+
+	case STMT_TYPE_IF:       compile_stmt_if(     c, stmt);        break;
+	case STMT_TYPE_WHILE:    compile_stmt_while(  c, stmt);        break;
+	case STMT_TYPE_FOR:      compile_stmt_for(    c, stmt);        break;
+	case STMT_TYPE_FOREACH:  compile_stmt_foreach(c, stmt);        break;
+	case STMT_TYPE_RETURN:   compile_stmt_return( c, stmt);        break;
+	case STMT_TYPE_BREAK:    compile_stmt_break(  c, stmt, false); break;
+	case STMT_TYPE_CONTINUE: compile_stmt_break(  c, stmt, true);  break;
+
+	case STMT_TYPE_DEFER:
+		stmt->as.defer.chunk = compile_defer(c, stmt->as.defer.stmt);
+		emit(c, OP_DEFER, 0, 0, stmt);
+		break;
+
+	case STMT_TYPE_IMPORT:
+		/* Every path of the chain is imported on its own */
+		for (stmt_t *import = stmt; import != NULL; import = import->as.import.next)
+			emit(c, OP_IMPORT, 0, 0, import);
+		break;
+
+	default: UNREACHABLE("Unknown statement type");
+	}
+}
+
+static void compile_stmts(compiler_t *c, stmt_t *stmts) {
+	for (stmt_t *stmt = stmts; stmt != NULL; stmt = stmt->next)
+		compile_stmt(c, stmt);
+}
+
+static const int expected_var_errors[BIN_OP_TYPE_COUNT] = {
+	[BIN_OP_ASSIGN] = ERR_ASSIGN_EXPECTED_VAR,
+	[BIN_OP_INC]    = ERR_INC_EXPECTED_VAR,
+	[BIN_OP_DEC]    = ERR_DEC_EXPECTED_VAR,
+	[BIN_OP_XINC]   = ERR_XINC_EXPECTED_VAR,
+	[BIN_OP_XDEC]   = ERR_XDEC_EXPECTED_VAR,
+};
+
+/* '=', '++', '--', '**' and '//' */
+static void compile_expr_assign(compiler_t *c, expr_t *expr) {
+	expr_bin_op_t *bin_op = &expr->as.bin_op;
+	bool           assign = bin_op->type == BIN_OP_ASSIGN;
+
+	if (bin_op->left->type == EXPR_TYPE_IDX) {
+		compile_expr(c, bin_op->right);
+
+		expr_idx_t *idx = &bin_op->left->as.idx;
+		if (idx->end != NULL) {
+			emit(c, OP_ERROR, 0, ERR_ASSIGN_TO_SLICE, expr);
+			return;
+		}
+
+		compile_expr(c, idx->start);
+		if (assign && idx->expr->type == EXPR_TYPE_IDX && idx->expr->as.idx.end == NULL) {
+			compile_expr(c, idx->expr->as.idx.expr);
+			compile_expr(c, idx->expr->as.idx.start);
+			emit(c, OP_SET_IDX, true, 0, expr);
+		} else {
+			compile_expr(c, idx->expr);
+			emit(c, assign? OP_SET_IDX : OP_UPDATE_IDX, 0, 0, expr);
+		}
+	} else if (bin_op->left->type == EXPR_TYPE_ID) {
+		compile_expr(c, bin_op->right);
+		compiler_resolve(c, &bin_op->left->as.id);
+		emit(c, assign? OP_SET : OP_UPDATE, 0, 0, expr);
+	} else {
+		emit(c, OP_ERROR, 0, expected_var_errors[bin_op->type], expr);
+		emit(c, OP_NIL,   0, 0, expr);
+	}
+}
+
+static void compile_expr_fun(compiler_t *c, expr_t *expr) {
+	expr_fun_t *fun = &expr->as.fun;
+
+	chunk_t   *sub = chunk_new();
+	compiler_t sc  = {.chunk = sub, .unit = c->unit, .syms = c->syms};
+	chunk_add_sub(c->unit, sub);
+
+	/* The arguments are the first variables of the call scope */
+	compiler_push_scope(&sc, false, 0);
+	for (size_t i = 0; i < fun->args_count; ++ i)
+		fun->args_sym[i] = compiler_declare(&sc, expr, fun->args[i], DECL_LET, false).sym;
+
+	compile_body(&sc, fun->body, TARGET_FUN);
+	sub->statics = sc.scopes[0].count;
+	compiler_deinit(&sc);
+
+	fun->chunk = sub;
+	emit(c, OP_FUN, 0, 0, expr);
+}
+
+static void compile_expr_bin_op(compiler_t *c, expr_t *expr) {
+	expr_bin_op_t *bin_op = &expr->as.bin_op;
+
+	switch (bin_op->type) {
+	case BIN_OP_AND:
+	case BIN_OP_OR: {
+		compile_expr(c, bin_op->left);
+		size_t jump = emit(c, bin_op->type == BIN_OP_AND? OP_AND : OP_OR, 0, 0, expr);
+
+		compile_expr(c, bin_op->right);
+		emit(c, OP_CHECK_BOOL, bin_op->type, 0, expr);
+
+		c->chunk->code[jump].arg = c->chunk->size;
+	} break;
+
+	case BIN_OP_ASSIGN:
+	case BIN_OP_INC:
+	case BIN_OP_DEC:
+	case BIN_OP_XINC:
+	case BIN_OP_XDEC: compile_expr_assign(c, expr); break;
+
+	default:
+		compile_expr(c, bin_op->left);
+		compile_expr(c, bin_op->right);
+		emit(c, OP_BIN_OP, 0, 0, expr);
+	}
+}
+
+static void compile_expr(compiler_t *c, expr_t *expr) {
+	switch (expr->type) {
+	case EXPR_TYPE_VALUE: emit(c, OP_VALUE, 0, 0, expr); break;
+	case EXPR_TYPE_ID:
+		compiler_resolve(c, &expr->as.id);
+		emit(c, OP_GET, 0, 0, expr);
+		break;
+
+	case EXPR_TYPE_CALL:
+		compile_expr(c, expr->as.call.expr);
+		for (size_t i = 0; i < expr->as.call.args_count; ++ i)
+			compile_expr(c, expr->as.call.args[i]);
+
+		emit(c, OP_CALL, 0, expr->as.call.args_count, expr);
+		break;
+
+	case EXPR_TYPE_FMT:
+		for (size_t i = 0; i < expr->as.fmt.args_count; ++ i)
+			compile_expr(c, expr->as.fmt.args[i]);
+
+		emit(c, OP_FMT, 0, expr->as.fmt.args_count, expr);
+		break;
+
+	case EXPR_TYPE_ARR:
+		for (size_t i = 0; i < expr->as.arr.size; ++ i)
+			compile_expr(c, expr->as.arr.buf[i]);
+
+		emit(c, OP_ARR, 0, expr->as.arr.size, expr);
+		break;
+
+	case EXPR_TYPE_MAP:
+		for (size_t i = 0; i < expr->as.map.size * 2; ++ i)
+			compile_expr(c, expr->as.map.buf[i]);
+
+		emit(c, OP_MAP, 0, expr->as.map.size, expr);
+		break;
+
+	case EXPR_TYPE_REC:
+		for (size_t i = 0; i < expr->as.rec.shape->size; ++ i)
+			compile_expr(c, expr->as.rec.fields[i]);
+
+		emit(c, OP_REC, 0, expr->as.rec.shape->size, expr);
+		break;
+
+	case EXPR_TYPE_IF: {
+		compile_expr(c, expr->as.if_.cond);
+		size_t jump_b = emit(c, OP_JUMP_IF_FALSE, COND_IF, 0, expr);
+
+		compile_expr(c, expr->as.if_.a);
+		size_t jump_end = emit(c, OP_JUMP, 0, 0, expr);
+
+		-- c->depth;
+		c->chunk->code[jump_b].arg = c->chunk->size;
+		compile_expr(c, expr->as.if_.b);
+
+		c->chunk->code[jump_end].arg = c->chunk->size;
+	} break;
+
+	case EXPR_TYPE_IDX:
+		compile_expr(c, expr->as.idx.expr);
+		compile_expr(c, expr->as.idx.start);
+		if (expr->as.idx.end != NULL) {
+			compile_expr(c, expr->as.idx.end);
+			emit(c, OP_SLICE, 0, 0, expr);
+		} else
+			emit(c, OP_IDX, 0, 0, expr);
+		break;
+
+	case EXPR_TYPE_DO: {
+		compile_scope_begin(c, expr);
+
+		target_t do_;
+		target_begin(c, &do_, TARGET_DO);
+
+		compile_stmts(c, expr->as.do_.body);
+		emit(c, OP_NIL, 0, 0, expr);
+
+		compiler_patch(c, &do_.breaks, c->chunk->size);
+		target_end(c, &do_);
+
+		compile_scope_end(c, expr);
+	} break;
+
+	case EXPR_TYPE_FUN: compile_expr_fun(c, expr); break;
+
+	case EXPR_TYPE_BIN_OP: compile_expr_bin_op(c, expr); break;
+
+	case EXPR_TYPE_UN_OP:
+		compile_expr(c, expr->as.un_op.expr);
+		emit(c, OP_UN_OP, 0, 0, expr);
+		break;
+
+	default: UNREACHABLE("Unknown expression type");
+	}
+}
+
+chunk_t *compile(stmt_t *program, symtab_t *syms, bool can_return) {
+	chunk_t   *chunk = chunk_new();
+	compiler_t c     = {.chunk = chunk, .unit = chunk, .syms = syms};
+
+	/* Units run in the scope that imports them */
+	compiler_push_scope(&c, true, 0);
+	compile_body(&c, program, can_return? TARGET_FUN : TARGET_UNIT);
+	compiler_deinit(&c);
+	return chunk;
+}
@@ -0,0 +1,131 @@
+#ifndef COMPILER_H_HEADER_GUARD
+#define COMPILER_H_HEADER_GUARD
+
+#include <stdlib.h> /* malloc, realloc, free */
+#include <stdint.h> /* uint8_t, uint32_t */
+#include <stddef.h> /* offsetof */
+#include <assert.h> /* static_assert */
+
+#include "common.h"
+#include "error.h"
+#include "node.h"
+#include "symtab.h"
+
+/* The compiler turns a parsed unit into a flat list of instructions for the stack VM in vm.c.
+ * Instructions keep a pointer to the node they came from, so the VM can reuse the node data
+ * (names, format strings, values) and report errors at the same location the tree walker does
+ *
+ * It also resolves the variables. Scopes opened by the compiled code have their variables in
+ * fixed slots, so identifiers declared in them are annotated with how many scopes up they are
+ * and their slot. Everything else (the top level of a unit, variables of the callers, builtins)
+ * is looked up by its symbol
+ */
+
+typedef enum {
+	OP_NIL = 0,  /* Push nil */
+	OP_VALUE,    /* Push the value of an EXPR_TYPE_VALUE node */
+	OP_FUN,      /* Push the function of an EXPR_TYPE_FUN node */
+	OP_POP,      /* Pop 1 value */
+	OP_POPN,     /* Pop 'arg' values */
+	OP_SLIDE,    /* Move the top value down by 'arg' slots, dropping what was between */
+	OP_GET,      /* Push the value of a resolved variable */
+	OP_ARR,      /* Pop 'arg' values into a new array */
+	OP_MAP,      /* Pop 'arg' keys, each followed by its value, into a new map */
+	OP_REC,      /* Pop 'arg' fields into a new record */
+	OP_FMT,      /* Pop 'arg' values into a formatted string */
+	OP_CALL,     /* Call the value below 'arg' arguments */
+	OP_IDX,      /* [value][index] */
+	OP_SLICE,    /* [value][start][end] */
+	OP_BIN_OP,   /* [left][right] */
+	OP_UN_OP,    /* [value] */
+	OP_AND,      /* Jump to 'arg' if the top is false, pop it otherwise */
+	OP_OR,       /* Jump to 'arg' if the top is true, pop it otherwise */
+	OP_CHECK_BOOL,
+	OP_SET,        /* [value] */
+	OP_SET_IDX,    /* [value][index][target], the target is [collection][index] with 'sub' set */
+	OP_UPDATE,     /* [value] */
+	OP_UPDATE_IDX, /* [value][index][target] */
+	OP_JUMP,
+	OP_JUMP_IF_FALSE,
+	OP_SCOPE_BEGIN,  /* Begin a scope with 'arg' reserved slots */
+	OP_SCOPE_END,
+	OP_DECLARE,      /* Declare the variable of a statement in the current scope */
+	OP_DEFINE,       /* Pop the value of a declared variable */
+	OP_FOREACH_INIT, /* [collection] -> [collection][length][index], maps have slots as length */
+	OP_FOREACH_NEXT, /* Set the iteration variables or jump to 'arg' when done */
+	OP_DEFER,
+	OP_IMPORT,
+	OP_ERROR,        /* Error with the message 'arg' at the location of the node */
+	OP_RETURN,
+
+	OP_COUNT,
+} opcode_t;
+
+/* Kinds of conditions, for the error messages */
+enum {
+	COND_IF = 0,
+	COND_WHILE,
+	COND_FOR,
+
+	COND_COUNT,
+};
+
+/* Kinds of variable declarations */
+enum {
+	DECL_LET = 0,
+	DECL_ENUM,
+	DECL_FUN,
+	DECL_ITER_VALUE,
+	DECL_ITERATOR,
+
+	DECL_COUNT,
+};
+
+/* Messages of OP_ERROR */
+enum {
+	ERR_UNEXPECTED_RETURN = 0,
+	ERR_UNEXPECTED_BREAK,
+	ERR_UNEXPECTED_CONTINUE,
+	ERR_RETURN_IN_FOR,
+	ERR_RETURN_IN_FOR_STEP,
+	ERR_BREAK_IN_FOR_STEP,
+	ERR_CONTINUE_IN_FOR_STEP,
+	ERR_ASSIGN_TO_SLICE,
+	ERR_ASSIGN_EXPECTED_VAR,
+	ERR_INC_EXPECTED_VAR,
+	ERR_DEC_EXPECTED_VAR,
+	ERR_XINC_EXPECTED_VAR,
+	ERR_XDEC_EXPECTED_VAR,
+
+	ERR_COUNT,
+};
+
+extern const char *compile_errors[ERR_COUNT];
+
+const char *decl_redeclared_msg(int kind, bool const_);
+
+typedef struct {
+	uint8_t  op, sub;
+	uint32_t arg;
+	void    *node; /* expr_t* or stmt_t*, both start with their where_t */
+} inst_t;
+
+static_assert(offsetof(expr_t, where) == 0); /* The VM reads the location through inst_t.node */
+static_assert(offsetof(stmt_t, where) == 0);
+
+struct chunk {
+	inst_t *code;
+	size_t  size, cap;
+	size_t  max_depth; /* Most values the chunk keeps on the stack at once */
+	size_t  statics;   /* Slots of the call scope of function bodies, the arguments come first */
+
+	chunk_t **subs; /* Function bodies and deferred statements */
+	size_t    subs_size, subs_cap;
+};
+
+/* Compiles the unit and every function and deferred statement inside of it. Units compiled with
+   can_return accept a top level 'return', like the ones of 'inline'. Names are interned in syms */
+chunk_t *compile(stmt_t *program, symtab_t *syms, bool can_return);
+void     chunk_free(chunk_t *chunk);
+
+#endif
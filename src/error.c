@@ -5,7 +5,7 @@ size_t *callstack_size = NULL;
 
 void from(where_t where) {
 	color_bold(stderr);
-	fprintf(stderr, "%s:%i:%i: ", where.path, where.row, where.col);
+	fprintf(stderr, "%s:%i:%i: ", where_path(where), (int)where.row, (int)where.col);
 	color_fg(stderr, COLOR_BCYAN);
 	fprintf(stderr, "From here");
 	color_reset(stderr);
@@ -21,7 +21,7 @@ void error(where_t where, const char *fmt, ...) {
 	va_end(args);
 
 	color_bold(stderr);
-	fprintf(stderr, "%s:%i:%i: ", where.path, where.row, where.col);
+	fprintf(stderr, "%s:%i:%i: ", where_path(where), (int)where.row, (int)where.col);
 	color_fg(stderr, COLOR_BRED);
 	fprintf(stderr, "Error:");
 	color_reset(stderr);
@@ -52,8 +52,8 @@ void print_callstack(void) {
 			fprintf(stderr, "  -> ");
 			color_reset(stderr);
 			color_bold(stderr);
-			fprintf(stderr, "%s:%i:%i: ",
-			        callstack[i].where.path, callstack[i].where.row, callstack[i].where.col);
+			fprintf(stderr, "%s:%i:%i: ", where_path(callstack[i].where),
+			        (int)callstack[i].where.row, (int)callstack[i].where.col);
 			color_fg(stderr, COLOR_GREY);
 			fprintf(stderr, "called from here\n");
 			color_reset(stderr);
@@ -1,8 +1,9 @@
 #include "eval.h"
+#include "vm.h"
 
 /* 1.7k+ lines of hell */
 
-static void env_scope_begin(env_t *e) {
+void env_scope_begin(env_t *e) {
 	if (e->scope == NULL)
 		e->scope = e->scopes;
 	else
@@ -10,6 +11,8 @@ static void env_scope_begin(env_t *e) {
 		++ e->scope;
 
 	e->scope->vars_count = 0;
+	e->scope->statics    = 0;
+	e->scope->dynamic    = 0;
 	if (e->scope->vars == NULL) {
 		e->scope->vars_cap = VARS_CHUNK;
 		e->scope->vars     = (var_t*)malloc(e->scope->vars_cap * sizeof(var_t));
@@ -26,16 +29,33 @@ static void env_scope_begin(env_t *e) {
 	}
 }
 
-static void env_gc(env_t *e) {
-	size_t cap = 1, size = 0;
+/* Only for scopes that were just begun, nothing is bound to their variables yet */
+void env_scope_reserve(env_t *e, size_t statics) {
+	if (statics > e->scope->vars_cap) {
+		do
+			e->scope->vars_cap *= 2;
+		while (statics > e->scope->vars_cap);
+
+		e->scope->vars = (var_t*)realloc(e->scope->vars, e->scope->vars_cap * sizeof(var_t));
+		if (e->scope->vars == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	for (size_t i = 0; i < statics; ++ i)
+		e->scope->vars[i].name = NULL;
+
+	e->scope->vars_count = statics;
+	e->scope->statics    = statics;
+}
+
+static void env_collect(env_t *e, gc_work_t work) {
+	/* Values on the value stack are roots too */
+	size_t cap = 1 + e->stack_size, size = 0;
 	for (scope_t *scope = e->scope; scope != e->scopes - 1; -- scope)
 		cap += scope->vars_count;
 
-	if (cap == 0)
-		cap = 1;
-
-	value_t *refs = (value_t*)malloc(cap * sizeof(value_t));
-	if (refs == NULL)
+	value_t **roots = (value_t**)malloc(cap * sizeof(value_t*));
+	if (roots == NULL)
 		UNREACHABLE("malloc() fail");
 
 	for (scope_t *scope = e->scope; scope != e->scopes - 1; -- scope) {
@@ -43,34 +63,97 @@ static void env_gc(env_t *e) {
 			if (scope->vars[i].name == NULL)
 				continue;
 
-			value_t val = scope->vars[i].val;
-			if (val.type == VALUE_TYPE_STR || val.type == VALUE_TYPE_ARR)
-				refs[size ++] = val;
+			value_t *val = &scope->vars[i].val;
+			if (value_is_obj(*val))
+				roots[size ++] = val;
 		}
 	}
 
-	refs[size ++] = e->return_;
+	for (size_t i = 0; i < e->stack_size; ++ i) {
+		if (value_is_obj(e->stack[i]))
+			roots[size ++] = e->stack + i;
+	}
+
+	roots[size ++] = &e->return_;
+
+	gc_collect(&e->gc, roots, size, work);
+	free(roots);
+}
+
+void env_gc(env_t *e) {
+	env_collect(e, GC_MAJOR);
+}
 
-	gc_mas(&e->gc, refs, size);
-	free(refs);
+static void env_unbind(env_t *e, var_t *var) {
+	e->binds[var->sym] = var->shadowed;
 }
 
-static void env_scope_end(env_t *e) {
-	for (size_t i = e->scope->defer_count; i --> 0;)
-		eval(e, e->scope->defer[i], e->path);
+void env_scope_end(env_t *e) {
+	for (size_t i = e->scope->defer_count; i --> 0;) {
+		stmt_t *defer = e->scope->defer[i];
+		if (e->walk)
+			eval(e, defer->as.defer.stmt, e->path);
+		else
+			vm_run_defer(e, defer);
+	}
+
+	for (size_t i = 0; i < e->scope->vars_count; ++ i) {
+		if (e->scope->vars[i].name != NULL)
+			env_unbind(e, &e->scope->vars[i]);
+	}
+
+	e->dynamic_vars -= e->scope->dynamic;
 
 	-- e->scope;
-	env_gc(e);
+	gc_work_t work = gc_pending(&e->gc);
+	if (work != GC_NONE)
+		env_collect(e, work);
+}
+
+/* Symbols can be interned after the binds were allocated (by compiling or by name) */
+void env_sync_binds(env_t *e) {
+	if (e->syms.count <= e->binds_cap)
+		return;
+
+	size_t prev = e->binds_cap;
+	while (e->syms.count > e->binds_cap)
+		e->binds_cap *= 2;
+
+	e->binds = (var_t**)realloc(e->binds, sizeof(var_t*) * e->binds_cap);
+	if (e->binds == NULL)
+		UNREACHABLE("realloc() fail");
+
+	memset(e->binds + prev, 0, sizeof(var_t*) * (e->binds_cap - prev));
+}
+
+static bool env_is_declared_in_scope(env_t *e, uint32_t sym) {
+	var_t *var = e->binds[sym];
+	return var != NULL && var >= e->scope->vars && var < e->scope->vars + e->scope->vars_count;
+}
+
+static void env_bind(env_t *e, var_t *var, const char *name, uint32_t sym, bool const_) {
+	var->name     = (char*)name;
+	var->sym      = sym;
+	var->const_   = const_;
+	var->val      = value_nil();
+	var->shadowed = e->binds[sym];
+
+	e->binds[sym] = var;
 }
 
-static var_t *env_new_var(env_t *e, const char *name, bool const_) {
+var_t *env_new_var(env_t *e, const char *name, bool const_) {
+	uint32_t sym = symtab_intern(&e->syms, name);
+	env_sync_binds(e);
+
+	if (env_is_declared_in_scope(e, sym))
+		return NULL;
+
 	size_t idx = -1;
-	for (size_t i = 0; i < e->scope->vars_count; ++ i) {
+	for (size_t i = e->scope->statics; i < e->scope->vars_count; ++ i) {
 		if (e->scope->vars[i].name == NULL) {
-			if (idx == (size_t)-1)
-				idx = i;
-		} else if (strcmp(e->scope->vars[i].name, name) == 0)
-			return NULL;
+			idx = i;
+			break;
+		}
 	}
 
 	if (idx == (size_t)-1) {
@@ -79,29 +162,43 @@ static var_t *env_new_var(env_t *e, const char *name, bool const_) {
 			e->scope->vars = (var_t*)realloc(e->scope->vars, e->scope->vars_cap * sizeof(var_t));
 			if (e->scope->vars == NULL)
 				UNREACHABLE("realloc() fail");
+
+			/* The variables of the innermost scope cannot be shadowed, so they are all bound */
+			for (size_t i = 0; i < e->scope->vars_count; ++ i) {
+				if (e->scope->vars[i].name != NULL)
+					e->binds[e->scope->vars[i].sym] = e->scope->vars + i;
+			}
 		}
 
 		idx = e->scope->vars_count ++;
 	}
 
-	e->scope->vars[idx].name   = (char*)name;
-	e->scope->vars[idx].const_ = const_;
-	e->scope->vars[idx].val    = value_nil();
+	if (e->scope != e->scopes) {
+		++ e->scope->dynamic;
+		++ e->dynamic_vars;
+	}
+
+	env_bind(e, e->scope->vars + idx, name, sym, const_);
 	return e->scope->vars + idx;
 }
 
-static var_t *env_get_var(env_t *e, char *name) {
-	for (scope_t *scope = e->scope; scope != e->scopes - 1; -- scope) {
-		for (size_t i = 0; i < scope->vars_count; ++ i) {
-			if (scope->vars[i].name == NULL)
-				continue;
+/* Declares a resolved variable in its reserved slot, NULL if it was already declared by name */
+var_t *env_new_static(env_t *e, const char *name, uint32_t sym, uint32_t slot, bool const_) {
+	assert(slot < e->scope->statics);
 
-			if (strcmp(scope->vars[i].name, name) == 0)
-				return &scope->vars[i];
-		}
-	}
+	if (e->scope->dynamic > 0 && env_is_declared_in_scope(e, sym))
+		return NULL;
 
-	return NULL;
+	env_bind(e, e->scope->vars + slot, name, sym, const_);
+	return e->scope->vars + slot;
+}
+
+var_t *env_get_var(env_t *e, char *name) {
+	uint32_t sym = symtab_find(&e->syms, name);
+	if (sym == SYM_NONE || sym >= e->binds_cap)
+		return NULL;
+
+	return e->binds[sym];
 }
 
 void env_init(env_t *e, int argc, const char **argv) {
@@ -112,6 +209,13 @@ void env_init(env_t *e, int argc, const char **argv) {
 	e->argc = argc;
 	e->argv = argv;
 
+	gc_init(&e->gc);
+	symtab_init(&e->syms);
+	e->binds_cap = 64;
+	e->binds     = (var_t**)calloc(e->binds_cap, sizeof(var_t*));
+	if (e->binds == NULL)
+		UNREACHABLE("malloc() fail");
+
 	env_scope_begin(e);
 
 	for (size_t i = 0; i < sizeof(builtins) / sizeof(*builtins); ++ i) {
@@ -120,16 +224,25 @@ void env_init(env_t *e, int argc, const char **argv) {
 		var_t *var = env_new_var(e, builtins[i].name, true);
 		assert(var != NULL);
 
-		var->val = value_nat(builtins[i].func);
+		var->val = value_nat((value_nat_t*)&builtins[i].func);
 	}
 
 	env_new_var(e, "PI", true)->val = value_num(3.1415926535);
 
 	e->to_free_cap = 32;
-	e->to_free     = (stmt_t**)malloc(sizeof(stmt_t*) * e->to_free_cap);
+	e->to_free     = (arena_t*)malloc(sizeof(arena_t) * e->to_free_cap);
 	if (e->to_free == NULL)
 		UNREACHABLE("malloc() fail");
 
+	e->chunks_cap = 32;
+	e->chunks     = (chunk_t**)malloc(sizeof(chunk_t*) * e->chunks_cap);
+	if (e->chunks == NULL)
+		UNREACHABLE("malloc() fail");
+
+	e->stack = (value_t*)malloc(sizeof(value_t) * STACK_CAPACITY);
+	if (e->stack == NULL)
+		UNREACHABLE("malloc() fail");
+
 	e->callstack_cap = 64;
 	e->callstack     = (call_t*)malloc(sizeof(call_t) * e->callstack_cap);
 	if (e->callstack == NULL)
@@ -141,6 +254,7 @@ void env_init(env_t *e, int argc, const char **argv) {
 
 void env_deinit(env_t *e) {
 	env_scope_end(e);
+	env_gc(e); /* Nothing is alive anymore */
 
 	for (size_t i = 0; i < MAX_NEST; ++ i) {
 		if (e->scopes[i].vars != NULL)
@@ -157,10 +271,19 @@ void env_deinit(env_t *e) {
 		free(e->imported[i]);
 
 	for (size_t i = 0; i < e->to_free_size; ++ i)
-		stmt_free(e->to_free[i]);
+		arena_free(&e->to_free[i]);
+
+	for (size_t i = 0; i < e->chunks_size; ++ i)
+		chunk_free(e->chunks[i]);
 
 	free(e->to_free);
+	free(e->chunks);
+	free(e->stack);
 	free(e->callstack);
+	free(e->binds);
+
+	gc_deinit(&e->gc);
+	symtab_deinit(&e->syms);
 
 	callstack = NULL;
 }
@@ -168,16 +291,27 @@ void env_deinit(env_t *e) {
 static value_t eval_expr(env_t *e, expr_t *expr);
 
 static void fprint_value(value_t value, FILE *file) {
-	switch (value.type) {
+	switch (value_type(value)) {
 	case VALUE_TYPE_NAT:  fprintf(file, "(native)"); break;
-	case VALUE_TYPE_ARR:  fprintf(file, "(list %p)", (void*)value.as.arr.buf);   break;
-	case VALUE_TYPE_FUN:  fprintf(file, "(fun %p)",  (void*)value.as.fun);       break;
+	case VALUE_TYPE_ARR:  fprintf(file, "(list %p)", (void*)value_as_arr(value));   break;
+	case VALUE_TYPE_MAP:  fprintf(file, "(map %p)",  (void*)value_as_map(value));   break;
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S:
+		fprintf(file, "(%s %p)", value_type_to_cstr(value_type(value)),
+		        (void*)value_as_packed(value));
+		break;
+	case VALUE_TYPE_REC:
+		fprintf(file, "(record %s %p)", value_as_rec(value)->shape->name,
+		        (void*)value_as_rec(value));
+		break;
+
+	case VALUE_TYPE_FUN:  fprintf(file, "(fun %p)",  (void*)value_as_fun(value));       break;
 	case VALUE_TYPE_NIL:  fprintf(file, "(nil)");                                break;
-	case VALUE_TYPE_STR:  fprintf(file, "%s", value.as.str);                     break;
-	case VALUE_TYPE_BOOL: fprintf(file, "%s", value.as.bool_? "true" : "false"); break;
+	case VALUE_TYPE_STR:  fwrite(value_str_buf(&value), 1, value_str_len(value), file); break;
+	case VALUE_TYPE_BOOL: fprintf(file, "%s", value_as_bool(value)? "true" : "false"); break;
 	case VALUE_TYPE_NUM: {
 		char buf[64] = {0};
-		double_to_str(value.as.num, buf, sizeof(buf));
+		double_to_str(value_as_num(value), buf, sizeof(buf));
 		fprintf(file, "%s", buf);
 	} break;
 
@@ -185,6 +319,15 @@ static void fprint_value(value_t value, FILE *file) {
 	}
 }
 
+/* Views are not terminated, they get their own copy of the text before it goes to C functions.
+   Short strings always are, by the zero bytes after their text */
+static const char *str_cstr(env_t *e, const value_t *str) {
+	if (!value_is_short_str(*str) && value_as_str(*str)->buf[value_as_str(*str)->len] != '\0')
+		gc_unview(&e->gc, *str);
+
+	return value_str_buf(str);
+}
+
 static value_t builtin_print(env_t *e, expr_t *expr, value_t *args) {
 	UNUSED(e);
 	expr_call_t *call = &expr->as.call;
@@ -213,7 +356,8 @@ static value_t builtin_panic(env_t *e, expr_t *expr, value_t *args) {
 	expr_call_t *call = &expr->as.call;
 
 	color_bold(stderr);
-	fprintf(stderr, "%s:%i:%i: ", expr->where.path, expr->where.row, expr->where.col);
+	fprintf(stderr, "%s:%i:%i: ", where_path(expr->where), (int)expr->where.row,
+	        (int)expr->where.col);
 	color_fg(stderr, COLOR_BRED);
 	fprintf(stderr, "panic():");
 	color_reset(stderr);
@@ -236,13 +380,16 @@ static value_t builtin_len(env_t *e, expr_t *expr, value_t *args) {
 	if (call->args_count != 1)
 		wrong_arg_count(expr->where, call->args_count, 1);
 
-	/* TODO: Make length be stored with the string pointer, so its faster */
 	value_t val = args[0];
-	switch (val.type) {
-	case VALUE_TYPE_STR: return value_num(strlen(val.as.str));
-	case VALUE_TYPE_ARR: return value_num(val.as.arr.size);
+	switch (value_type(val)) {
+	case VALUE_TYPE_STR: return value_num(value_str_len(val));
+	case VALUE_TYPE_ARR: return value_num(value_as_arr(val)->size);
+	case VALUE_TYPE_MAP: return value_num(value_as_map(val)->size);
+
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S: return value_num(value_as_packed(val)->size);
 
-	default: wrong_type(expr->where, val.type, "'len' function");
+	default: wrong_type(expr->where, value_type(val), "'len' function");
 	}
 
 	return value_nil();
@@ -252,17 +399,12 @@ static value_t builtin_readnum(env_t *e, expr_t *expr, value_t *args) {
 	UNUSED(e);
 	expr_call_t *call = &expr->as.call;
 
-	value_t list = value_arr(call->args_count);
-	for (size_t i = 0; i < call->args_count; ++ i)
-		list.as.arr.buf[i] = args[i];
-
-	for (size_t i =0 ; i < call->args_count; ++ i) {
+	for (size_t i = 0; i < call->args_count; ++ i) {
 		if (i > 0)
 			putchar(' ');
 
-		fprint_value(list.as.arr.buf[i], stdout);
+		fprint_value(args[i], stdout);
 	}
-	value_free(&list);
 
 	if (call->args_count > 0)
 		putchar(' ');
@@ -286,17 +428,12 @@ static value_t builtin_readstr(env_t *e, expr_t *expr, value_t *args) {
 	UNUSED(e);
 	expr_call_t *call = &expr->as.call;
 
-	value_t list = value_arr(call->args_count);
-	for (size_t i = 0; i < call->args_count; ++ i)
-		list.as.arr.buf[i] = args[i];
-
-	for (size_t i =0 ; i < call->args_count; ++ i) {
+	for (size_t i = 0; i < call->args_count; ++ i) {
 		if (i > 0)
 			putchar(' ');
 
-		fprint_value(list.as.arr.buf[i], stdout);
+		fprint_value(args[i], stdout);
 	}
-	value_free(&list);
 
 	if (call->args_count > 0)
 		putchar(' ');
@@ -310,10 +447,10 @@ static value_t builtin_readstr(env_t *e, expr_t *expr, value_t *args) {
 	size_t len = strlen(buf);
 	if (len > 0) {
 		if (buf[len - 1] == '\n')
-			buf[len - 1] = '\0';
+			buf[-- len] = '\0';
 	}
 
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap(buf)));
+	return gc_str(&e->gc, buf, len);
 }
 
 static value_t builtin_exit(env_t *e, expr_t *expr, value_t *args) {
@@ -324,10 +461,10 @@ static value_t builtin_exit(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'exit' function");
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'exit' function");
 
-	exit((int)round(val.as.num));
+	exit((int)round(value_as_num(val)));
 }
 
 static value_t builtin_system(env_t *e, expr_t *expr, value_t *args) {
@@ -345,23 +482,41 @@ static value_t builtin_system(env_t *e, expr_t *expr, value_t *args) {
 		char    buf[64] = {0};
 		const char *add = NULL;
 
-		switch (value.type) {
+		switch (value_type(value)) {
 		case VALUE_TYPE_NAT: add = "(native)"; break;
 		case VALUE_TYPE_FUN:
-			sprintf(buf, "(fun %p)", (void*)value.as.fun);
+			sprintf(buf, "(fun %p)", (void*)value_as_fun(value));
 			add = buf;
 			break;
 
 		case VALUE_TYPE_ARR:
-			sprintf(buf, "(list %p)", (void*)value.as.arr.buf);
+			sprintf(buf, "(list %p)", (void*)value_as_arr(value));
+			add = buf;
+			break;
+
+		case VALUE_TYPE_MAP:
+			sprintf(buf, "(map %p)", (void*)value_as_map(value));
+			add = buf;
+			break;
+
+		case VALUE_TYPE_U8S:
+		case VALUE_TYPE_F64S:
+			sprintf(buf, "(%s %p)", value_type_to_cstr(value_type(value)),
+			        (void*)value_as_packed(value));
+			add = buf;
+			break;
+
+		case VALUE_TYPE_REC:
+			snprintf(buf, sizeof(buf), "(record %s %p)", value_as_rec(value)->shape->name,
+			         (void*)value_as_rec(value));
 			add = buf;
 			break;
 
 		case VALUE_TYPE_NIL:  add = "(nil)";      break;
-		case VALUE_TYPE_STR:  add = value.as.str; break;
-		case VALUE_TYPE_BOOL: add = value.as.bool_? "true" : "false"; break;
+		case VALUE_TYPE_STR:  add = str_cstr(e, &value); break;
+		case VALUE_TYPE_BOOL: add = value_as_bool(value)? "true" : "false"; break;
 		case VALUE_TYPE_NUM:
-			double_to_str(value.as.num, buf, sizeof(buf));
+			double_to_str(value_as_num(value), buf, sizeof(buf));
 			add = buf;
 			break;
 
@@ -399,15 +554,15 @@ static value_t builtin_platform(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 0);
 
 #if defined(WIN32)
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap("windows")));
+	return gc_cstr(&e->gc, "windows");
 #elif defined(__APPLE__)
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap("apple")));
+	return gc_cstr(&e->gc, "apple");
 #elif defined(__linux__) || defined(__gnu_linux__) || defined(linux)
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap("linux")));
+	return gc_cstr(&e->gc, "linux");
 #elif defined(__unix__) || defined(unix)
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap("unix")));
+	return gc_cstr(&e->gc, "unix");
 #else
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap("unknown")));
+	return gc_cstr(&e->gc, "unknown");
 #endif
 }
 
@@ -442,10 +597,10 @@ static value_t builtin_argat(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'argat' function");
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'argat' function");
 
-	return value_str((char*)e->argv[(int)round(val.as.num)]);
+	return gc_cstr(&e->gc, e->argv[(int)round(value_as_num(val))]);
 }
 
 static value_t builtin_strtonum(env_t *e, expr_t *expr, value_t *args) {
@@ -456,12 +611,12 @@ static value_t builtin_strtonum(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t val = args[0];
-	if (val.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, val.type, "'strtonum' function");
+	if (value_type(val) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(val), "'strtonum' function");
 
 	char *ptr;
-	double n = (double)strtod(val.as.str, &ptr);
-	if (*ptr != '\0')
+	double n = (double)strtod(str_cstr(e, &val), &ptr);
+	if (ptr != value_str_buf(&val) + value_str_len(val))
 		return value_nil();
 	else
 		return value_num(n);
@@ -475,12 +630,12 @@ static value_t builtin_numtostr(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'numtostr' function");
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'numtostr' function");
 
 	char buf[64] = {0};
-	double_to_str(val.as.num, buf, sizeof(buf));
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap(buf)));
+	double_to_str(value_as_num(val), buf, sizeof(buf));
+	return gc_cstr(&e->gc, buf);
 }
 
 static value_t builtin_getenv(env_t *e, expr_t *expr, value_t *args) {
@@ -491,14 +646,14 @@ static value_t builtin_getenv(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t val = args[0];
-	if (val.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, val.type, "'getenv' function");
+	if (value_type(val) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(val), "'getenv' function");
 
-	char *str = getenv(val.as.str);
+	char *str = getenv(str_cstr(e, &val));
 	if (str == NULL)
 		return value_nil();
 	else
-		return gc_add_elem(&e->gc, value_str(strcpy_to_heap(str)));
+		return gc_cstr(&e->gc, str);
 }
 
 static value_t builtin_type(env_t *e, expr_t *expr, value_t *args) {
@@ -508,8 +663,7 @@ static value_t builtin_type(env_t *e, expr_t *expr, value_t *args) {
 	if (call->args_count != 1)
 		wrong_arg_count(expr->where, call->args_count, 1);
 
-	char *type = (char*)value_type_to_cstr(args[0].type);
-	return gc_add_elem(&e->gc, value_str(strcpy_to_heap(type)));
+	return gc_cstr(&e->gc, value_type_to_cstr(value_type(args[0])));
 }
 
 static value_t builtin_repeat(env_t *e, expr_t *expr, value_t *args) {
@@ -520,22 +674,21 @@ static value_t builtin_repeat(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 2);
 
 	value_t str = args[0];
-	if (str.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, str.type, "'repeat' function argument #1");
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'repeat' function argument #1");
 
 	value_t n = args[1];
-	if (n.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, n.type, "'repeat' function argument #2");
+	if (value_type(n) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(n), "'repeat' function argument #2");
 
-	char *repeated = (char*)malloc(strlen(str.as.str) * (int)round(n.as.num) + 1);
-	if (repeated == NULL)
-		UNREACHABLE("malloc() fail");
+	int    count = (int)round(value_as_num(n));
+	size_t len   = value_str_len(str);
 
-	*repeated = '\0';
-	for (int i = 0; i < (int)round(n.as.num); ++ i)
-		strcat(repeated, str.as.str);
+	value_t repeated = gc_str(&e->gc, NULL, count > 0? len * count : 0);
+	for (int i = 0; i < count; ++ i)
+		memcpy(value_as_str(repeated)->buf + len * i, value_str_buf(&str), len);
 
-	return gc_add_elem(&e->gc, value_str(repeated));
+	return repeated;
 }
 
 static value_t builtin_rand(env_t *e, expr_t *expr, value_t *args) {
@@ -557,10 +710,10 @@ static value_t builtin_srand(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t seed = args[0];
-	if (seed.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, seed.type, "'srand' function");
+	if (value_type(seed) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(seed), "'srand' function");
 
-	srand((int)seed.as.num);
+	srand((int)value_as_num(seed));
 	return value_nil();
 }
 
@@ -572,11 +725,16 @@ static value_t builtin_freadstr(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t path = args[0];
-	if (path.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, path.type, "'freadstr' function");
+	if (value_type(path) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(path), "'freadstr' function");
+
+	char *str = readfile(str_cstr(e, &path));
+	if (str == NULL)
+		return value_nil();
 
-	char *str = readfile(path.as.str);
-	return str == NULL? value_nil() : gc_add_elem(&e->gc, value_str(str));
+	value_t val = gc_cstr(&e->gc, str);
+	free(str);
+	return val;
 }
 
 static value_t builtin_freadbytes(env_t *e, expr_t *expr, value_t *args) {
@@ -587,10 +745,10 @@ static value_t builtin_freadbytes(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t path = args[0];
-	if (path.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, path.type, "'freadbytes' function");
+	if (value_type(path) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(path), "'freadbytes' function");
 
-	FILE *file = fopen(path.as.str, "rb");
+	FILE *file = fopen(str_cstr(e, &path), "rb");
 	if (file == NULL)
 		return value_nil();
 
@@ -598,9 +756,36 @@ static value_t builtin_freadbytes(env_t *e, expr_t *expr, value_t *args) {
 	size_t size = (size_t)ftell(file);
 	rewind(file);
 
-	value_t bytes = gc_add_elem(&e->gc, value_arr(size));
+	value_t bytes = gc_arr(&e->gc, size);
 	for (size_t i = 0; i < size; ++ i)
-		bytes.as.arr.buf[i] = value_num(fgetc(file));
+		value_as_arr(bytes)->buf[i] = value_num(fgetc(file));
+
+	fclose(file);
+	return bytes;
+}
+
+/* Like freadbytes, but into a u8 array with one fread */
+static value_t builtin_freadu8array(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t path = args[0];
+	if (value_type(path) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(path), "'freadu8array' function");
+
+	FILE *file = fopen(str_cstr(e, &path), "rb");
+	if (file == NULL)
+		return value_nil();
+
+	fseek(file, 0, SEEK_END);
+	size_t size = (size_t)ftell(file);
+	rewind(file);
+
+	value_t bytes = gc_packed(&e->gc, VALUE_TYPE_U8S, size);
+	value_as_packed(bytes)->size = fread(value_as_packed(bytes)->buf, 1, size, file);
 
 	fclose(file);
 	return bytes;
@@ -614,18 +799,18 @@ static value_t builtin_fwritestr(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 2);
 
 	value_t path = args[0];
-	if (path.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, path.type, "'fwritestr' function argument #1");
+	if (value_type(path) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(path), "'fwritestr' function argument #1");
 
 	value_t str = args[1];
-	if (str.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, str.type, "'fwritestr' function argument #2");
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'fwritestr' function argument #2");
 
-	FILE *file = fopen(path.as.str, "w");
+	FILE *file = fopen(str_cstr(e, &path), "w");
 	if (file == NULL)
 		return value_nil();
 
-	fprintf(file, "%s", str.as.str);
+	fwrite(value_str_buf(&str), 1, value_str_len(str), file);
 	fclose(file);
 	return value_nil();
 }
@@ -638,23 +823,29 @@ static value_t builtin_fwritebytes(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 2);
 
 	value_t path = args[0];
-	if (path.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, path.type, "'fwritebytes' function argument #1");
+	if (value_type(path) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(path), "'fwritebytes' function argument #1");
 
 	value_t bytes = args[1];
-	if (bytes.type != VALUE_TYPE_ARR)
-		wrong_type(expr->where, bytes.type, "'fwritebytes' function argument #2");
+	if (value_type(bytes) != VALUE_TYPE_ARR && value_type(bytes) != VALUE_TYPE_U8S)
+		wrong_type(expr->where, value_type(bytes), "'fwritebytes' function argument #2");
 
-	FILE *file = fopen(path.as.str, "wb");
+	FILE *file = fopen(str_cstr(e, &path), "wb");
 	if (file == NULL)
 		return value_nil();
 
-	for (size_t i = 0; i < bytes.as.arr.size; ++ i) {
-		if (bytes.as.arr.buf[i].type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, bytes.as.arr.buf[i].type,
+	if (value_type(bytes) == VALUE_TYPE_U8S) {
+		fwrite(value_as_packed(bytes)->buf, 1, value_as_packed(bytes)->size, file);
+		fclose(file);
+		return value_nil();
+	}
+
+	for (size_t i = 0; i < value_as_arr(bytes)->size; ++ i) {
+		if (value_type(value_as_arr(bytes)->buf[i]) != VALUE_TYPE_NUM)
+			wrong_type(expr->where, value_type(value_as_arr(bytes)->buf[i]),
 			           "'fwritebytes' function argument #2 byte array");
 
-		fputc((int)round(bytes.as.arr.buf[i].as.num), file);
+		fputc((int)round(value_as_num(value_as_arr(bytes)->buf[i])), file);
 	}
 
 	fclose(file);
@@ -669,231 +860,697 @@ static value_t builtin_array(env_t *e, expr_t *expr, value_t *args) {
 		wrong_arg_count(expr->where, call->args_count, 1);
 
 	value_t size = args[0];
-	if (size.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, size.type, "'array' function");
+	if (value_type(size) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(size), "'array' function");
 
-	value_t val = gc_add_elem(&e->gc, value_arr((size_t)round(size.as.num)));
+	value_t val = gc_arr(&e->gc, (size_t)round(value_as_num(size)));
 
-	for (size_t i = 0; i < val.as.arr.size; ++ i)
-		val.as.arr.buf[i] = value_num(0);
+	for (size_t i = 0; i < value_as_arr(val)->size; ++ i)
+		value_as_arr(val)->buf[i] = value_num(0);
 
 	return val;
 }
 
-static value_t eval_with_return(env_t *e, stmt_t *stmt);
-
-static value_t builtin_inline(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
+/* A packed array of the given size, or a copy of the elements of an array or packed array */
+static value_t packed_array(env_t *e, expr_t *expr, value_t *args, value_type_t type,
+                            const char *name) {
 	expr_call_t *call = &expr->as.call;
+	char in[64];
+	snprintf(in, sizeof(in), "'%s' function", name);
 
 	if (call->args_count != 1)
 		wrong_arg_count(expr->where, call->args_count, 1);
 
-	value_t str = args[0];
-	if (str.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, str.type, "'inline' function");
+	value_t from = args[0];
+	if (value_type(from) == VALUE_TYPE_NUM) {
+		if (value_as_num(from) < 0)
+			error(expr->where, "Negative size is not allowed");
 
-	stmt_t *program = parse(str.as.str, e->path);
-	value_t ret     = eval_with_return(e, program);
+		return gc_packed(&e->gc, type, (size_t)round(value_as_num(from)));
+	} else if (value_type(from) == type) {
+		value_t val = gc_packed(&e->gc, type, value_as_packed(from)->size);
+		memcpy(value_as_packed(val)->buf, value_as_packed(from)->buf,
+		       value_as_packed(from)->size * value_packed_width(from));
+		return val;
+	} else if (value_type(from) != VALUE_TYPE_ARR && !value_is_packed(from))
+		wrong_type(expr->where, value_type(from), in);
+
+	size_t  size = value_is_packed(from)? value_as_packed(from)->size : value_as_arr(from)->size;
+	value_t val  = gc_packed(&e->gc, type, size);
+	for (size_t i = 0; i < size; ++ i) {
+		value_t elem = value_is_packed(from)? value_packed_get(from, i) : value_as_arr(from)->buf[i];
+		if (value_type(elem) != VALUE_TYPE_NUM)
+			wrong_type(expr->where, value_type(elem), in);
+
+		double num = value_as_num(elem);
+		if (type == VALUE_TYPE_U8S) {
+			num = round(num);
+			if (!(num >= 0 && num <= 255))
+				error(expr->where, "Byte value out of range");
+		}
 
-	if (e->to_free_size >= e->to_free_cap) {
-		e->to_free_cap *= 2;
-		e->to_free      = (stmt_t**)realloc(e->to_free, sizeof(stmt_t*) * e->to_free_cap);
-		if (e->to_free == NULL)
-			UNREACHABLE("malloc() fail");
+		value_packed_set(val, i, num);
 	}
+	return val;
+}
 
-	e->to_free[e->to_free_size ++] = program;
+static value_t builtin_u8array(env_t *e, expr_t *expr, value_t *args) {
+	return packed_array(e, expr, args, VALUE_TYPE_U8S, "u8array");
+}
 
-	return ret;
+static value_t builtin_f64array(env_t *e, expr_t *expr, value_t *args) {
+	return packed_array(e, expr, args, VALUE_TYPE_F64S, "f64array");
 }
 
-static value_t builtin_gc(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
+/* The numbers of an array, u8 array or f64 array. F64 arrays are read in place, the rest are
+   unboxed into a buffer that the caller frees */
+static double *arr_nums(expr_t *expr, value_t arr, const char *name, int arg, double **owned) {
+	char in[64];
+	snprintf(in, sizeof(in), "'%s' function argument #%i", name, arg);
 
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+	*owned = NULL;
+	if (value_type(arr) == VALUE_TYPE_F64S)
+		return (double*)value_as_packed(arr)->buf;
+	else if (value_type(arr) == VALUE_TYPE_U8S) {
+		size_t size = value_as_packed(arr)->size;
+		*owned = (double*)malloc((size + 1) * sizeof(double));
+		if (*owned == NULL)
+			UNREACHABLE("malloc() fail");
 
-	env_gc(e);
-	return value_nil();
-}
+		for (size_t i = 0; i < size; ++ i)
+			(*owned)[i] = (unsigned char)value_as_packed(arr)->buf[i];
 
-static value_t builtin_strtobytes(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	expr_call_t *call = &expr->as.call;
+		return *owned;
+	} else if (value_type(arr) != VALUE_TYPE_ARR)
+		wrong_type(expr->where, value_type(arr), in);
 
-	if (call->args_count != 1)
-		wrong_arg_count(expr->where, call->args_count, 1);
+	size_t size = value_as_arr(arr)->size;
+	for (size_t i = 0; i < size; ++ i) {
+		if (value_type(value_as_arr(arr)->buf[i]) != VALUE_TYPE_NUM) {
+			strcat(in, " number array");
+			wrong_type(expr->where, value_type(value_as_arr(arr)->buf[i]), in);
+		}
+	}
 
-	value_t str = args[0];
-	if (str.type != VALUE_TYPE_STR)
-		wrong_type(expr->where, str.type, "'strtobytes' function");
+	*owned = (double*)malloc((size + 1) * sizeof(double));
+	if (*owned == NULL)
+		UNREACHABLE("malloc() fail");
 
-	value_t bytes = gc_add_elem(&e->gc, value_arr(strlen(str.as.str)));
+	for (size_t i = 0; i < size; ++ i)
+		(*owned)[i] = value_as_num(value_as_arr(arr)->buf[i]);
 
-	for (size_t i = 0; i < bytes.as.arr.size; ++ i)
-		bytes.as.arr.buf[i] = value_num((float)str.as.str[i]);
+	return *owned;
+}
 
-	return bytes;
+static size_t arr_size(value_t arr) {
+	return value_is_packed(arr)? value_as_packed(arr)->size : value_as_arr(arr)->size;
 }
 
-static value_t builtin_bytestostr(env_t *e, expr_t *expr, value_t *args) {
+typedef enum {
+	REDUCE_SUM = 0,
+	REDUCE_MIN,
+	REDUCE_MAX,
+} reduce_t;
+
+/* Minimum and maximum of an empty array are nil */
+static value_t arr_reduce(env_t *e, expr_t *expr, value_t *args, reduce_t reduce,
+                          const char *name) {
 	UNUSED(e);
 	expr_call_t *call = &expr->as.call;
 
 	if (call->args_count != 1)
 		wrong_arg_count(expr->where, call->args_count, 1);
 
-	value_t bytes = args[0];
-	if (bytes.type != VALUE_TYPE_ARR)
-		wrong_type(expr->where, bytes.type, "'bytestostr' function");
+	double *owned, *xs = arr_nums(expr, args[0], name, 1, &owned);
+	size_t  size = arr_size(args[0]);
 
-	char *str = (char*)malloc(bytes.as.arr.size + 1);
-	if (str == NULL)
-		UNREACHABLE("malloc() fail");
+	value_t val;
+	switch (reduce) {
+	case REDUCE_SUM: val = value_num(kernel_sum(xs, size)); break;
+	case REDUCE_MIN: val = size == 0? value_nil() : value_num(kernel_min(xs, size)); break;
+	case REDUCE_MAX: val = size == 0? value_nil() : value_num(kernel_max(xs, size)); break;
 
-	for (size_t i = 0; i < bytes.as.arr.size; ++ i) {
-		if (bytes.as.arr.buf[i].type != VALUE_TYPE_NUM)
-			error(expr->where, "'bytestostr' function expected a byte array");
-		str[i] = (char)round(bytes.as.arr.buf[i].as.num);
+	default: UNREACHABLE("Unknown reduction");
 	}
 
-	str[bytes.as.arr.size] = '\0';
-	return gc_add_elem(&e->gc, value_str(str));
+	free(owned);
+	return val;
 }
 
-static value_t builtin_round(env_t *e, expr_t *expr, value_t *args) {
+static value_t builtin_arrsum(env_t *e, expr_t *expr, value_t *args) {
+	return arr_reduce(e, expr, args, REDUCE_SUM, "arrsum");
+}
+
+static value_t builtin_arrmin(env_t *e, expr_t *expr, value_t *args) {
+	return arr_reduce(e, expr, args, REDUCE_MIN, "arrmin");
+}
+
+static value_t builtin_arrmax(env_t *e, expr_t *expr, value_t *args) {
+	return arr_reduce(e, expr, args, REDUCE_MAX, "arrmax");
+}
+
+static value_t builtin_arrdot(env_t *e, expr_t *expr, value_t *args) {
 	UNUSED(e);
 	expr_call_t *call = &expr->as.call;
 
-	if (call->args_count != 1)
-		wrong_arg_count(expr->where, call->args_count, 1);
+	if (call->args_count != 2)
+		wrong_arg_count(expr->where, call->args_count, 2);
 
-	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'round' function");
+	double *owned_a, *a = arr_nums(expr, args[0], "arrdot", 1, &owned_a);
+	double *owned_b, *b = arr_nums(expr, args[1], "arrdot", 2, &owned_b);
+	if (arr_size(args[0]) != arr_size(args[1]))
+		error(expr->where, "'arrdot' function expected arrays of the same length");
 
-	return value_num(round(val.as.num));
+	value_t val = value_num(kernel_dot(a, b, arr_size(args[0])));
+	free(owned_a);
+	free(owned_b);
+	return val;
 }
 
-static value_t builtin_floor(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
+/* Elementwise operations give a new f64 array */
+static value_t arr_zip(env_t *e, expr_t *expr, value_t *args,
+                       void (*kernel)(double*, const double*, const double*, size_t),
+                       const char *name) {
 	expr_call_t *call = &expr->as.call;
 
-	if (call->args_count != 1)
-		wrong_arg_count(expr->where, call->args_count, 1);
+	if (call->args_count != 2)
+		wrong_arg_count(expr->where, call->args_count, 2);
 
-	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'floor' function");
+	double *owned_a, *a = arr_nums(expr, args[0], name, 1, &owned_a);
+	double *owned_b, *b = arr_nums(expr, args[1], name, 2, &owned_b);
+	if (arr_size(args[0]) != arr_size(args[1]))
+		error(expr->where, "'%s' function expected arrays of the same length", name);
 
-	return value_num(floor(val.as.num));
+	value_t val = gc_packed(&e->gc, VALUE_TYPE_F64S, arr_size(args[0]));
+	kernel((double*)value_as_packed(val)->buf, a, b, arr_size(args[0]));
+	free(owned_a);
+	free(owned_b);
+	return val;
 }
 
-static value_t builtin_ceil(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
+static value_t builtin_arradd(env_t *e, expr_t *expr, value_t *args) {
+	return arr_zip(e, expr, args, kernel_add, "arradd");
+}
+
+static value_t builtin_arrmul(env_t *e, expr_t *expr, value_t *args) {
+	return arr_zip(e, expr, args, kernel_mul, "arrmul");
+}
+
+static value_t builtin_arrscale(env_t *e, expr_t *expr, value_t *args) {
 	expr_call_t *call = &expr->as.call;
 
-	if (call->args_count != 1)
-		wrong_arg_count(expr->where, call->args_count, 1);
+	if (call->args_count != 2)
+		wrong_arg_count(expr->where, call->args_count, 2);
 
-	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'ceil' function");
+	double *owned, *xs = arr_nums(expr, args[0], "arrscale", 1, &owned);
 
-	return value_num(ceil(val.as.num));
+	value_t by = args[1];
+	if (value_type(by) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(by), "'arrscale' function argument #2");
+
+	value_t val = gc_packed(&e->gc, VALUE_TYPE_F64S, arr_size(args[0]));
+	kernel_scale((double*)value_as_packed(val)->buf, xs, value_as_num(by), arr_size(args[0]));
+	free(owned);
+	return val;
 }
 
-static value_t builtin_abs(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
+static value_t builtin_arrprefixsum(env_t *e, expr_t *expr, value_t *args) {
 	expr_call_t *call = &expr->as.call;
 
 	if (call->args_count != 1)
 		wrong_arg_count(expr->where, call->args_count, 1);
 
-	value_t val = args[0];
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'abs' function");
+	double *owned, *xs = arr_nums(expr, args[0], "arrprefixsum", 1, &owned);
 
-	return value_num(fabs(val.as.num));
+	value_t val = gc_packed(&e->gc, VALUE_TYPE_F64S, arr_size(args[0]));
+	kernel_prefix_sum((double*)value_as_packed(val)->buf, xs, arr_size(args[0]));
+	free(owned);
+	return val;
 }
 
-static value_t builtin_gettime(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
+static void    eval_hold(       env_t *e, expr_t *expr, value_t val);
+static value_t eval_release(    env_t *e);
+static value_t eval_with_return(env_t *e, stmt_t *stmt);
 
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+/* Calls a function from a builtin. The arguments have to be on top of the value stack, and are
+   popped with the call */
+static value_t call_fun(env_t *e, expr_t *expr, value_t to_call, value_t *args, size_t count) {
+	expr_fun_t *fun = (expr_fun_t*)value_as_fun(to_call);
+	if (fun->args_count != count)
+		error(expr->where, "Function expected %i arguments, got %i",
+		      (int)fun->args_count, (int)count);
+
+	env_call_begin(e, expr, fun, args);
+	if (e->walk) {
+		eval_hold(e, expr, eval_with_return(e, fun->body));
+		e->return_ = value_nil();
+	} else
+		vm_run_fun(e, fun, expr->where);
 
-	return value_num(time(NULL) * 1000);
+	env_call_end(e);
+	value_t val = eval_release(e);
+	e->stack_size = args - e->stack;
+	return val;
 }
 
-static value_t builtin_getyear(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
+/* Elements are read again after every call, since calls can collect garbage and move them */
+static value_t arr_elem(value_t arr, size_t i) {
+	return value_is_packed(arr)? value_packed_get(arr, i) : value_as_arr(arr)->buf[i];
+}
 
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+/* Comparators tell if their first argument goes before the second one */
+static bool call_less(env_t *e, expr_t *expr, value_t less, value_t a, value_t b,
+                      const char *name) {
+	value_t *args = e->stack + e->stack_size;
+	eval_hold(e, expr, a);
+	eval_hold(e, expr, b);
 
-	time_t    t  = time(NULL);
-	struct tm tm = *localtime(&t);
+	value_t val = call_fun(e, expr, less, args, 2);
+	if (value_type(val) != VALUE_TYPE_BOOL) {
+		char in[64];
+		snprintf(in, sizeof(in), "'%s' function comparator result", name);
+		wrong_type(expr->where, value_type(val), in);
+	}
 
-	return value_num(tm.tm_year + 1900);
+	return value_as_bool(val);
 }
 
-static value_t builtin_getmonth(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
-
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+/* Without a comparator, numbers and strings are compared by themselves */
+static bool value_less(expr_t *expr, value_t a, value_t b, const char *name) {
+	char in[64];
+	snprintf(in, sizeof(in), "'%s' function, expected numbers or strings", name);
 
-	time_t    t  = time(NULL);
-	struct tm tm = *localtime(&t);
+	if (value_type(a) == VALUE_TYPE_NUM && value_type(b) == VALUE_TYPE_NUM)
+		return value_as_num(a) < value_as_num(b);
+	else if (value_type(a) == VALUE_TYPE_STR && value_type(b) == VALUE_TYPE_STR)
+		return str_less(a, b);
 
-	return value_num(tm.tm_mon + 1);
+	wrong_type(expr->where, value_type(value_type(a) == VALUE_TYPE_NUM ||
+	                                   value_type(a) == VALUE_TYPE_STR? b : a), in);
+	return false;
 }
 
-static value_t builtin_getday(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
-
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+typedef struct {
+	env_t   *e;
+	expr_t  *expr;
+	value_t *args; /* The array and the comparator, where the GC updates them */
+	size_t   size;
+} sort_by_t;
 
-	time_t    t  = time(NULL);
-	struct tm tm = *localtime(&t);
+static bool sort_by_less(void *ctx, size_t a, size_t b) {
+	sort_by_t *by = (sort_by_t*)ctx;
+	if (arr_size(by->args[0]) != by->size)
+		error(by->expr->where, "Array changed its length while sorting");
 
-	return value_num(tm.tm_mday);
+	return call_less(by->e, by->expr, by->args[1], arr_elem(by->args[0], a),
+	                 arr_elem(by->args[0], b), "sort");
 }
 
-static value_t builtin_gethour(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
-	expr_call_t *call = &expr->as.call;
+/* The comparator can change anything and collect garbage, so the indexes are sorted and the
+   elements are only moved once it is done */
+static void sort_by(env_t *e, expr_t *expr, value_t *args, size_t size) {
+	size_t *idxs = (size_t*)malloc((size + 1) * sizeof(size_t));
+	if (idxs == NULL)
+		UNREACHABLE("malloc() fail");
 
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+	for (size_t i = 0; i < size; ++ i)
+		idxs[i] = i;
 
-	time_t    t  = time(NULL);
-	struct tm tm = *localtime(&t);
+	sort_by_t by = {.e = e, .expr = expr, .args = args, .size = size};
+	sort_idxs(idxs, size, sort_by_less, &by);
 
-	return value_num(tm.tm_hour);
+	args[0] = gc_unview(&e->gc, args[0]);
+	bool   packed = value_is_packed(args[0]);
+	size_t width  = packed? value_packed_width(args[0]) : sizeof(value_t);
+	char  *buf    = packed? value_as_packed(args[0])->buf : (char*)value_as_arr(args[0])->buf;
+
+	char *copy = (char*)malloc(size * width + 1);
+	if (copy == NULL)
+		UNREACHABLE("malloc() fail");
+
+	memcpy(copy, buf, size * width);
+	for (size_t i = 0; i < size; ++ i)
+		memcpy(buf + i * width, copy + idxs[i] * width, width);
+
+	free(copy);
+	free(idxs);
 }
 
-static value_t builtin_getmin(env_t *e, expr_t *expr, value_t *args) {
-	UNUSED(e);
-	UNUSED(args);
+/* Sorts the array in place and gives it back. Without a comparator, its elements have to be all
+   numbers or all strings */
+static value_t builtin_sort(env_t *e, expr_t *expr, value_t *args) {
 	expr_call_t *call = &expr->as.call;
 
-	if (call->args_count != 0)
-		wrong_arg_count(expr->where, call->args_count, 0);
+	if (call->args_count < 1 || call->args_count > 2)
+		wrong_arg_count(expr->where, call->args_count, call->args_count < 1? 1 : 2);
+
+	if (value_type(args[0]) != VALUE_TYPE_ARR && !value_is_packed(args[0]))
+		wrong_type(expr->where, value_type(args[0]), "'sort' function argument #1");
+
+	size_t size = arr_size(args[0]);
+	if (call->args_count == 2) {
+		if (value_type(args[1]) != VALUE_TYPE_FUN)
+			wrong_type(expr->where, value_type(args[1]), "'sort' function argument #2");
+
+		sort_by(e, expr, args, size);
+		return args[0];
+	}
+
+	args[0] = gc_unview(&e->gc, args[0]);
+	if (value_type(args[0]) == VALUE_TYPE_U8S)
+		sort_bytes((unsigned char*)value_as_packed(args[0])->buf, size);
+	else if (value_type(args[0]) == VALUE_TYPE_F64S)
+		sort_nums((double*)value_as_packed(args[0])->buf, size);
+	else if (size > 0 && value_type(value_as_arr(args[0])->buf[0]) == VALUE_TYPE_NUM) {
+		/* Numbers are unboxed, so the comparisons do not have to */
+		double *owned, *xs = arr_nums(expr, args[0], "sort", 1, &owned);
+		sort_nums(xs, size);
+
+		for (size_t i = 0; i < size; ++ i)
+			value_as_arr(args[0])->buf[i] = value_num(xs[i]);
+
+		free(owned);
+	} else if (size > 0) {
+		value_t *buf = value_as_arr(args[0])->buf;
+		for (size_t i = 0; i < size; ++ i) {
+			if (value_type(buf[i]) != VALUE_TYPE_STR)
+				wrong_type(expr->where, value_type(buf[i]),
+				           "'sort' function, expected numbers or strings");
+		}
+
+		sort_strs(buf, size);
+	}
+
+	return args[0];
+}
+
+/* The index of an element equal to the value in a sorted array, or nil. A comparator has to be
+   the one the array was sorted with */
+static value_t builtin_bsearch(env_t *e, expr_t *expr, value_t *args) {
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count < 2 || call->args_count > 3)
+		wrong_arg_count(expr->where, call->args_count, call->args_count < 2? 2 : 3);
+
+	if (value_type(args[0]) != VALUE_TYPE_ARR && !value_is_packed(args[0]))
+		wrong_type(expr->where, value_type(args[0]), "'bsearch' function argument #1");
+
+	bool by = call->args_count == 3;
+	if (by && value_type(args[2]) != VALUE_TYPE_FUN)
+		wrong_type(expr->where, value_type(args[2]), "'bsearch' function argument #3");
+
+	/* The first element that does not go before the value */
+	size_t size = arr_size(args[0]), lo = 0, hi = size;
+	while (lo < hi) {
+		if (arr_size(args[0]) != size)
+			error(expr->where, "Array changed its length while searching");
+
+		size_t  mid  = lo + (hi - lo) / 2;
+		value_t elem = arr_elem(args[0], mid);
+		if (by? call_less(e, expr, args[2], elem, args[1], "bsearch") :
+		        value_less(expr, elem, args[1], "bsearch"))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo >= arr_size(args[0]))
+		return value_nil();
+
+	value_t elem = arr_elem(args[0], lo);
+	bool    past = by? call_less(e, expr, args[2], args[1], elem, "bsearch") :
+	                   value_less(expr, args[1], elem, "bsearch");
+	return past? value_nil() : value_num(lo);
+}
+
+/* A copy of the array with room for at least n elements, so that pushing to it does not have to
+   grow it again */
+static value_t builtin_reserve(env_t *e, expr_t *expr, value_t *args) {
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 2)
+		wrong_arg_count(expr->where, call->args_count, 2);
+
+	value_t arr = args[0];
+	if (value_type(arr) != VALUE_TYPE_ARR)
+		wrong_type(expr->where, value_type(arr), "'reserve' function argument #1");
+
+	value_t n = args[1];
+	if (value_type(n) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(n), "'reserve' function argument #2");
+
+	if (value_as_num(n) < 0)
+		error(expr->where, "Negative capacity is not allowed");
+
+	size_t size = value_as_arr(arr)->size, cap = (size_t)round(value_as_num(n));
+	value_t val = gc_arr_cap(&e->gc, size, cap < size? size : cap);
+	memcpy(value_as_arr(val)->buf, value_as_arr(arr)->buf, size * sizeof(value_t));
+
+	/* The variable it is stored in owns it, so pushing to it uses the room */
+	VALUE_HEADER(value_as_arr(val))->owner = VALUE_TEMPORARY;
+	return val;
+}
+
+static value_t builtin_inline(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t str = args[0];
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'inline' function");
+
+	arena_t arena;
+	arena_init(&arena);
+
+	stmt_t *program = parse(str_cstr(e, &str), e->path, &arena);
+	value_t ret     = e->walk? eval_with_return(e, program) : vm_run(e, program, e->path, true);
+
+	env_to_free(e, &arena);
+	return ret;
+}
+
+static value_t builtin_gc(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	env_gc(e);
+	return value_nil();
+}
+
+static value_t builtin_strtobytes(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t str = args[0];
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'strtobytes' function");
+
+	value_t bytes = gc_arr(&e->gc, value_str_len(str));
+
+	for (size_t i = 0; i < value_as_arr(bytes)->size; ++ i)
+		value_as_arr(bytes)->buf[i] = value_num((float)value_str_buf(&str)[i]);
+
+	return bytes;
+}
+
+/* Like strtobytes, but into a u8 array, so the bytes are 0..255 instead of chars */
+static value_t builtin_strtou8array(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t str = args[0];
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'strtou8array' function");
+
+	value_t bytes = gc_packed(&e->gc, VALUE_TYPE_U8S, value_str_len(str));
+	memcpy(value_as_packed(bytes)->buf, value_str_buf(&str), value_str_len(str));
+	return bytes;
+}
+
+static value_t builtin_bytestostr(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t bytes = args[0];
+	if (value_type(bytes) == VALUE_TYPE_U8S)
+		return gc_str(&e->gc, value_as_packed(bytes)->buf, value_as_packed(bytes)->size);
+	else if (value_type(bytes) != VALUE_TYPE_ARR)
+		wrong_type(expr->where, value_type(bytes), "'bytestostr' function");
+
+	/* Short strings are filled in place and boxed once they are done */
+	size_t  size = value_as_arr(bytes)->size;
+	char    short_buf[VALUE_SHORT_STR_MAX];
+	value_t str  = size <= VALUE_SHORT_STR_MAX? value_nil() : gc_str(&e->gc, NULL, size);
+	char   *buf  = size <= VALUE_SHORT_STR_MAX? short_buf : value_as_str(str)->buf;
+	for (size_t i = 0; i < size; ++ i) {
+		if (value_type(value_as_arr(bytes)->buf[i]) != VALUE_TYPE_NUM)
+			error(expr->where, "'bytestostr' function expected a byte array");
+		buf[i] = (char)round(value_as_num(value_as_arr(bytes)->buf[i]));
+	}
+
+	return size <= VALUE_SHORT_STR_MAX? value_short_str(short_buf, size) : str;
+}
+
+static value_t builtin_intern(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t str = args[0];
+	if (value_type(str) != VALUE_TYPE_STR)
+		wrong_type(expr->where, value_type(str), "'intern' function");
+
+	return gc_intern(&e->gc, str);
+}
+
+static value_t builtin_round(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t val = args[0];
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'round' function");
+
+	return value_num(round(value_as_num(val)));
+}
+
+static value_t builtin_floor(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t val = args[0];
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'floor' function");
+
+	return value_num(floor(value_as_num(val)));
+}
+
+static value_t builtin_ceil(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t val = args[0];
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'ceil' function");
+
+	return value_num(ceil(value_as_num(val)));
+}
+
+static value_t builtin_abs(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 1)
+		wrong_arg_count(expr->where, call->args_count, 1);
+
+	value_t val = args[0];
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'abs' function");
+
+	return value_num(fabs(value_as_num(val)));
+}
+
+static value_t builtin_gettime(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	return value_num(time(NULL) * 1000);
+}
+
+static value_t builtin_getyear(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	time_t    t  = time(NULL);
+	struct tm tm = *localtime(&t);
+
+	return value_num(tm.tm_year + 1900);
+}
+
+static value_t builtin_getmonth(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	time_t    t  = time(NULL);
+	struct tm tm = *localtime(&t);
+
+	return value_num(tm.tm_mon + 1);
+}
+
+static value_t builtin_getday(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	time_t    t  = time(NULL);
+	struct tm tm = *localtime(&t);
+
+	return value_num(tm.tm_mday);
+}
+
+static value_t builtin_gethour(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
+
+	time_t    t  = time(NULL);
+	struct tm tm = *localtime(&t);
+
+	return value_num(tm.tm_hour);
+}
+
+static value_t builtin_getmin(env_t *e, expr_t *expr, value_t *args) {
+	UNUSED(e);
+	UNUSED(args);
+	expr_call_t *call = &expr->as.call;
+
+	if (call->args_count != 0)
+		wrong_arg_count(expr->where, call->args_count, 0);
 
 	time_t    t  = time(NULL);
 	struct tm tm = *localtime(&t);
@@ -937,13 +1594,29 @@ builtin_t builtins[BUILTINS_COUNT] = {
 	{.name = "srand",       .func = builtin_srand},
 	{.name = "freadstr",    .func = builtin_freadstr},
 	{.name = "freadbytes",  .func = builtin_freadbytes},
+	{.name = "freadu8array", .func = builtin_freadu8array},
 	{.name = "fwritestr",   .func = builtin_fwritestr},
 	{.name = "fwritebytes", .func = builtin_fwritebytes},
 	{.name = "array",       .func = builtin_array},
+	{.name = "reserve",     .func = builtin_reserve},
+	{.name = "u8array",     .func = builtin_u8array},
+	{.name = "f64array",    .func = builtin_f64array},
+	{.name = "arrsum",      .func = builtin_arrsum},
+	{.name = "arrmin",      .func = builtin_arrmin},
+	{.name = "arrmax",      .func = builtin_arrmax},
+	{.name = "arrdot",      .func = builtin_arrdot},
+	{.name = "arradd",      .func = builtin_arradd},
+	{.name = "arrmul",      .func = builtin_arrmul},
+	{.name = "arrscale",    .func = builtin_arrscale},
+	{.name = "arrprefixsum", .func = builtin_arrprefixsum},
+	{.name = "sort",        .func = builtin_sort},
+	{.name = "bsearch",     .func = builtin_bsearch},
 	{.name = "inline",      .func = builtin_inline},
 	{.name = "gc",          .func = builtin_gc},
 	{.name = "strtobytes",  .func = builtin_strtobytes},
+	{.name = "strtou8array", .func = builtin_strtou8array},
 	{.name = "bytestostr",  .func = builtin_bytestostr},
+	{.name = "intern",      .func = builtin_intern},
 	{.name = "round",       .func = builtin_round},
 	{.name = "floor",       .func = builtin_floor},
 	{.name = "ceil",        .func = builtin_ceil},
@@ -957,7 +1630,7 @@ builtin_t builtins[BUILTINS_COUNT] = {
 	{.name = "getsec",      .func = builtin_getsec},
 };
 
-static_assert(BUILTINS_COUNT == 39); /* Update builtins count */
+static_assert(BUILTINS_COUNT == 55); /* Update builtins count */
 
 static value_t eval_with_return(env_t *e, stmt_t *stmt) {
 	++ e->returns;
@@ -971,253 +1644,468 @@ static value_t eval_with_return(env_t *e, stmt_t *stmt) {
 	return e->return_;
 }
 
-static value_t eval_expr_call(env_t *e, expr_t *expr) {
-	expr_call_t *call = &expr->as.call;
-	value_t to_call = eval_expr(e, call->expr);
-	switch (to_call.type) {
-	case VALUE_TYPE_NAT: {
-		++ e->builtin_nest;
-		value_t evaled[ARGS_CAPACITY];
-		for (size_t i = 0; i < call->args_count; ++ i) {
-			evaled[i] = eval_expr(e, call->args[i]);
-
-			char name[MAX_NEST + 3] = {'#', 'A' + i, '\0'};
-			for (size_t i = 0; i < e->builtin_nest; ++ i)
-				name[2 + i] = '_';
-			var_t *var = env_new_var(e, strcpy_to_heap(name), true);
-			assert(var != NULL);
-			var->val = evaled[i];
+void env_call_begin(env_t *e, expr_t *expr, expr_fun_t *fun, value_t *args) {
+	UNUSED(expr);
+	env_scope_begin(e);
+
+	/* Compiled functions have their arguments resolved to the first slots of the call scope */
+	if (fun->chunk != NULL) {
+		env_scope_reserve(e, fun->chunk->statics);
+		for (size_t i = 0; i < fun->args_count; ++ i) {
+			args[i] = gc_share(&e->gc, args[i]);
+			env_new_static(e, fun->args[i], fun->args_sym[i], i, false)->val = args[i];
+		}
+	} else {
+		for (size_t i = 0; i < fun->args_count; ++ i) {
+			var_t *var = env_new_var(e, fun->args[i], false);
+			var->val = gc_share(&e->gc, args[i]);
 		}
+	}
 
-		value_t val = to_call.as.nat(e, expr, evaled);
-		-- e->builtin_nest;
+	if (e->callstack_size >= e->callstack_cap) {
+		e->callstack_cap *= 2;
+		e->callstack      = (call_t*)realloc(e->callstack, sizeof(call_t) * e->callstack_cap);
+		if (e->callstack == NULL)
+			UNREACHABLE("malloc() fail");
+	}
 
-		for (size_t i = 0; i < e->scope->vars_count; ++ i) {
-			if (e->scope->vars[i].name == NULL)
-				continue;
+	callstack = e->callstack;
+	e->callstack[e->callstack_size ++].where = expr->where;
+}
 
-			if (e->scope->vars[i].name[0] == '#' && e->scope->vars[i].name[1] <= 'Z') {
-				free(e->scope->vars[i].name);
-				e->scope->vars[i].name = NULL;
-			}
+void env_call_end(env_t *e) {
+	-- e->callstack_size;
+
+	env_scope_end(e);
+}
+
+void env_defer(env_t *e, stmt_t *stmt) {
+	if (e->scope->defer_count >= e->scope->defer_cap) {
+		e->scope->defer_cap *= 2;
+		e->scope->defer = (stmt_t**)realloc(e->scope->defer, e->scope->defer_cap * sizeof(stmt_t*));
+		if (e->scope->defer == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	e->scope->defer[e->scope->defer_count ++] = stmt;
+}
+
+void env_to_free(env_t *e, arena_t *arena) {
+	if (e->to_free_size >= e->to_free_cap) {
+		e->to_free_cap *= 2;
+		e->to_free      = (arena_t*)realloc(e->to_free, sizeof(arena_t) * e->to_free_cap);
+		if (e->to_free == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	e->to_free[e->to_free_size ++] = *arena;
+}
+
+/* Returns the path of the parsed file, or NULL if it was already imported */
+char *env_import(env_t *e, stmt_t *stmt, stmt_t **imported) {
+	stmt_import_t *import = &stmt->as.import;
+
+	char *path = (char*)malloc(strlen(e->path) + strlen(import->path) + 1);
+	if (path == NULL)
+		UNREACHABLE("malloc() fail");
+
+	strcpy(path, e->path);
+	char *last = strrchr(path, '/');
+	if (last != NULL) {
+		*last = '\0';
+		strcat(path, "/");
+	} else
+		*path = '\0';
+
+	strcat(path, import->path);
+
+	for (size_t i = 0; i < e->imported_count; ++ i) {
+		if (strcmp(e->imported[i], path) == 0) {
+			free(path);
+			return NULL;
 		}
+	}
+
+	char *str = readfile(path);
+	if (str == NULL)
+		error(stmt->where, "Cannot import '%s'", path);
+
+	arena_t arena;
+	arena_init(&arena);
+
+	*imported = parse(str, path, &arena);
+	free(str);
+
+	e->imported[e->imported_count ++] = path;
+	env_to_free(e, &arena);
+	return path;
+}
+
+/* Evaluated values that are still needed while more code runs are held on the value stack, where
+   the GC sees them (and updates them when it moves young objects) */
+static void eval_hold(env_t *e, expr_t *expr, value_t val) {
+	if (e->stack_size >= STACK_CAPACITY)
+		error(expr->where, "Stack overflow");
+
+	e->stack[e->stack_size ++] = val;
+}
+
+static value_t eval_release(env_t *e) {
+	return e->stack[-- e->stack_size];
+}
+
+static value_t *eval_push(env_t *e, expr_t *expr, expr_t **exprs, size_t count) {
+	value_t *vals = e->stack + e->stack_size;
+	for (size_t i = 0; i < count; ++ i)
+		eval_hold(e, expr, eval_expr(e, exprs[i]));
+
+	return vals;
+}
+
+static value_t eval_expr_call(env_t *e, expr_t *expr) {
+	expr_call_t *call = &expr->as.call;
+	value_t to_call = eval_expr(e, call->expr);
+	switch (value_type(to_call)) {
+	case VALUE_TYPE_NAT: {
+		value_t *args = eval_push(e, expr, call->args, call->args_count);
+		value_t  val  = value_as_nat(to_call)(e, expr, args);
+
+		e->stack_size = args - e->stack;
 		return val;
 	}
 
 	case VALUE_TYPE_FUN: {
-		expr_fun_t *fun = (expr_fun_t*)to_call.as.fun;
+		expr_fun_t *fun = (expr_fun_t*)value_as_fun(to_call);
 
 		if (fun->args_count != call->args_count)
 			error(expr->where, "Function expected %i arguments, got %i",
 			      (int)fun->args_count, (int)call->args_count);
 
-		value_t evaled[ARGS_CAPACITY];
-		for (size_t i = 0; i < fun->args_count; ++ i)
-			evaled[i] = eval_expr(e, call->args[i]);
+		value_t *args = eval_push(e, expr, call->args, call->args_count);
+		env_call_begin(e, expr, fun, args);
+		e->stack_size = args - e->stack;
 
-		env_scope_begin(e);
+		eval_hold(e, expr, eval_with_return(e, fun->body));
+		e->return_ = value_nil();
 
-		for (size_t i = 0; i < fun->args_count; ++ i) {
-			var_t *var = env_new_var(e, fun->args[i], false);
-			var->val = evaled[i];
-		}
+		env_call_end(e);
+		return eval_release(e);
+	}
 
-		if (e->callstack_size >= e->callstack_cap) {
-			e->callstack_cap *= 2;
-			e->callstack      = (call_t*)realloc(e->callstack, sizeof(call_t) * e->callstack_cap);
-			if (e->callstack == NULL)
-				UNREACHABLE("malloc() fail");
-		}
+	default: wrong_type(expr->where, value_type(to_call), "'()' operation");
+	}
 
-		callstack = e->callstack;
-		e->callstack[e->callstack_size ++].where = expr->where;
+	return value_nil();
+}
 
-		value_t val = eval_with_return(e, fun->body);
+static value_t eval_expr_arr(env_t *e, expr_t *expr) {
+	expr_arr_t *arr = &expr->as.arr;
 
-		-- e->callstack_size;
+	/* The elements are kept on the value stack until the array exists, since evaluating them can
+	   collect garbage */
+	value_t *elems = eval_push(e, expr, arr->buf, arr->size);
 
-		env_scope_end(e);
-		e->return_ = value_nil();
-		return val;
+	value_t val = gc_arr(&e->gc, arr->size);
+	for (size_t i = 0; i < arr->size; ++ i) {
+		value_as_arr(val)->buf[i] = gc_share(&e->gc, elems[i]);
 	}
 
-	default: wrong_type(expr->where, to_call.type, "'()' operation");
+	e->stack_size = elems - e->stack;
+	return val;
+}
+
+static void check_map_key(where_t where, value_t key) {
+	if (value_type(key) != VALUE_TYPE_NUM && value_type(key) != VALUE_TYPE_STR)
+		wrong_type(where, value_type(key), "map key");
+}
+
+value_t op_map(env_t *e, expr_t *expr, value_t *args) {
+	expr_map_t *map = &expr->as.map;
+
+	value_t val = gc_map(&e->gc, map->size);
+	for (size_t i = 0; i < map->size; ++ i) {
+		check_map_key(map->buf[i * 2]->where, args[i * 2]);
+		gc_map_set(&e->gc, val, args[i * 2], args[i * 2 + 1]);
 	}
 
-	return value_nil();
+	return val;
 }
 
-static value_t eval_expr_arr(env_t *e, expr_t *expr) {
-	expr_arr_t *arr = &expr->as.arr;
+static value_t eval_expr_map(env_t *e, expr_t *expr) {
+	/* Like the elements of arrays, the keys and values wait on the value stack */
+	value_t *args = eval_push(e, expr, expr->as.map.buf, expr->as.map.size * 2);
+	value_t  val  = op_map(e, expr, args);
+
+	e->stack_size = args - e->stack;
+	return val;
+}
 
-	value_t val = gc_add_elem(&e->gc, value_arr(arr->size));
-	for (size_t i = 0; i < arr->size; ++ i)
-		val.as.arr.buf[i] = eval_expr(e, arr->buf[i]);
+value_t op_rec(env_t *e, expr_t *expr, value_t *args) {
+	const value_shape_t *shape = expr->as.rec.shape;
+
+	value_t val = gc_rec(&e->gc, shape);
+	for (size_t i = 0; i < shape->size; ++ i)
+		value_as_rec(val)->fields[i] = gc_share(&e->gc, args[i]);
 
 	return val;
 }
 
-static value_t eval_expr_fmt(env_t *e, expr_t *expr) {
+static value_t eval_expr_rec(env_t *e, expr_t *expr) {
+	value_t *args = eval_push(e, expr, expr->as.rec.fields, expr->as.rec.shape->size);
+	value_t  val  = op_rec(e, expr, args);
+
+	e->stack_size = args - e->stack;
+	return val;
+}
+
+/* The field of a record with the name, looked up in its shape unless the index already knows
+   where it is (see expr_idx_t) */
+static value_t *rec_field(expr_t *idx, where_t where, value_t rec, value_t name) {
+	value_rec_t *ptr   = value_as_rec(rec);
+	expr_idx_t  *cache = &idx->as.idx;
+	if (cache->shape == ptr->shape)
+		return ptr->fields + cache->field;
+
+	if (value_type(name) != VALUE_TYPE_STR)
+		wrong_type(where, value_type(name), "record field name");
+
+	size_t      len = value_str_len(name), i = 0;
+	const char *buf = value_str_buf(&name);
+	for (; i < ptr->shape->size; ++ i) {
+		const char *field = ptr->shape->fields[i];
+		if (strlen(field) == len && memcmp(field, buf, len) == 0)
+			break;
+	}
+
+	if (i >= ptr->shape->size)
+		error(where, "Record '%s' has no field '%.*s'", ptr->shape->name, (int)len, buf);
+
+	/* Other names can change between the evaluations of the index */
+	if (cache->start->type == EXPR_TYPE_VALUE) {
+		cache->shape = ptr->shape;
+		cache->field = i;
+	}
+
+	return ptr->fields + i;
+}
+
+static const char *value_to_cstr(const value_t *value, char *buf, size_t size) {
+	switch (value_type(*value)) {
+	case VALUE_TYPE_NAT: return "(native)";
+	case VALUE_TYPE_FUN:
+		snprintf(buf, size, "(fun %p)", (void*)value_as_fun(*value));
+		return buf;
+
+	case VALUE_TYPE_ARR:
+		snprintf(buf, size, "(list %p)", (void*)value_as_arr(*value));
+		return buf;
+
+	case VALUE_TYPE_MAP:
+		snprintf(buf, size, "(map %p)", (void*)value_as_map(*value));
+		return buf;
+
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S:
+		snprintf(buf, size, "(%s %p)", value_type_to_cstr(value_type(*value)),
+		         (void*)value_as_packed(*value));
+		return buf;
+
+	case VALUE_TYPE_REC:
+		snprintf(buf, size, "(record %s %p)", value_as_rec(*value)->shape->name,
+		         (void*)value_as_rec(*value));
+		return buf;
+
+	case VALUE_TYPE_NIL:  return "(nil)";
+	case VALUE_TYPE_STR:  return value_str_buf(value);
+	case VALUE_TYPE_BOOL: return value_as_bool(*value)? "true" : "false";
+	case VALUE_TYPE_NUM:
+		double_to_str(value_as_num(*value), buf, size);
+		return buf;
+
+	default: UNREACHABLE("Unknown value type");
+	}
+
+	return NULL;
+}
+
+static void fmt_append(char **str, size_t *size, size_t *cap, const char *add, size_t len) {
+	if (*size + len > *cap) {
+		do {
+			*cap *= 2;
+		} while (*size + len > *cap);
+
+		*str = (char*)realloc(*str, *cap);
+		if (*str == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	memcpy(*str + *size, add, len);
+	*size += len;
+}
+
+/* Evaluates the format arguments lazily if args is NULL. The string is built outside of the GC
+   heap, since evaluating the arguments can collect garbage */
+static value_t eval_fmt(env_t *e, expr_t *expr, value_t *args) {
 	expr_fmt_t *fmt = &expr->as.fmt;
 
-	size_t cap = 64, size = 0;
+	size_t cap = fmt->len + 64, size = 0;
 	char *str = (char*)malloc(cap);
 	if (str == NULL)
 		UNREACHABLE("malloc() fail");
 
-	*str = '\0';
-	size_t arg  = 0;
-	char   prev = '\0';
-	for (size_t i = 0; i < strlen(fmt->str); ++ i) {
+	const char *part = fmt->str;
+	fmt_append(&str, &size, &cap, part, fmt->parts[0]);
+	for (size_t i = 1; i < fmt->parts_count; ++ i) {
+		part += fmt->parts[i - 1];
+		if (i > fmt->args_count)
+			error(expr->where, "Unexpected string format at index %i", (int)(part - fmt->str));
+
 		char    buf[64] = {0};
-		const char *add = NULL;
+		value_t value   = args == NULL? eval_expr(e, fmt->args[i - 1]) : args[i - 1];
+		const char *add = value_to_cstr(&value, buf, sizeof(buf));
+		fmt_append(&str, &size, &cap, add, value_type(value) == VALUE_TYPE_STR?
+		           value_str_len(value) : strlen(add));
 
-		if (prev != '%' && fmt->str[i] == '%' && fmt->str[i + 1] == 'v') {
-			if (arg >= fmt->args_count)
-				error(expr->where, "Unexpected string format at index %i", (int)round(i));
+		part += 2;
+		fmt_append(&str, &size, &cap, part, fmt->parts[i]);
+	}
 
-			value_t value = eval_expr(e, fmt->args[arg ++]);
+	if (fmt->parts_count - 1 < fmt->args_count)
+		error(fmt->args[fmt->parts_count - 1]->where, "Unexpected format argument");
 
-			switch (value.type) {
-			case VALUE_TYPE_NAT: add = "(native)"; break;
-			case VALUE_TYPE_FUN:
-				sprintf(buf, "(fun %p)", (void*)value.as.fun);
-				add = buf;
-				break;
+	value_t val = gc_str(&e->gc, str, size);
+	free(str);
+	return val;
+}
 
-			case VALUE_TYPE_ARR:
-				sprintf(buf, "(list %p)", (void*)value.as.arr.buf);
-				add = buf;
-				break;
+value_t op_fmt(env_t *e, expr_t *expr, value_t *args) {
+	return eval_fmt(e, expr, args);
+}
 
-			case VALUE_TYPE_NIL:  add = "(nil)";      break;
-			case VALUE_TYPE_STR:  add = value.as.str; break;
-			case VALUE_TYPE_BOOL: add = value.as.bool_? "true" : "false"; break;
-			case VALUE_TYPE_NUM:
-				double_to_str(value.as.num, buf, sizeof(buf));
-				add = buf;
-				break;
+static value_t eval_expr_fmt(env_t *e, expr_t *expr) {
+	return eval_fmt(e, expr, NULL);
+}
 
-			default: UNREACHABLE("Unknown value type");
-			}
+value_t op_slice(env_t *e, expr_t *expr, value_t to_idx, value_t start, value_t end) {
+	if (value_type(start) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(start), "'[]' operation start index");
 
-			++ i;
-		} else {
-			buf[0] = fmt->str[i];
-			buf[1] = '\0';
-			add = buf;
-		}
+	int startPos = (int)round(value_as_num(start));
+	if (startPos < 0)
+		error(expr->where, "Negative start index is not allowed");
 
-		size_t len = strlen(add);
+	if (value_type(end) != VALUE_TYPE_NUM && value_type(end) != VALUE_TYPE_NIL)
+		wrong_type(expr->where, value_type(end), "'[]' operation end index");
 
-		size += len;
-		if (size + 1 >= cap) {
-			do {
-				cap *= 2;
-			} while (size + 1 >= cap);
+	int endPos = value_type(end) == VALUE_TYPE_NIL? 0 : (int)round(value_as_num(end));
+	if (endPos < 0)
+		error(expr->where, "Negative end index is not allowed");
 
-			str = (char*)realloc(str, cap);
-			if (str == NULL)
-				UNREACHABLE("realloc() fail");
-		}
+	if (value_type(end) != VALUE_TYPE_NIL && startPos > endPos) {
+		int tmp  = endPos;
+		endPos   = startPos;
+		startPos = tmp;
+	}
 
-		strcat(str, add);
-		prev = fmt->str[i];
+	switch (value_type(to_idx)) {
+	case VALUE_TYPE_STR: {
+		size_t len = value_str_len(to_idx);
+		if ((size_t)startPos >= len)
+			error(expr->where, "Start index exceeds string length");
+		else if ((size_t)endPos > len)
+			error(expr->where, "End index exceeds string length");
+
+		len = value_type(end) == VALUE_TYPE_NIL? len - startPos : (size_t)endPos - startPos;
+		return gc_slice(&e->gc, to_idx, startPos, len);
 	}
 
-	if (arg < fmt->args_count)
-		error(fmt->args[arg]->where, "Unexpected format argument");
+	case VALUE_TYPE_ARR: {
+		size_t size = value_as_arr(to_idx)->size;
+		if ((size_t)startPos >= size)
+			error(expr->where, "Start index exceeds array length");
+		else if ((size_t)endPos > size)
+			error(expr->where, "End index exceeds array length");
 
-	return gc_add_elem(&e->gc, value_str(str));
-}
+		size = value_type(end) == VALUE_TYPE_NIL? size - startPos : (size_t)endPos - startPos;
+		return gc_slice(&e->gc, to_idx, startPos, size);
+	}
 
-static value_t eval_expr_idx(env_t *e, expr_t *expr) {
-	expr_idx_t *idx = &expr->as.idx;
-	value_t to_idx = eval_expr(e, idx->expr);
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S: {
+		size_t size = value_as_packed(to_idx)->size;
+		if ((size_t)startPos >= size)
+			error(expr->where, "Start index exceeds array length");
+		else if ((size_t)endPos > size)
+			error(expr->where, "End index exceeds array length");
 
-	if (idx->end != NULL) {
-		value_t start = eval_expr(e, idx->start);
-		if (start.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, start.type, "'[]' operation start index");
-
-		int startPos = (int)round(start.as.num);
-		if (startPos < 0)
-			error(expr->where, "Negative start index is not allowed");
-
-		value_t end = eval_expr(e, idx->end);
-		if (end.type != VALUE_TYPE_NUM && end.type != VALUE_TYPE_NIL)
-			wrong_type(expr->where, end.type, "'[]' operation end index");
-
-		int endPos = end.type == VALUE_TYPE_NIL? 0 : (int)round(end.as.num);
-		if (endPos < 0)
-			error(expr->where, "Negative end index is not allowed");
-
-		if (end.type != VALUE_TYPE_NIL && startPos > endPos) {
-			int tmp  = endPos;
-			endPos   = startPos;
-			startPos = tmp;
-		}
+		size = value_type(end) == VALUE_TYPE_NIL? size - startPos : (size_t)endPos - startPos;
+		return gc_slice(&e->gc, to_idx, startPos, size);
+	}
 
-		switch (to_idx.type) {
-		case VALUE_TYPE_STR: {
-			size_t len = strlen(to_idx.as.str);
-			if ((size_t)startPos >= len)
-				error(expr->where, "Start index exceeds string length");
-			else if ((size_t)endPos > len)
-				error(expr->where, "End index exceeds string length");
-
-			/* Very lazy */
-			char *buf = strcpy_to_heap(to_idx.as.str + startPos);
-			if (end.type != VALUE_TYPE_NIL)
-				buf[endPos - startPos] = '\0';
-			return gc_add_elem(&e->gc, value_str(buf));
-		}
+	default: wrong_type(expr->where, value_type(to_idx), "'[]' operation");
+	}
 
-		case VALUE_TYPE_ARR: {
-			size_t size = to_idx.as.arr.size;
-			if ((size_t)startPos >= size)
-				error(expr->where, "Start index exceeds array length");
-			else if ((size_t)endPos > size)
-				error(expr->where, "End index exceeds array length");
+	return value_nil();
+}
 
-			size = end.type == VALUE_TYPE_NIL? size - startPos : (size_t)endPos - startPos;
+/* Maps give nil for the keys they do not have */
+value_t op_idx(env_t *e, expr_t *expr, value_t to_idx, value_t val) {
+	UNUSED(e);
+	if (value_type(to_idx) == VALUE_TYPE_REC)
+		return *rec_field(expr, expr->where, to_idx, val);
+	else if (value_type(to_idx) == VALUE_TYPE_MAP) {
+		check_map_key(expr->where, val);
+		value_t *found = value_map_find(to_idx, val);
+		return found == NULL? value_nil() : *found;
+	}
 
-			value_t val = gc_add_elem(&e->gc, value_arr(size));
-			for (size_t i = 0; i < val.as.arr.size; ++ i)
-				val.as.arr.buf[i] = to_idx.as.arr.buf[startPos + i];
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "'[]' operation index");
 
-			return val;
-		}
+	int pos = (int)round(value_as_num(val));
+	if (pos < 0)
+		error(expr->where, "Negative index is not allowed");
 
-		default: wrong_type(expr->where, to_idx.type, "'[]' operation");
-		}
-	} else {
-		value_t val = eval_expr(e, idx->start);
-		if (val.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, val.type, "'[]' operation index");
+	switch (value_type(to_idx)) {
+	case VALUE_TYPE_STR: {
+		if ((size_t)pos >= value_str_len(to_idx))
+			error(expr->where, "Index exceeds string length");
 
-		int pos = (int)round(val.as.num);
-		if (pos < 0)
-			error(expr->where, "Negative index is not allowed");
+		return value_short_str(value_str_buf(&to_idx) + pos, 1);
+	}
 
-		switch (to_idx.type) {
-		case VALUE_TYPE_STR: {
-			if ((size_t)pos >= strlen(to_idx.as.str))
-				error(expr->where, "Index exceeds string length");
+	case VALUE_TYPE_ARR: return value_as_arr(to_idx)->buf[pos];
 
-			char buf[] = {to_idx.as.str[pos], '\0'};
-			return gc_add_elem(&e->gc, value_str(strcpy_to_heap(buf)));
-		}
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S:
+		if ((size_t)pos >= value_as_packed(to_idx)->size)
+			error(expr->where, "Index exceeds array length");
 
-		case VALUE_TYPE_ARR: return to_idx.as.arr.buf[pos];
+		return value_packed_get(to_idx, pos);
 
-		default: wrong_type(expr->where, to_idx.type, "'[]' operation");
-		}
+	default: wrong_type(expr->where, value_type(to_idx), "'[]' operation");
 	}
 
 	return value_nil();
 }
 
+static value_t eval_expr_idx(env_t *e, expr_t *expr) {
+	expr_idx_t *idx = &expr->as.idx;
+	eval_hold(e, expr, eval_expr(e, idx->expr));
+
+	if (idx->end != NULL) {
+		eval_hold(e, expr, eval_expr(e, idx->start));
+		value_t end    = eval_expr(e, idx->end);
+		value_t start  = eval_release(e);
+		value_t to_idx = eval_release(e);
+		return op_slice(e, expr, to_idx, start, end);
+	} else {
+		value_t start  = eval_expr(e, idx->start);
+		value_t to_idx = eval_release(e);
+		return op_idx(e, expr, to_idx, start);
+	}
+}
+
 static value_t eval_expr_id(env_t *e, expr_t *expr) {
 	var_t *var = env_get_var(e, expr->as.id.name);
 	if (var == NULL)
@@ -1230,10 +2118,10 @@ static value_t eval_expr_do(env_t *e, expr_t *expr) {
 	expr_do_t *do_ = &expr->as.do_;
 	env_scope_begin(e);
 
-	value_t value = eval_with_return(e, do_->body);
+	eval_hold(e, expr, eval_with_return(e, do_->body));
 
 	env_scope_end(e);
-	return value;
+	return eval_release(e);
 }
 
 static value_t eval_expr_fun(env_t *e, expr_t *expr) {
@@ -1242,26 +2130,46 @@ static value_t eval_expr_fun(env_t *e, expr_t *expr) {
 	return value_fun(fun);
 }
 
-static value_t eval_expr_value(env_t *e, expr_t *expr) {
+/* String and array literals are constants, see gc_share */
+value_t op_value(env_t *e, expr_t *expr) {
 	UNUSED(e);
-	if (expr->as.val.type == VALUE_TYPE_STR)
-		return gc_add_elem(&e->gc, value_str(strcpy_to_heap(expr->as.val.as.str)));
-	else
-		return expr->as.val;
+	return expr->as.val;
+}
+
+static int values_are_equal(value_t left, value_t right);
+
+/* Records are equal when they have the same shape and equal fields */
+static bool recs_are_equal(value_t left, value_t right) {
+	value_rec_t *a = value_as_rec(left), *b = value_as_rec(right);
+	if (a == b)
+		return true;
+	else if (a->shape != b->shape)
+		return false;
+
+	for (size_t i = 0; i < a->shape->size; ++ i) {
+		if (!values_are_equal(a->fields[i], b->fields[i]))
+			return false;
+	}
+
+	return true;
 }
 
 static int values_are_equal(value_t left, value_t right) {
-	if (right.type != left.type)
+	if (value_type(right) != value_type(left))
 		return false;
 
-	switch (left.type) {
-	case VALUE_TYPE_NUM:  return left.as.num   == right.as.num;
-	case VALUE_TYPE_BOOL: return left.as.bool_ == right.as.bool_;
-	case VALUE_TYPE_STR:  return strcmp(left.as.str, right.as.str) == 0;
+	switch (value_type(left)) {
+	case VALUE_TYPE_NUM:  return value_as_num(left)   == value_as_num(right);
+	case VALUE_TYPE_BOOL: return value_as_bool(left) == value_as_bool(right);
+	case VALUE_TYPE_STR:  return value_str_equal(left, right);
 	case VALUE_TYPE_NIL:  return true;
-	case VALUE_TYPE_FUN:  return left.as.fun     == right.as.fun;
-	case VALUE_TYPE_NAT:  return left.as.nat     == right.as.nat;
-	case VALUE_TYPE_ARR:  return left.as.arr.buf == right.as.arr.buf;
+	case VALUE_TYPE_FUN:  return value_as_fun(left)     == value_as_fun(right);
+	case VALUE_TYPE_NAT:  return value_as_nat(left)     == value_as_nat(right);
+	case VALUE_TYPE_ARR:  return value_as_arr(left) == value_as_arr(right);
+	case VALUE_TYPE_MAP:  return value_as_map(left) == value_as_map(right);
+	case VALUE_TYPE_REC:  return recs_are_equal(left, right);
+	case VALUE_TYPE_U8S:
+	case VALUE_TYPE_F64S: return value_as_packed(left) == value_as_packed(right);
 
 	default: UNREACHABLE("Unknown value type");
 	}
@@ -1269,514 +2177,586 @@ static int values_are_equal(value_t left, value_t right) {
 	return false;
 }
 
-static value_t eval_expr_bin_op_equals(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
+static value_t str_concat(env_t *e, value_t left, value_t right) {
+	size_t len = value_str_len(left), right_len = value_str_len(right);
+	if (len + right_len <= VALUE_SHORT_STR_MAX) {
+		char buf[VALUE_SHORT_STR_MAX];
+		memcpy(buf, value_str_buf(&left), len);
+		memcpy(buf + len, value_str_buf(&right), right_len);
+		return value_short_str(buf, len + right_len);
+	}
 
-	return value_bool(values_are_equal(left, right));
+	value_t str = gc_str(&e->gc, NULL, len + right_len);
+	memcpy(value_as_str(str)->buf, value_str_buf(&left), len);
+	memcpy(value_as_str(str)->buf + len, value_str_buf(&right), right_len);
+	return str;
 }
 
-static value_t eval_expr_bin_op_not_equals(env_t *e, expr_t *expr) {
-	value_t val  = eval_expr_bin_op_equals(e, expr);
-	val.as.bool_ = !val.as.bool_;
-	return val;
+/* Temporaries can still hold a value from before its variable was last read */
+static bool value_is_owned(env_t *e, value_t val) {
+	if (VALUE_HEADER(value_as_ptr(val))->owner != VALUE_OWNED)
+		return false;
+
+	for (size_t i = 0; i < e->stack_size; ++ i) {
+		if (e->stack[i].bits == val.bits)
+			return false;
+	}
+
+	return e->return_.bits != val.bits;
 }
 
-static value_t eval_expr_bin_op_greater(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
+/* Appends in place while the string has room and nothing else refers to it. Otherwise it is
+   copied with double the room it needs, so building a string with '++' takes amortized O(1) */
+static value_t str_append(env_t *e, value_t str, value_t add) {
+	size_t len = value_str_len(add), size = value_str_len(str);
+	if (value_is_short_str(str) || size + len > value_as_str(str)->cap || !value_is_owned(e, str)) {
+		if (size + len <= VALUE_SHORT_STR_MAX)
+			return str_concat(e, str, add);
 
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
+		value_t copy = gc_str(&e->gc, NULL, (size + len) * 2);
+		memcpy(value_as_str(copy)->buf, value_str_buf(&str), size);
+		value_as_str(copy)->len = size;
 
-	if (right.type != left.type)
-		wrong_type(expr->where, left.type,
-		           "right side of '>' operation, expected same as left side");
+		str = copy;
+		VALUE_HEADER(value_as_str(str))->owner = VALUE_OWNED;
+	}
+
+	/* The text can be the string itself */
+	value_str_t *to = value_as_str(str);
+	memcpy(to->buf + to->len, value_str_buf(&add), len);
+	to->len += len;
+	to->buf[to->len] = '\0';
+	to->hash = 0;
+	return str;
+}
+
+/* Pushes in place while the array has room and the owner allows it, otherwise the copy gets
+   double the room it needs, so pushing in a loop takes amortized O(1). Copies keep the capacity of
+   the array they are made from, which 'reserve' can give room up front */
+static value_t arr_push(env_t *e, value_t arr, value_t val, int owner) {
+	val = gc_share(&e->gc, val);
+
+	size_t size     = value_as_arr(arr)->size;
+	bool   in_place = owner == VALUE_OWNED? value_is_owned(e, arr) :
+	                  VALUE_HEADER(value_as_arr(arr))->owner == VALUE_TEMPORARY;
+	if (!in_place || size >= value_as_arr(arr)->cap) {
+		size_t cap = size * 2 < ARRAY_MIN_GROWTH? ARRAY_MIN_GROWTH : size * 2;
+		if (cap < value_as_arr(arr)->cap)
+			cap = value_as_arr(arr)->cap;
+
+		value_t new = gc_arr_cap(&e->gc, size + 1, cap);
+		memcpy(value_as_arr(new)->buf, value_as_arr(arr)->buf, size * sizeof(value_t));
+		value_as_arr(new)->size = size;
+
+		arr = new;
+		VALUE_HEADER(value_as_arr(arr))->owner = owner;
+	}
+
+	value_as_arr(arr)->buf[value_as_arr(arr)->size ++] = val;
+	gc_barrier(&e->gc, arr, val);
+	return arr;
+}
 
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '>' operation");
+static value_t op_equals(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	UNUSED(expr);
+	return value_bool(values_are_equal(left, right));
+}
 
-	return value_bool(left.as.num > right.as.num);
+static value_t op_not_equals(env_t *e, expr_t *expr, value_t left, value_t right) {
+	value_t val  = op_equals(e, expr, left, right);
+	val = value_bool(!value_as_bool(val));
+	return val;
 }
 
-static value_t eval_expr_bin_op_greater_equ(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
+static value_t op_greater(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(right) != value_type(left))
+		wrong_type(expr->where, value_type(left),
+		           "right side of '>' operation, expected same as left side");
+
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '>' operation");
 
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
+	return value_bool(value_as_num(left) > value_as_num(right));
+}
 
-	if (right.type != left.type)
-		wrong_type(expr->where, left.type,
+static value_t op_greater_equ(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(right) != value_type(left))
+		wrong_type(expr->where, value_type(left),
 		           "right side of '>=' operation, expected same as left side");
 
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '>=' operation");
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '>=' operation");
 
-	return value_bool(left.as.num >= right.as.num);
+	return value_bool(value_as_num(left) >= value_as_num(right));
 }
 
-static value_t eval_expr_bin_op_less(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (right.type != left.type)
-		wrong_type(expr->where, left.type,
+static value_t op_less(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(right) != value_type(left))
+		wrong_type(expr->where, value_type(left),
 		           "right side of '<' operation, expected same as left side");
 
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '<' operation");
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '<' operation");
 
-	return value_bool(left.as.num < right.as.num);
+	return value_bool(value_as_num(left) < value_as_num(right));
 }
 
-static value_t eval_expr_bin_op_less_equ(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
+static value_t op_less_equ(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(right) != value_type(left))
+		wrong_type(expr->where, value_type(left),
+		           "right side of '<=' operation, expected same as left side");
 
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '<=' operation");
 
-	if (right.type != left.type)
-		wrong_type(expr->where, left.type,
-		           "right side of '<=' operation, expected same as left side");
+	return value_bool(value_as_num(left) <= value_as_num(right));
+}
+
+/* Bytes are rounded, and have to fit */
+static void packed_set(env_t *e, expr_t *expr, value_t packed, size_t i, value_t val) {
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), "packed array element assignment");
 
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '<=' operation");
+	double num = value_as_num(val);
+	if (value_type(packed) == VALUE_TYPE_U8S) {
+		num = round(num);
+		if (!(num >= 0 && num <= 255))
+			error(expr->where, "Byte value out of range");
+	}
 
-	return value_bool(left.as.num <= right.as.num);
+	packed = gc_unview(&e->gc, packed);
+	value_packed_set(packed, i, num);
 }
 
-static value_t eval_expr_bin_op_assign(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
+/* Strings are values, so assigning a character never changes another variable, element or argument
+   holding the same string. Short strings are changed in the target itself, and long ones are copied
+   unless the target owns them. The caller stores the changed string back to where it was read
+   from, see op_assign_idx_elem. Keys of maps get a copy too */
+value_t op_assign_idx(env_t *e, expr_t *expr, value_t val, value_t pos, value_t *target) {
+	if (value_type(*target) == VALUE_TYPE_REC) {
+		value_t *field = rec_field(expr->as.bin_op.left, expr->where, *target, pos);
+		*field = gc_share(&e->gc, val);
+		gc_barrier(&e->gc, *target, *field);
+		return val;
+	} else if (value_type(*target) == VALUE_TYPE_MAP) {
+		check_map_key(expr->where, pos);
+		gc_map_set(&e->gc, *target, pos, val);
+		return val;
+	}
 
-	if (bin_op->left->type == EXPR_TYPE_IDX) {
-		value_t val = eval_expr(e, bin_op->right);
+	if (value_type(pos) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(pos), "'[]' operation index");
 
-		expr_idx_t *idx = &bin_op->left->as.idx;
-		if (idx->end != NULL)
-			error(expr->where, "Cannot assign to a slice");
+	if (value_as_num(pos) < 0)
+		error(expr->where, "Negative index is not allowed");
 
-		value_t pos = eval_expr(e, idx->start);
-		if (pos.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, pos.type, "'[]' operation index");
+	if (value_type(*target) == VALUE_TYPE_ARR) {
+		if ((size_t)round(value_as_num(pos)) >= value_as_arr(*target)->size)
+			error(expr->where, "Index exceeds array length");
 
-		if (pos.as.num < 0)
-			error(expr->where, "Negative index is not allowed");
+		val     = gc_share(&e->gc, val);
+		*target = gc_unview(&e->gc, *target);
+		value_as_arr(*target)->buf[(int)round(value_as_num(pos))] = val;
+		gc_barrier(&e->gc, *target, val);
+	} else if (value_type(*target) == VALUE_TYPE_STR) {
+		size_t i = (size_t)round(value_as_num(pos));
+		if (i >= value_str_len(*target))
+			error(expr->where, "Index exceeds string length");
 
-		value_t target = eval_expr(e, idx->expr);
-		if (target.type == VALUE_TYPE_ARR) {
-			if ((size_t)round(pos.as.num) >= target.as.arr.size)
-				error(expr->where, "Index exceeds array length");
+		if (value_type(val) != VALUE_TYPE_STR)
+			wrong_type(expr->where, value_type(val), "string character assignment");
+
+		if (value_str_len(val) != 1)
+			error(expr->where, "Expected a single character");
+
+		if (value_is_short_str(*target)) {
+			((char*)&target->bits)[i + 1] = *value_str_buf(&val);
+			return val;
+		}
 
-			target.as.arr.buf[(int)round(pos.as.num)] = val;
-		} else if (target.type == VALUE_TYPE_STR) {
-			if ((size_t)round(pos.as.num) >= strlen(target.as.str))
-				error(expr->where, "Index exceeds string length");
+		if (value_is_owned(e, *target))
+			*target = gc_unview(&e->gc, *target);
+		else {
+			*target = gc_str(&e->gc, value_str_buf(target), value_str_len(*target));
+			VALUE_HEADER(value_as_str(*target))->owner = VALUE_OWNED;
+		}
 
-			if (val.type != VALUE_TYPE_STR)
-				wrong_type(expr->where, val.type, "string character assignment");
+		value_as_str(*target)->buf[i] = *value_str_buf(&val);
+		value_as_str(*target)->hash = 0;
+	} else if (value_is_packed(*target)) {
+		size_t i = (size_t)round(value_as_num(pos));
+		if (i >= value_as_packed(*target)->size)
+			error(expr->where, "Index exceeds array length");
 
-			if (strlen(val.as.str) != 1)
-				error(expr->where, "Expected a single character");
+		packed_set(e, expr, *target, i, val);
+	} else
+		wrong_type(expr->where, value_type(*target), "'[]' assignment target");
 
-			target.as.str[(int)round(pos.as.num)] = val.as.str[0];
-		} else
-			error(expr->where, "Index assignment only allowed with arrays");
+	return val;
+}
 
+value_t op_assign_idx_elem(env_t *e, expr_t *expr, value_t val, value_t pos, value_t of,
+                           value_t at) {
+	value_t target = op_idx(e, expr->as.bin_op.left->as.idx.expr, of, at), prev = target;
+	val = op_assign_idx(e, expr, val, pos, &target);
+	if (target.bits == prev.bits)
 		return val;
-	} else if (bin_op->left->type == EXPR_TYPE_ID) {
-		char *name = bin_op->left->as.id.name;
 
-		value_t val = eval_expr(e, bin_op->right);
-		var_t *var  = env_get_var(e, name);
-		if (var == NULL)
-			undefined(expr->where, name);
+	/* The changed string is stored without sharing it, so the element keeps owning its copy */
+	if (value_type(of) == VALUE_TYPE_ARR) {
+		of = gc_unview(&e->gc, of);
+		value_as_arr(of)->buf[(int)round(value_as_num(at))] = target;
+		gc_barrier(&e->gc, of, target);
+	} else if (value_type(of) == VALUE_TYPE_MAP) {
+		gc_map_set(&e->gc, of, at, target);
+		if (!value_is_short_str(target))
+			VALUE_HEADER(value_as_str(target))->owner = VALUE_OWNED;
+	} else if (value_type(of) == VALUE_TYPE_REC) {
+		*rec_field(expr->as.bin_op.left->as.idx.expr, expr->where, of, at) = target;
+		gc_barrier(&e->gc, of, target);
+	}
 
-		if (var->const_)
-			error(expr->where, "Attempt to assign to constant '%s'", name);
+	return val;
+}
 
-		var->val = val;
-		return val;
-	} else
-		error(expr->where, "left side of '=' expected variable");
+value_t op_assign(env_t *e, expr_t *expr, var_t *var, value_t val) {
+	UNUSED(e);
+	char *name = expr->as.bin_op.left->as.id.name;
+	if (var == NULL)
+		undefined(expr->where, name);
 
-	return value_nil();
+	if (var->const_)
+		error(expr->where, "Attempt to assign to constant '%s'", name);
+
+	var->val = gc_share(&e->gc, val);
+	return var->val;
 }
 
-static value_t eval_expr_bin_op_inc(env_t *e, expr_t *expr) {
+static value_t eval_expr_bin_op_assign(env_t *e, expr_t *expr) {
 	expr_bin_op_t *bin_op = &expr->as.bin_op;
 
 	if (bin_op->left->type == EXPR_TYPE_IDX) {
-		value_t val = eval_expr(e, bin_op->right);
+		eval_hold(e, expr, eval_expr(e, bin_op->right));
 
 		expr_idx_t *idx = &bin_op->left->as.idx;
 		if (idx->end != NULL)
 			error(expr->where, "Cannot assign to a slice");
 
-		value_t pos = eval_expr(e, idx->start);
-		if (pos.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, pos.type, "'[]' operation index");
+		eval_hold(e, expr, eval_expr(e, idx->start));
+		if (idx->expr->type == EXPR_TYPE_IDX && idx->expr->as.idx.end == NULL) {
+			eval_hold(e, expr, eval_expr(e, idx->expr->as.idx.expr));
+			value_t at  = eval_expr(e, idx->expr->as.idx.start);
+			value_t of  = eval_release(e);
+			value_t pos = eval_release(e);
+			value_t val = eval_release(e);
+			return op_assign_idx_elem(e, expr, val, pos, of, at);
+		}
 
-		if (pos.as.num < 0)
-			error(expr->where, "Negative index is not allowed");
+		value_t target = eval_expr(e, idx->expr), prev = target;
+		value_t pos    = eval_release(e);
+		value_t val    = eval_release(e);
+		val = op_assign_idx(e, expr, val, pos, &target);
+		if (target.bits != prev.bits && idx->expr->type == EXPR_TYPE_ID)
+			env_get_var(e, idx->expr->as.id.name)->val = target;
 
-		value_t target = eval_expr(e, idx->expr);
-		if (target.type == VALUE_TYPE_ARR) {
-			if ((size_t)round(pos.as.num) >= target.as.arr.size)
-				error(expr->where, "Index exceeds array length");
-
-			if (target.as.arr.buf[(int)round(pos.as.num)].type == VALUE_TYPE_NUM) {
-				if (val.type != target.as.arr.buf[(int)round(pos.as.num)].type)
-					wrong_type(expr->where, val.type, "'++' assignment");
-
-				target.as.arr.buf[(int)round(pos.as.num)].as.num += val.as.num;
-			} else if (target.as.arr.buf[(int)round(pos.as.num)].type == VALUE_TYPE_STR) {
-				if (val.type != target.as.arr.buf[(int)round(pos.as.num)].type)
-					wrong_type(expr->where, val.type, "'++' assignment");
-
-				value_t *str = &target.as.arr.buf[(int)round(pos.as.num)];
-				char *concatted = (char*)malloc(strlen(str->as.str) + strlen(val.as.str) + 1);
-				if (concatted == NULL)
-					UNREACHABLE("malloc() fail");
-
-				strcpy(concatted, str->as.str);
-				strcat(concatted, val.as.str);
-				str->as.str = concatted;
-				return gc_add_elem(&e->gc, *str);
-			} else if (target.as.arr.buf[(int)round(pos.as.num)].type == VALUE_TYPE_ARR) {
-				value_t *arr = &target.as.arr.buf[(int)round(pos.as.num)];
-				value_t  new = gc_add_elem(&e->gc, value_arr(arr->as.arr.size + 1));
-				for (size_t i = 0; i < arr->as.arr.size; ++ i)
-					new.as.arr.buf[i] = arr->as.arr.buf[i];
-
-				new.as.arr.buf[arr->as.arr.size] = val;
-				*arr = new;
-			} else
-				wrong_type(expr->where, val.type, "left side of '++' assignment");
-		} else
-			error(expr->where, "Index assignment only allowed with arrays");
+		return val;
 	} else if (bin_op->left->type == EXPR_TYPE_ID) {
-		char *name = bin_op->left->as.id.name;
-
 		value_t val = eval_expr(e, bin_op->right);
-		var_t *var  = env_get_var(e, name);
-		if (var == NULL)
-			undefined(expr->where, name);
-
-		if (var->val.type == VALUE_TYPE_ARR) {
-			value_t new = gc_add_elem(&e->gc, value_arr(var->val.as.arr.size + 1));
-			for (size_t i = 0; i < var->val.as.arr.size; ++ i)
-				new.as.arr.buf[i] = var->val.as.arr.buf[i];
-
-			new.as.arr.buf[var->val.as.arr.size] = val;
-			var->val = new;
-			return new;
-		} else {
-			if (val.type != var->val.type)
-				wrong_type(expr->where, val.type, "'++' assignment");
-
-			if (val.type != VALUE_TYPE_NUM && val.type != VALUE_TYPE_STR)
-				wrong_type(expr->where, val.type, "left side of '++' assignment");
-
-			if (val.type == VALUE_TYPE_STR) {
-				char *concatted = (char*)malloc(strlen(var->val.as.str) + strlen(val.as.str) + 1);
-				if (concatted == NULL)
-					UNREACHABLE("malloc() fail");
-
-				strcpy(concatted, var->val.as.str);
-				strcat(concatted, val.as.str);
-				var->val.as.str = concatted;
-				return gc_add_elem(&e->gc, var->val);
-			} else {
-				var->val.as.num += val.as.num;
-				return val;
-			}
-		}
-	} else
-		error(expr->where, "left side of '++' expected variable");
+		return op_assign(e, expr, env_get_var(e, bin_op->left->as.id.name), val);
+	}
+	else
+		error(expr->where, "left side of '=' expected variable");
 
 	return value_nil();
 }
 
-static value_t eval_expr_bin_op_dec(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
+/* The element of an array, the value of a map key or the field of a record that is updated in
+   place. The target is set to the array or record it is stored in, for the barrier */
+static value_t *update_elem(env_t *e, expr_t *expr, value_t pos, value_t *target) {
+	if (value_type(*target) == VALUE_TYPE_REC)
+		return rec_field(expr->as.bin_op.left, expr->where, *target, pos);
+	else if (value_type(*target) == VALUE_TYPE_MAP) {
+		check_map_key(expr->where, pos);
+		value_t *elem = value_map_find(*target, pos);
+		if (elem == NULL)
+			error(expr->where, "Key not found in map");
+
+		*target = value_as_map(*target)->slots;
+		return elem;
+	} else if (value_type(*target) != VALUE_TYPE_ARR)
+		wrong_type(expr->where, value_type(*target), "'[]' assignment target");
+
+	if ((size_t)round(value_as_num(pos)) >= value_as_arr(*target)->size)
+		error(expr->where, "Index exceeds array length");
+
+	*target = gc_unview(&e->gc, *target);
+	return &value_as_arr(*target)->buf[(int)round(value_as_num(pos))];
+}
+
+static value_t op_inc_idx(env_t *e, expr_t *expr, value_t val, value_t pos, value_t target) {
+	value_t *elem = update_elem(e, expr, pos, &target);
+	if (value_type(*elem) == VALUE_TYPE_NUM) {
+		if (value_type(val) != value_type(*elem))
+			wrong_type(expr->where, value_type(val), "'++' assignment");
+
+		*elem = value_num(value_as_num(*elem) + value_as_num(val));
+	} else if (value_type(*elem) == VALUE_TYPE_STR) {
+		if (value_type(val) != value_type(*elem))
+			wrong_type(expr->where, value_type(val), "'++' assignment");
+
+		*elem = str_append(e, *elem, val);
+		gc_barrier(&e->gc, target, *elem);
+		return *elem;
+	} else if (value_type(*elem) == VALUE_TYPE_ARR) {
+		*elem = arr_push(e, *elem, val, VALUE_OWNED);
+		gc_barrier(&e->gc, target, *elem);
+	} else
+		wrong_type(expr->where, value_type(val), "left side of '++' assignment");
 
-	if (bin_op->left->type == EXPR_TYPE_IDX) {
-		value_t val = eval_expr(e, bin_op->right);
+	return value_nil();
+}
 
-		expr_idx_t *idx = &bin_op->left->as.idx;
-		if (idx->end != NULL)
-			error(expr->where, "Cannot assign to a slice");
+static value_t op_inc(env_t *e, expr_t *expr, var_t *var, value_t val) {
+	if (var == NULL)
+		undefined(expr->where, expr->as.bin_op.left->as.id.name);
 
-		value_t pos = eval_expr(e, idx->start);
-		if (pos.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, pos.type, "'[]' operation index");
+	if (value_type(var->val) == VALUE_TYPE_ARR) {
+		var->val = arr_push(e, var->val, val, VALUE_OWNED);
+		return var->val;
+	} else {
+		if (value_type(val) != value_type(var->val))
+			wrong_type(expr->where, value_type(val), "'++' assignment");
 
-		if (pos.as.num < 0)
-			error(expr->where, "Negative index is not allowed");
+		if (value_type(val) != VALUE_TYPE_NUM && value_type(val) != VALUE_TYPE_STR)
+			wrong_type(expr->where, value_type(val), "left side of '++' assignment");
 
-		value_t target = eval_expr(e, idx->expr);
-		if (target.type == VALUE_TYPE_ARR) {
-			if ((size_t)round(pos.as.num) >= target.as.arr.size)
-				error(expr->where, "Index exceeds array length");
+		if (value_type(val) == VALUE_TYPE_STR) {
+			var->val = str_append(e, var->val, val);
+			return var->val;
+		} else {
+			var->val = value_num(value_as_num(var->val) + value_as_num(val));
+			return val;
+		}
+	}
+}
 
-			if (val.type != target.as.arr.buf[(int)round(pos.as.num)].type)
-				wrong_type(expr->where, val.type, "'--' assignment");
+static const char *bin_op_to_cstr_map[BIN_OP_TYPE_COUNT] = {
+	[BIN_OP_DEC]  = "--",
+	[BIN_OP_XINC] = "**",
+	[BIN_OP_XDEC] = "//",
+};
 
-			if (val.type != VALUE_TYPE_NUM)
-				wrong_type(expr->where, val.type, "left side of '--' assignment");
+/* '--', '**' and '//' only work on numbers */
+static value_t num_update(bin_op_type_t type, value_t num, double by) {
+	switch (type) {
+	case BIN_OP_DEC:  return value_num(value_as_num(num) - by);
+	case BIN_OP_XINC: return value_num(value_as_num(num) * by);
+	case BIN_OP_XDEC: return value_num(value_as_num(num) / by);
 
-			target.as.arr.buf[(int)round(pos.as.num)].as.num -= val.as.num;
-		} else
-			error(expr->where, "Index assignment only allowed with arrays");
-	} else if (bin_op->left->type == EXPR_TYPE_ID) {
-		char *name = bin_op->left->as.id.name;
+	default: UNREACHABLE("Unknown update operation type");
+	}
 
-		value_t val = eval_expr(e, bin_op->right);
-		var_t *var  = env_get_var(e, name);
-		if (var == NULL)
-			undefined(expr->where, name);
+	return num;
+}
+
+static value_t op_num_update_idx(env_t *e, expr_t *expr, value_t val, value_t pos,
+                                 value_t target) {
+	UNUSED(e);
+	const char *op = bin_op_to_cstr_map[expr->as.bin_op.type];
+	char msg[64];
 
-		if (val.type != var->val.type)
-			wrong_type(expr->where, val.type, "'--' assignment");
+	value_t *elem = update_elem(e, expr, pos, &target);
 
-		if (val.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, val.type, "left side of '--' assignment");
+	snprintf(msg, sizeof(msg), "'%s' assignment", op);
+	if (value_type(val) != value_type(*elem))
+		wrong_type(expr->where, value_type(val), msg);
 
-		var->val.as.num -= val.as.num;
-		return val;
-	} else
-		error(expr->where, "left side of '--' expected variable");
+	snprintf(msg, sizeof(msg), "left side of '%s' assignment", op);
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), msg);
 
+	*elem = num_update(expr->as.bin_op.type, *elem, value_as_num(val));
 	return value_nil();
 }
 
-static value_t eval_expr_bin_op_xinc(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	if (bin_op->left->type == EXPR_TYPE_IDX) {
-		value_t val = eval_expr(e, bin_op->right);
-
-		expr_idx_t *idx = &bin_op->left->as.idx;
-		if (idx->end != NULL)
-			error(expr->where, "Cannot assign to a slice");
-
-		value_t pos = eval_expr(e, idx->start);
-		if (pos.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, pos.type, "'[]' operation index");
+static value_t op_num_update(env_t *e, expr_t *expr, var_t *var, value_t val) {
+	UNUSED(e);
+	const char *op = bin_op_to_cstr_map[expr->as.bin_op.type];
+	char msg[64];
 
-		if (pos.as.num < 0)
-			error(expr->where, "Negative index is not allowed");
+	if (var == NULL)
+		undefined(expr->where, expr->as.bin_op.left->as.id.name);
 
-		value_t target = eval_expr(e, idx->expr);
-		if (target.type == VALUE_TYPE_ARR) {
-			if ((size_t)round(pos.as.num) >= target.as.arr.size)
-				error(expr->where, "Index exceeds array length");
+	snprintf(msg, sizeof(msg), "'%s' assignment", op);
+	if (value_type(val) != value_type(var->val))
+		wrong_type(expr->where, value_type(val), msg);
 
-			if (val.type != target.as.arr.buf[(int)round(pos.as.num)].type)
-				wrong_type(expr->where, val.type, "'**' assignment");
+	snprintf(msg, sizeof(msg), "left side of '%s' assignment", op);
+	if (value_type(val) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(val), msg);
 
-			if (val.type != VALUE_TYPE_NUM)
-				wrong_type(expr->where, val.type, "left side of '**' assignment");
+	var->val = num_update(expr->as.bin_op.type, var->val, value_as_num(val));
+	return val;
+}
 
-			target.as.arr.buf[(int)round(pos.as.num)].as.num *= val.as.num;
-		} else
-			error(expr->where, "Index assignment only allowed with arrays");
-	} else if (bin_op->left->type == EXPR_TYPE_ID) {
-		char *name = bin_op->left->as.id.name;
+value_t op_update_idx(env_t *e, expr_t *expr, value_t val, value_t pos, value_t target) {
+	if (value_type(target) != VALUE_TYPE_MAP && value_type(target) != VALUE_TYPE_REC) {
+		if (value_type(pos) != VALUE_TYPE_NUM)
+			wrong_type(expr->where, value_type(pos), "'[]' operation index");
 
-		value_t val = eval_expr(e, bin_op->right);
-		var_t *var  = env_get_var(e, name);
-		if (var == NULL)
-			undefined(expr->where, name);
+		if (value_as_num(pos) < 0)
+			error(expr->where, "Negative index is not allowed");
+	}
 
-		if (val.type != var->val.type)
-			wrong_type(expr->where, val.type, "'**' assignment");
+	if (value_is_packed(target)) {
+		size_t i = (size_t)round(value_as_num(pos));
+		if (i >= value_as_packed(target)->size)
+			error(expr->where, "Index exceeds array length");
+
+		if (value_type(val) != VALUE_TYPE_NUM) {
+			char msg[64];
+			snprintf(msg, sizeof(msg), "'%s' assignment",
+			         expr->as.bin_op.type == BIN_OP_INC? "++" :
+			                                             bin_op_to_cstr_map[expr->as.bin_op.type]);
+			wrong_type(expr->where, value_type(val), msg);
+		}
 
-		if (val.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, val.type, "left side of '**' assignment");
+		value_t elem = value_packed_get(target, i);
+		elem = expr->as.bin_op.type == BIN_OP_INC?
+		       value_num(value_as_num(elem) + value_as_num(val)) :
+		       num_update(expr->as.bin_op.type, elem, value_as_num(val));
+		packed_set(e, expr, target, i, elem);
+		return value_nil();
+	}
 
-		var->val.as.num *= val.as.num;
-		return val;
-	} else
-		error(expr->where, "left side of '**' expected variable");
+	if (expr->as.bin_op.type == BIN_OP_INC)
+		return op_inc_idx(e, expr, val, pos, target);
+	else
+		return op_num_update_idx(e, expr, val, pos, target);
+}
 
-	return value_nil();
+value_t op_update(env_t *e, expr_t *expr, var_t *var, value_t val) {
+	if (expr->as.bin_op.type == BIN_OP_INC)
+		return op_inc(e, expr, var, val);
+	else
+		return op_num_update(e, expr, var, val);
 }
 
-static value_t eval_expr_bin_op_xdec(env_t *e, expr_t *expr) {
+/* '++', '--', '**' and '//' */
+static value_t eval_expr_bin_op_update(env_t *e, expr_t *expr) {
 	expr_bin_op_t *bin_op = &expr->as.bin_op;
 
 	if (bin_op->left->type == EXPR_TYPE_IDX) {
-		value_t val = eval_expr(e, bin_op->right);
+		eval_hold(e, expr, eval_expr(e, bin_op->right));
 
 		expr_idx_t *idx = &bin_op->left->as.idx;
 		if (idx->end != NULL)
 			error(expr->where, "Cannot assign to a slice");
 
-		value_t pos = eval_expr(e, idx->start);
-		if (pos.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, pos.type, "'[]' operation index");
-
-		if (pos.as.num < 0)
-			error(expr->where, "Negative index is not allowed");
-
+		eval_hold(e, expr, eval_expr(e, idx->start));
 		value_t target = eval_expr(e, idx->expr);
-		if (target.type == VALUE_TYPE_ARR) {
-			if ((size_t)round(pos.as.num) >= target.as.arr.size)
-				error(expr->where, "Index exceeds array length");
-
-			if (val.type != target.as.arr.buf[(int)round(pos.as.num)].type)
-				wrong_type(expr->where, val.type, "'//' assignment");
-
-			if (val.type != VALUE_TYPE_NUM)
-				wrong_type(expr->where, val.type, "left side of '//' assignment");
-
-			target.as.arr.buf[(int)round(pos.as.num)].as.num /= val.as.num;
-		} else
-			error(expr->where, "Index assignment only allowed with arrays");
+		value_t pos    = eval_release(e);
+		value_t val    = eval_release(e);
+		return op_update_idx(e, expr, val, pos, target);
 	} else if (bin_op->left->type == EXPR_TYPE_ID) {
-		char *name = bin_op->left->as.id.name;
-
 		value_t val = eval_expr(e, bin_op->right);
-		var_t *var  = env_get_var(e, name);
-		if (var == NULL)
-			undefined(expr->where, name);
-
-		if (val.type != var->val.type)
-			wrong_type(expr->where, val.type, "'//' assignment");
-
-		if (val.type != VALUE_TYPE_NUM)
-			wrong_type(expr->where, val.type, "left side of '//' assignment");
-
-		var->val.as.num /= val.as.num;
-		return val;
-	} else
-		error(expr->where, "left side of '//' expected variable");
+		return op_update(e, expr, env_get_var(e, bin_op->left->as.id.name), val);
+	}
+	else if (bin_op->type == BIN_OP_INC)
+		error(expr->where, "left side of '++' expected variable");
+	else
+		error(expr->where, "left side of '%s' expected variable",
+		      bin_op_to_cstr_map[bin_op->type]);
 
 	return value_nil();
 }
 
-static value_t eval_expr_bin_op_add(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_ARR && right.type != left.type)
-		wrong_type(expr->where, right.type,
+static value_t op_add(env_t *e, expr_t *expr, value_t left, value_t right) {
+	if (value_type(left) != VALUE_TYPE_ARR && value_type(right) != value_type(left))
+		wrong_type(expr->where, value_type(right),
 		           "right side of '+' operation, expected same as left side");
 
-	if (left.type == VALUE_TYPE_STR) {
-		char *concatted = (char*)malloc(strlen(left.as.str) + strlen(right.as.str) + 1);
-		if (concatted == NULL)
-			UNREACHABLE("malloc() fail");
-
-		strcpy(concatted, left.as.str);
-		strcat(concatted, right.as.str);
-		left.as.str = concatted;
-		gc_add_elem(&e->gc, left);
-	} else if (left.type == VALUE_TYPE_NUM)
-		left.as.num += right.as.num;
-	else if (left.type == VALUE_TYPE_ARR) {
-		value_t new = value_arr(left.as.arr.size + 1);
-		for (size_t i = 0; i < left.as.arr.size; ++ i)
-			new.as.arr.buf[i] = left.as.arr.buf[i];
-
-		new.as.arr.buf[left.as.arr.size] = right;
-		return new;
-	} else
-		wrong_type(expr->where, left.type, "left side of '+' operation");
+	if (value_type(left) == VALUE_TYPE_STR)
+		left = str_concat(e, left, right);
+	else if (value_type(left) == VALUE_TYPE_NUM)
+		left = value_num(value_as_num(left) + value_as_num(right));
+	else if (value_type(left) == VALUE_TYPE_ARR)
+		left = arr_push(e, left, right, VALUE_TEMPORARY);
+	else
+		wrong_type(expr->where, value_type(left), "left side of '+' operation");
 
 	return left;
 }
 
-static value_t eval_expr_bin_op_sub(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '-' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_sub(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '-' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '-' operation, expected same as left side");
 
-	left.as.num -= right.as.num;
+	left = value_num(value_as_num(left) - value_as_num(right));
 	return left;
 }
 
-static value_t eval_expr_bin_op_mul(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '*' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_mul(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '*' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '*' operation, expected same as left side");
 
-	left.as.num *= right.as.num;
+	left = value_num(value_as_num(left) * value_as_num(right));
 	return left;
 }
 
-static value_t eval_expr_bin_op_div(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '/' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_div(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '/' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '/' operation, expected same as left side");
 
-	if (right.as.num == 0)
+	if (value_as_num(right) == 0)
 		error(expr->where, "division by zero");
 
-	left.as.num /= right.as.num;
+	left = value_num(value_as_num(left) / value_as_num(right));
 	return left;
 }
 
-static value_t eval_expr_bin_op_pow(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '^' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_pow(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '^' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '^' operation, expected same as left side");
 
-	left.as.num = pow(left.as.num, right.as.num);
+	left = value_num(pow(value_as_num(left), value_as_num(right)));
 	return left;
 }
 
-static value_t eval_expr_bin_op_mod(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '^' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_mod(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '^' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '^' operation, expected same as left side");
 
-	if (right.as.num == 0)
+	if (value_as_num(right) == 0)
 		error(expr->where, "division by zero");
 
-	double remainder = left.as.num / right.as.num;
-	left.as.num = right.as.num * (remainder - floor(remainder));
+	double remainder = value_as_num(left) / value_as_num(right);
+	left = value_num(value_as_num(right) * (remainder - floor(remainder)));
 	return left;
 }
 
@@ -1784,18 +2764,18 @@ static value_t eval_expr_bin_op_and(env_t *e, expr_t *expr) {
 	expr_bin_op_t *bin_op = &expr->as.bin_op;
 
 	value_t left = eval_expr(e, bin_op->left);
-	if (left.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, left.type, "left side of 'and' operation");
+	if (value_type(left) != VALUE_TYPE_BOOL)
+		wrong_type(expr->where, value_type(left), "left side of 'and' operation");
 
-	if (!left.as.bool_)
+	if (!value_as_bool(left))
 		return left;
 
 	value_t right = eval_expr(e, bin_op->right);
-	if (right.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, right.type,
+	if (value_type(right) != VALUE_TYPE_BOOL)
+		wrong_type(expr->where, value_type(right),
 		           "right side of 'and' operation, expected same as left side");
 
-	left.as.bool_ = left.as.bool_ && right.as.bool_;
+	left = value_bool(value_as_bool(left) && value_as_bool(right));
 	return left;
 }
 
@@ -1803,136 +2783,132 @@ static value_t eval_expr_bin_op_or(env_t *e, expr_t *expr) {
 	expr_bin_op_t *bin_op = &expr->as.bin_op;
 
 	value_t left = eval_expr(e, bin_op->left);
-	if (left.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, left.type, "left side of 'or' operation");
+	if (value_type(left) != VALUE_TYPE_BOOL)
+		wrong_type(expr->where, value_type(left), "left side of 'or' operation");
 
-	if (left.as.bool_)
+	if (value_as_bool(left))
 		return left;
 
 	value_t right = eval_expr(e, bin_op->right);
-	if (right.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, right.type,
+	if (value_type(right) != VALUE_TYPE_BOOL)
+		wrong_type(expr->where, value_type(right),
 		           "right side of 'or' operation, expected same as left side");
 
-	left.as.bool_ = left.as.bool_ || right.as.bool_;
+	left = value_bool(value_as_bool(left) || value_as_bool(right));
 	return left;
 }
 
-static value_t eval_expr_bin_op_in(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (right.type == VALUE_TYPE_ARR) {
-		for (size_t i = 0; i < right.as.arr.size; ++ i) {
-			if (values_are_equal(right.as.arr.buf[i], left))
+/* Gives where the value is, or nil. Keys of maps are their own place */
+static value_t op_in(env_t *e, expr_t *expr, value_t left, value_t right) {
+	UNUSED(e);
+	if (value_type(right) == VALUE_TYPE_MAP) {
+		if (value_map_find(right, left) != NULL)
+			return left;
+	} else if (value_type(right) == VALUE_TYPE_ARR) {
+		for (size_t i = 0; i < value_as_arr(right)->size; ++ i) {
+			if (values_are_equal(value_as_arr(right)->buf[i], left))
+				return value_num(i);
+		}
+	} else if (value_type(right) == VALUE_TYPE_STR) {
+		if (value_type(left) != VALUE_TYPE_STR)
+			wrong_type(expr->where, value_type(left), "left side of 'in' operation");
+
+		/* Compared by length, since strings can have zero bytes in them */
+		const char *str = value_str_buf(&right), *sub = value_str_buf(&left);
+		size_t      len = value_str_len(right),   sub_len = value_str_len(left);
+		for (size_t i = 0; i + sub_len <= len; ++ i) {
+			if (memcmp(str + i, sub, sub_len) == 0)
 				return value_num(i);
 		}
-	} else if (right.type == VALUE_TYPE_STR) {
-		if (left.type != VALUE_TYPE_STR)
-			wrong_type(expr->where, left.type, "left side of 'in' operation");
-
-		const char *ptr = strstr(right.as.str, left.as.str);
-		if (ptr != NULL)
-			return value_num((double)(ptr - right.as.str));
 	} else
-		wrong_type(expr->where, right.type, "right side of 'in' operation");
+		wrong_type(expr->where, value_type(right), "right side of 'in' operation");
 
 	return value_nil();
 }
 
-static value_t eval_expr_bin_op_range(env_t *e, expr_t *expr) {
-	expr_bin_op_t *bin_op = &expr->as.bin_op;
-
-	value_t left  = eval_expr(e, bin_op->left);
-	value_t right = eval_expr(e, bin_op->right);
-
-	if (left.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, left.type, "left side of '..' operation");
-	else if (right.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, right.type,
+static value_t op_range(env_t *e, expr_t *expr, value_t left, value_t right) {
+	if (value_type(left) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(left), "left side of '..' operation");
+	else if (value_type(right) != VALUE_TYPE_NUM)
+		wrong_type(expr->where, value_type(right),
 		           "right side of '..' operation, expected same as left side");
 
-	size_t from = left.as.num;
-	size_t to   = right.as.num;
+	size_t from = value_as_num(left);
+	size_t to   = value_as_num(right);
 
-	size_t  size = to - from + (bin_op->type == BIN_OP_RANGE);
-	value_t val  = gc_add_elem(&e->gc, value_arr(size));
+	size_t  size = to - from + (expr->as.bin_op.type == BIN_OP_RANGE);
+	value_t val  = gc_arr(&e->gc, size);
 
-	for (size_t i = 0; i < val.as.arr.size; ++ i)
-		val.as.arr.buf[i] = value_num((size_t)round(left.as.num) + i);
+	for (size_t i = 0; i < value_as_arr(val)->size; ++ i)
+		value_as_arr(val)->buf[i] = value_num((size_t)round(value_as_num(left)) + i);
 
 	return val;
 }
 
-static value_t eval_expr_bin_op(env_t *e, expr_t *expr) {
+value_t op_bin(env_t *e, expr_t *expr, value_t left, value_t right) {
 	switch (expr->as.bin_op.type) {
-	case BIN_OP_EQUALS:      return eval_expr_bin_op_equals(     e, expr);
-	case BIN_OP_NOT_EQUALS:  return eval_expr_bin_op_not_equals( e, expr);
-	case BIN_OP_GREATER:     return eval_expr_bin_op_greater(    e, expr);
-	case BIN_OP_GREATER_EQU: return eval_expr_bin_op_greater_equ(e, expr);
-	case BIN_OP_LESS:        return eval_expr_bin_op_less(       e, expr);
-	case BIN_OP_LESS_EQU:    return eval_expr_bin_op_less_equ(   e, expr);
-
-	case BIN_OP_AND:    return eval_expr_bin_op_and(   e, expr);
-	case BIN_OP_OR:     return eval_expr_bin_op_or(    e, expr);
-	case BIN_OP_IN:     return eval_expr_bin_op_in(    e, expr);
-	case BIN_OP_RANGE:  return eval_expr_bin_op_range( e, expr);
-	case BIN_OP_ERANGE: return eval_expr_bin_op_range( e, expr);
-
-	case BIN_OP_ASSIGN: return eval_expr_bin_op_assign(e, expr);
-	case BIN_OP_INC:    return eval_expr_bin_op_inc(   e, expr);
-	case BIN_OP_DEC:    return eval_expr_bin_op_dec(   e, expr);
-	case BIN_OP_XINC:   return eval_expr_bin_op_xinc(  e, expr);
-	case BIN_OP_XDEC:   return eval_expr_bin_op_xdec(  e, expr);
-
-	case BIN_OP_ADD: return eval_expr_bin_op_add(e, expr);
-	case BIN_OP_SUB: return eval_expr_bin_op_sub(e, expr);
-	case BIN_OP_MUL: return eval_expr_bin_op_mul(e, expr);
-	case BIN_OP_DIV: return eval_expr_bin_op_div(e, expr);
-	case BIN_OP_POW: return eval_expr_bin_op_pow(e, expr);
-	case BIN_OP_MOD: return eval_expr_bin_op_mod(e, expr);
+	case BIN_OP_EQUALS:      return op_equals(     e, expr, left, right);
+	case BIN_OP_NOT_EQUALS:  return op_not_equals( e, expr, left, right);
+	case BIN_OP_GREATER:     return op_greater(    e, expr, left, right);
+	case BIN_OP_GREATER_EQU: return op_greater_equ(e, expr, left, right);
+	case BIN_OP_LESS:        return op_less(       e, expr, left, right);
+	case BIN_OP_LESS_EQU:    return op_less_equ(   e, expr, left, right);
+
+	case BIN_OP_IN:     return op_in(   e, expr, left, right);
+	case BIN_OP_RANGE:  return op_range(e, expr, left, right);
+	case BIN_OP_ERANGE: return op_range(e, expr, left, right);
+
+	case BIN_OP_ADD: return op_add(e, expr, left, right);
+	case BIN_OP_SUB: return op_sub(e, expr, left, right);
+	case BIN_OP_MUL: return op_mul(e, expr, left, right);
+	case BIN_OP_DIV: return op_div(e, expr, left, right);
+	case BIN_OP_POW: return op_pow(e, expr, left, right);
+	case BIN_OP_MOD: return op_mod(e, expr, left, right);
 
 	default: UNREACHABLE("Unknown binary operation type");
 	}
 }
 
-static value_t eval_expr_un_op_pos(env_t *e, expr_t *expr) {
-	expr_un_op_t *un_op = &expr->as.un_op;
-
-	value_t val = eval_expr(e, un_op->expr);
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'+' unary operation");
+static value_t eval_expr_bin_op(env_t *e, expr_t *expr) {
+	switch (expr->as.bin_op.type) {
+	case BIN_OP_AND: return eval_expr_bin_op_and(e, expr);
+	case BIN_OP_OR:  return eval_expr_bin_op_or( e, expr);
 
-	return val;
+	case BIN_OP_ASSIGN: return eval_expr_bin_op_assign(e, expr);
+	case BIN_OP_INC:
+	case BIN_OP_DEC:
+	case BIN_OP_XINC:
+	case BIN_OP_XDEC:   return eval_expr_bin_op_update(e, expr);
+
+	default: {
+		eval_hold(e, expr, eval_expr(e, expr->as.bin_op.left));
+		value_t right = eval_expr(e, expr->as.bin_op.right);
+		value_t left  = eval_release(e);
+		return op_bin(e, expr, left, right);
+	}
+	}
 }
 
-static value_t eval_expr_un_op_neg(env_t *e, expr_t *expr) {
-	expr_un_op_t *un_op = &expr->as.un_op;
-
-	value_t val = eval_expr(e, un_op->expr);
-	if (val.type != VALUE_TYPE_NUM)
-		wrong_type(expr->where, val.type, "'-' unary operation");
+value_t op_un(env_t *e, expr_t *expr, value_t val) {
+	UNUSED(e);
+	switch (expr->as.un_op.type) {
+	case UN_OP_POS:
+		if (value_type(val) != VALUE_TYPE_NUM)
+			wrong_type(expr->where, value_type(val), "'+' unary operation");
 
-	return value_num(-val.as.num);
-}
+		return val;
 
-static value_t eval_expr_un_op_not(env_t *e, expr_t *expr) {
-	expr_un_op_t *un_op = &expr->as.un_op;
+	case UN_OP_NEG:
+		if (value_type(val) != VALUE_TYPE_NUM)
+			wrong_type(expr->where, value_type(val), "'-' unary operation");
 
-	value_t val = eval_expr(e, un_op->expr);
-	if (val.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, val.type, "'not' operation");
+		return value_num(-value_as_num(val));
 
-	return value_bool(!val.as.bool_);
-}
+	case UN_OP_NOT:
+		if (value_type(val) != VALUE_TYPE_BOOL)
+			wrong_type(expr->where, value_type(val), "'not' operation");
 
-static value_t eval_expr_un_op(env_t *e, expr_t *expr) {
-	switch (expr->as.un_op.type) {
-	case UN_OP_POS: return eval_expr_un_op_pos(e, expr);
-	case UN_OP_NEG: return eval_expr_un_op_neg(e, expr);
-	case UN_OP_NOT: return eval_expr_un_op_not(e, expr);
+		return value_bool(!value_as_bool(val));
 
 	default: UNREACHABLE("Unknown unary operation type");
 	}
@@ -1942,10 +2918,10 @@ static value_t eval_expr_if(env_t *e, expr_t *expr) {
 	expr_if_t *if_ = &expr->as.if_;
 
 	value_t cond = eval_expr(e, if_->cond);
-	if (cond.type != VALUE_TYPE_BOOL)
-		wrong_type(expr->where, cond.type, "if statement condition");
+	if (value_type(cond) != VALUE_TYPE_BOOL)
+		wrong_type(expr->where, value_type(cond), "if statement condition");
 
-	if (cond.as.bool_)
+	if (value_as_bool(cond))
 		return eval_expr(e, if_->a);
 	else
 		return eval_expr(e, if_->b);
@@ -1956,14 +2932,16 @@ static value_t eval_expr(env_t *e, expr_t *expr) {
 	case EXPR_TYPE_CALL:   return eval_expr_call(  e, expr);
 	case EXPR_TYPE_FMT:    return eval_expr_fmt(   e, expr);
 	case EXPR_TYPE_ARR:    return eval_expr_arr(   e, expr);
+	case EXPR_TYPE_MAP:    return eval_expr_map(   e, expr);
+	case EXPR_TYPE_REC:    return eval_expr_rec(   e, expr);
 	case EXPR_TYPE_IF:     return eval_expr_if(    e, expr);
 	case EXPR_TYPE_IDX:    return eval_expr_idx(   e, expr);
 	case EXPR_TYPE_ID:     return eval_expr_id(    e, expr);
 	case EXPR_TYPE_DO:     return eval_expr_do(    e, expr);
 	case EXPR_TYPE_FUN:    return eval_expr_fun(   e, expr);
-	case EXPR_TYPE_VALUE:  return eval_expr_value( e, expr);
+	case EXPR_TYPE_VALUE:  return op_value(        e, expr);
 	case EXPR_TYPE_BIN_OP: return eval_expr_bin_op(e, expr);
-	case EXPR_TYPE_UN_OP:  return eval_expr_un_op( e, expr);
+	case EXPR_TYPE_UN_OP:  return op_un(e, expr, eval_expr(e, expr->as.un_op.expr));
 
 	default: UNREACHABLE("Unknown expression type");
 	}
@@ -1979,7 +2957,7 @@ static void eval_stmt_let(env_t *e, stmt_t *stmt) {
 		error(stmt->where,
 		      let->const_? "Constant '%s' redeclared" : "Variable '%s' redeclared", let->name);
 
-	var->val = let->val == NULL? value_nil() : eval_expr(e, let->val);
+	var->val = let->val == NULL? value_nil() : gc_share(&e->gc, eval_expr(e, let->val));
 
 	if (let->next != NULL)
 		eval_stmt_let(e, let->next);
@@ -2002,12 +2980,12 @@ static void eval_stmt_if(env_t *e, stmt_t *stmt) {
 	stmt_if_t *if_ = &stmt->as.if_;
 
 	value_t cond = eval_expr(e, if_->cond);
-	if (cond.type != VALUE_TYPE_BOOL)
-		wrong_type(stmt->where, cond.type, "if statement condition");
+	if (value_type(cond) != VALUE_TYPE_BOOL)
+		wrong_type(stmt->where, value_type(cond), "if statement condition");
 
 	env_scope_begin(e);
 
-	if (cond.as.bool_)
+	if (value_as_bool(cond))
 		eval(e, if_->body, e->path);
 	else if (if_->next != NULL)
 		eval_stmt_if(e, if_->next);
@@ -2023,10 +3001,10 @@ static void eval_stmt_while(env_t *e, stmt_t *stmt) {
 	++ e->breaks;
 	while (true) {
 		value_t cond = eval_expr(e, while_->cond);
-		if (cond.type != VALUE_TYPE_BOOL)
-			wrong_type(stmt->where, cond.type, "while statement condition");
+		if (value_type(cond) != VALUE_TYPE_BOOL)
+			wrong_type(stmt->where, value_type(cond), "while statement condition");
 
-		if (!cond.as.bool_)
+		if (!value_as_bool(cond))
 			break;
 
 		env_scope_begin(e);
@@ -2054,10 +3032,10 @@ static void eval_stmt_for(env_t *e, stmt_t *stmt) {
 	++ e->breaks;
 	while (true) {
 		value_t cond = eval_expr(e, for_->cond);
-		if (cond.type != VALUE_TYPE_BOOL)
-			wrong_type(stmt->where, cond.type, "for statement condition");
+		if (value_type(cond) != VALUE_TYPE_BOOL)
+			wrong_type(stmt->where, value_type(cond), "for statement condition");
 
-		if (cond.as.bool_) {
+		if (value_as_bool(cond)) {
 			env_scope_begin(e);
 			eval(e, for_->body, e->path);
 			env_scope_end(e);
@@ -2084,6 +3062,16 @@ static void eval_stmt_for(env_t *e, stmt_t *stmt) {
 	env_scope_end(e);
 }
 
+value_t op_foreach(env_t *e, value_t in, size_t i) {
+	UNUSED(e);
+	if (value_type(in) == VALUE_TYPE_STR) {
+		return value_short_str(value_str_buf(&in) + i, 1);
+	} else if (value_is_packed(in))
+		return value_packed_get(in, i);
+	else
+		return value_as_arr(in)->buf[i];
+}
+
 static void eval_stmt_foreach(env_t *e, stmt_t *stmt) {
 	stmt_foreach_t *foreach = &stmt->as.foreach;
 	env_scope_begin(e);
@@ -2101,22 +3089,38 @@ static void eval_stmt_foreach(env_t *e, stmt_t *stmt) {
 	var_t *itOver = env_new_var(e, "#foreach", true);
 	assert(itOver != NULL);
 
+	/* The collection is only read, so constants do not need a copy */
 	itOver->val = eval_expr(e, foreach->in);
-	if (itOver->val.type != VALUE_TYPE_STR && itOver->val.type != VALUE_TYPE_ARR)
-		error(stmt->where, "'foreach' can only iterate over strings and arrays");
+	value_share(itOver->val);
+
+	/* Maps are iterated by their slots, with the keys in place of the indexes */
+	bool map = value_type(itOver->val) == VALUE_TYPE_MAP;
+	if (map)
+		itOver->val = value_as_map(itOver->val)->slots;
+	else if (value_type(itOver->val) != VALUE_TYPE_STR &&
+	         value_type(itOver->val) != VALUE_TYPE_ARR && !value_is_packed(itOver->val))
+		error(stmt->where, "'foreach' can only iterate over strings, arrays and maps");
 
 	++ e->breaks;
-	size_t len = itOver->val.type == VALUE_TYPE_STR?
-	             strlen(itOver->val.as.str) : itOver->val.as.arr.size;
+	size_t len = value_type(itOver->val) == VALUE_TYPE_STR? value_str_len(itOver->val) :
+	             value_is_packed(itOver->val)?              value_as_packed(itOver->val)->size :
+	                                                        value_as_arr(itOver->val)->size;
+	if (map)
+		len /= 2;
+
 	for (size_t i = 0; i < len; ++ i) {
+		if (map) {
+			i = value_map_next(itOver->val, i);
+			if (i >= len)
+				break;
+		}
+
 		if (it != NULL)
-			it->val = value_num(i);
+			it->val = map? value_as_arr(itOver->val)->buf[i * 2] : value_num(i);
 
-		if (itOver->val.type == VALUE_TYPE_STR) {
-			char buf[] = {itOver->val.as.str[i], '\0'};
-			val->val = gc_add_elem(&e->gc, value_str(strcpy_to_heap(buf)));
-		} else
-			val->val = itOver->val.as.arr.buf[i];
+		/* The element is in a variable now, so '++' on it in the collection has to copy it */
+		val->val = map? value_as_arr(itOver->val)->buf[i * 2 + 1] : op_foreach(e, itOver->val, i);
+		value_share(val->val);
 
 		env_scope_begin(e);
 		eval(e, foreach->body, e->path);
@@ -2157,19 +3161,6 @@ static void eval_stmt_continue(env_t *e, stmt_t *stmt) {
 	e->continuing = true;
 }
 
-static void eval_stmt_defer(env_t *e, stmt_t *stmt) {
-	stmt_defer_t *defer = &stmt->as.defer;
-
-	if (e->scope->defer_count >= e->scope->defer_cap) {
-		e->scope->defer_cap *= 2;
-		e->scope->defer = (stmt_t**)realloc(e->scope->defer, e->scope->defer_cap * sizeof(stmt_t*));
-		if (e->scope->defer == NULL)
-			UNREACHABLE("realloc() fail");
-	}
-
-	e->scope->defer[e->scope->defer_count ++] = defer->stmt;
-}
-
 static void eval_stmt_fun(env_t *e, stmt_t *stmt) {
 	stmt_fun_t *fun = &stmt->as.fun;
 
@@ -2181,50 +3172,16 @@ static void eval_stmt_fun(env_t *e, stmt_t *stmt) {
 }
 
 static void eval_stmt_import(env_t *e, stmt_t *stmt) {
-	stmt_import_t *import = &stmt->as.import;
-
-	for (size_t i = 0; i < e->imported_count; ++ i) {
-		if (strcmp(e->imported[i], import->path) == 0)
-			return;
-	}
-
-	char *path = (char*)malloc(strlen(e->path) + strlen(import->path) + 1);
-	if (path == NULL)
-		UNREACHABLE("malloc() fail");
-
-	strcpy(path, e->path);
-	char *last = strrchr(path, '/');
-	if (last != NULL) {
-		*last = '\0';
-		strcat(path, "/");
-	} else
-		*path = '\0';
-
-	strcat(path, import->path);
-
-	char *str = readfile(path);
-	if (str == NULL)
-		error(stmt->where, "Cannot import '%s'", path);
-
-	stmt_t *imported = parse(str, path);
-	free(str);
-	const char *prev_path = e->path;
-	eval(e, imported, path);
-	e->path = prev_path;
-
-	e->imported[e->imported_count ++] = path;
-
-	if (e->to_free_size >= e->to_free_cap) {
-		e->to_free_cap *= 2;
-		e->to_free      = (stmt_t**)realloc(e->to_free, sizeof(stmt_t*) * e->to_free_cap);
-		if (e->to_free == NULL)
-			UNREACHABLE("realloc() fail");
+	for (; stmt != NULL; stmt = stmt->as.import.next) {
+		stmt_t *imported;
+		char   *path = env_import(e, stmt, &imported);
+		if (path == NULL)
+			continue;
+
+		const char *prev_path = e->path;
+		eval(e, imported, path);
+		e->path = prev_path;
 	}
-
-	e->to_free[e->to_free_size ++] = imported;
-
-	if (import->next != NULL)
-		eval_stmt_import(e, import->next);
 }
 
 void eval(env_t *e, stmt_t *program, const char *path) {
@@ -2242,7 +3199,7 @@ void eval(env_t *e, stmt_t *program, const char *path) {
 		case STMT_TYPE_RETURN:   eval_stmt_return(  e, stmt);          break;
 		case STMT_TYPE_BREAK:    eval_stmt_break(   e, stmt);          break;
 		case STMT_TYPE_CONTINUE: eval_stmt_continue(e, stmt);          break;
-		case STMT_TYPE_DEFER:    eval_stmt_defer(   e, stmt);          break;
+		case STMT_TYPE_DEFER:    env_defer(         e, stmt);          break;
 		case STMT_TYPE_FUN:      eval_stmt_fun(     e, stmt);          break;
 		case STMT_TYPE_IMPORT:   eval_stmt_import(  e, stmt);          break;
 
@@ -12,25 +12,35 @@
 #include "value.h"
 #include "node.h"
 #include "gc.h"
+#include "symtab.h"
+#include "compiler.h"
+#include "kernel.h"
+#include "sort.h"
 
 /* Welcome to eval.h
  * You should probably stay in the header files since you dont wanna see what the hell is going
  * on under the hood in gc.c and eval.c
  */
 
-typedef struct {
-	char   *name;
-	value_t val;
-	bool    const_;
+typedef struct var {
+	char    *name;
+	value_t  val;
+	bool     const_;
+	uint32_t sym;
+
+	struct var *shadowed; /* The variable of the same symbol this one hides while it lives */
 } var_t;
 
-#define VARS_CHUNK  32
-#define DEFER_CHUNK 8
-#define MAX_NEST    64
+#define VARS_CHUNK     32
+#define DEFER_CHUNK    8
+#define MAX_NEST       64
+#define STACK_CAPACITY 65536
 
 typedef struct {
 	var_t *vars;
 	size_t vars_count, vars_cap;
+	size_t statics; /* Slots reserved for resolved variables, undeclared ones have no name */
+	size_t dynamic; /* Variables declared by name */
 
 	stmt_t **defer;
 	size_t   defer_count, defer_cap;
@@ -50,11 +60,24 @@ typedef struct {
 	char  *imported[MAX_IMPORTS];
 	size_t imported_count;
 
+	/* The variable each symbol currently refers to, the innermost declaration wins */
+	symtab_t syms;
+	var_t  **binds;
+	size_t   binds_cap;
+	size_t   dynamic_vars; /* Declared by name outside of the global scope */
+
 	gc_t     gc;
-	stmt_t **to_free;
+	arena_t *to_free; /* Of the imported and inlined units */
 	size_t   to_free_size, to_free_cap;
 
-	size_t  builtin_nest;
+	chunk_t **chunks;
+	size_t    chunks_size, chunks_cap;
+
+	/* Value stack of the VM and of native call arguments, scanned by the GC */
+	value_t *stack;
+	size_t   stack_size;
+	bool     walk; /* Evaluate with the tree walker instead of the VM */
+
 	call_t *callstack;
 	size_t  callstack_size, callstack_cap;
 } env_t;
@@ -66,12 +89,43 @@ typedef struct {
 	builtin_func_t func;
 } builtin_t;
 
-#define BUILTINS_COUNT 39
+#define BUILTINS_COUNT 55
 extern builtin_t builtins[BUILTINS_COUNT];
 
 void env_init(  env_t *e, int argc, const char **argv);
 void env_deinit(env_t *e);
 
+void   env_scope_begin(  env_t *e);
+void   env_scope_reserve(env_t *e, size_t statics);
+void   env_scope_end(    env_t *e);
+void   env_gc(           env_t *e);
+void   env_sync_binds(   env_t *e);
+var_t *env_new_var(      env_t *e, const char *name, bool const_);
+var_t *env_new_static(   env_t *e, const char *name, uint32_t sym, uint32_t slot, bool const_);
+var_t *env_get_var(      env_t *e, char *name);
+void   env_defer(        env_t *e, stmt_t *stmt);
+void   env_call_begin(   env_t *e, expr_t *expr, expr_fun_t *fun, value_t *args);
+void   env_call_end(     env_t *e);
+char  *env_import(       env_t *e, stmt_t *stmt, stmt_t **imported);
+void   env_to_free(      env_t *e, arena_t *arena);
+
+/* Operations shared by the tree walker and the VM, on already evaluated operands */
+value_t op_value(     env_t *e, expr_t *expr);
+value_t op_fmt(       env_t *e, expr_t *expr, value_t *args);
+value_t op_map(       env_t *e, expr_t *expr, value_t *args);
+value_t op_rec(       env_t *e, expr_t *expr, value_t *args);
+value_t op_idx(       env_t *e, expr_t *expr, value_t to_idx, value_t pos);
+value_t op_slice(     env_t *e, expr_t *expr, value_t to_idx, value_t start, value_t end);
+value_t op_bin(       env_t *e, expr_t *expr, value_t left, value_t right);
+value_t op_un(        env_t *e, expr_t *expr, value_t val);
+value_t op_assign(    env_t *e, expr_t *expr, var_t *var, value_t val);
+value_t op_assign_idx(env_t *e, expr_t *expr, value_t val, value_t pos, value_t *target);
+value_t op_assign_idx_elem(env_t *e, expr_t *expr, value_t val, value_t pos, value_t of,
+                           value_t at);
+value_t op_update(    env_t *e, expr_t *expr, var_t *var, value_t val);
+value_t op_update_idx(env_t *e, expr_t *expr, value_t val, value_t pos, value_t target);
+value_t op_foreach(   env_t *e, value_t in, size_t i);
+
 void eval(env_t *e, stmt_t *program, const char *path);
 
 #endif
@@ -19,115 +19,955 @@
  *  --- ----------------------------------- ---
  */
 
-static void gc_mark_array(gc_t *gc, value_t val);
+static void gc_update_threshold(gc_t *gc) {
+	gc->threshold = gc->bytes + gc->bytes / 100 * gc->growth;
+	if (gc->threshold < gc->min_heap)
+		gc->threshold = gc->min_heap;
+}
+
+/* Cell sizes of the slabs, every one is a multiple of the header alignment */
+static const size_t gc_class_sizes[GC_CLASSES] = {
+	32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024,
+	1280, 1536, 1792, 2048,
+};
+
+static_assert(sizeof(value_header_t) < 32);
+static_assert(GC_SLAB_MAX == 2048); /* Has to be the biggest size class */
+
+void gc_init(gc_t *gc) {
+	memset(gc, 0, sizeof(*gc));
+
+	size_t class_ = 0;
+	for (size_t i = 0; i <= GC_SLAB_MAX / sizeof(double); ++ i) {
+		while (gc_class_sizes[class_] < i * sizeof(double))
+			++ class_;
+
+		gc->class_of[i] = class_;
+	}
+
+	gc_set_pacing(gc, GC_MIN_HEAP, GC_GROWTH);
+	gc_set_nursery(gc, GC_NURSERY);
+}
+
+static void gc_free(gc_t *gc, value_header_t *header);
+
+void gc_deinit(gc_t *gc) {
+	assert(gc->young_top == gc->nursery); /* Everything has to be collected first */
+
+	for (value_header_t *header = gc->root; header != NULL;) {
+		value_header_t *next = header->next;
+		gc_free(gc, header);
+		header = next;
+	}
+
+	for (size_t i = 0; i < GC_CLASSES; ++ i) {
+		for (slab_t *slab = gc->classes[i].slabs; slab != NULL;) {
+			slab_t *next = slab->next;
+			free(slab);
+			slab = next;
+		}
+	}
+
+	if (gc->nursery != NULL)
+		free(gc->nursery);
+
+	if (gc->gray != NULL)
+		free(gc->gray);
+
+	if (gc->remembered != NULL)
+		free(gc->remembered);
+
+	if (gc->moved != NULL)
+		free(gc->moved);
+
+	if (gc->interned != NULL)
+		free(gc->interned);
+}
+
+void gc_set_pacing(gc_t *gc, size_t min_heap, size_t growth) {
+	gc->min_heap = min_heap;
+	gc->growth   = growth;
+	gc_update_threshold(gc);
+}
+
+void gc_set_nursery(gc_t *gc, size_t size) {
+	assert(gc->young_top == gc->nursery);
+
+	if (gc->nursery != NULL)
+		free(gc->nursery);
+
+	gc->nursery = NULL;
+	if (size > 0) {
+		gc->nursery = (char*)malloc(size);
+		if (gc->nursery == NULL)
+			UNREACHABLE("malloc() fail");
+	}
+
+	gc->young_top = gc->nursery;
+	gc->young_end = gc->nursery + size;
+}
+
+void gc_set_max_pause(gc_t *gc, size_t us) {
+	gc->max_pause = us;
+}
 
-/* I know these recursive loops are extremely slow and i dont care currently.
-   If python devs dont care about speed, why should i. */
-static void gc_find_and_mark(gc_t *gc, value_t val) {
-	for (gc_elem_t *elem = gc->root; elem != NULL; elem = elem->next) {
-		if (elem->val.type != val.type)
+gc_work_t gc_pending(gc_t *gc) {
+	if (gc->max_pause == 0) {
+		if (gc->bytes > gc->threshold)
+			return GC_MAJOR;
+	} else if (gc->phase == GC_IDLE? gc->bytes > gc->threshold : gc->allocated >= GC_STEP_BYTES)
+		return GC_STEP;
+
+	if (gc->young_full || gc->young_top - gc->nursery > (gc->young_end - gc->nursery) / 2)
+		return GC_MINOR;
+
+	return GC_NONE;
+}
+
+static bool gc_is_young(gc_t *gc, void *ptr) {
+	return (char*)ptr >= gc->nursery && (char*)ptr < gc->young_end;
+}
+
+static void gc_push(value_t **stack, size_t *size, size_t *cap, value_t val) {
+	if (*size >= *cap) {
+		*cap   = *cap == 0? 64 : *cap * 2;
+		*stack = (value_t*)realloc(*stack, sizeof(value_t) * *cap);
+		if (*stack == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	(*stack)[(*size) ++] = val;
+}
+
+static void gc_remember(gc_t *gc, value_t arr) {
+	value_header_t *header = VALUE_HEADER(value_as_ptr(arr));
+	if (header->remembered)
+		return;
+
+	header->remembered = true;
+	gc_push(&gc->remembered, &gc->remembered_size, &gc->remembered_cap, arr);
+}
+
+static slab_t *gc_slab_of(void *ptr) {
+	return (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(GC_SLAB - 1));
+}
+
+/* Memory for an object of the old heap, the size includes the header */
+static value_header_t *gc_malloc(gc_t *gc, size_t size) {
+	void *ptr;
+	if (size > GC_SLAB_MAX) {
+		ptr = malloc(size);
+		if (ptr == NULL)
+			UNREACHABLE("malloc() fail");
+
+		return (value_header_t*)ptr;
+	}
+
+	gc_class_t *class_ = gc->classes + gc->class_of[size / sizeof(double)];
+	while (class_->avail != NULL) {
+		slab_t *slab = class_->avail;
+		if (slab->free != NULL) {
+			ptr        = slab->free;
+			slab->free = *(void**)ptr;
+		} else if (slab->top < slab->end) {
+			ptr        = slab->top;
+			slab->top += slab->cell;
+		} else {
+			class_->avail = slab->next_avail;
+			slab->avail   = false;
 			continue;
+		}
 
-		if (elem->val.type == VALUE_TYPE_STR) {
-			if (elem->val.as.str == val.as.str) {
-				elem->marked = true;
-				break;
-			}
-		} else if (elem->val.type == VALUE_TYPE_ARR) {
-			if (elem->val.as.arr.buf == val.as.arr.buf) {
-				elem->marked = true;
-				gc_mark_array(gc, val);
-				break;
+		++ slab->used;
+		return (value_header_t*)ptr;
+	}
+
+	slab_t *slab = (slab_t*)aligned_alloc(GC_SLAB, GC_SLAB);
+	if (slab == NULL)
+		UNREACHABLE("aligned_alloc() fail");
+
+	slab->cell = gc_class_sizes[class_ - gc->classes];
+	slab->top  = (char*)slab + ((sizeof(slab_t) + sizeof(double) - 1) & ~(sizeof(double) - 1));
+	slab->end  = (char*)slab + GC_SLAB - slab->cell + 1;
+	slab->free = NULL;
+	slab->used = 1;
+
+	ptr        = slab->top;
+	slab->top += slab->cell;
+
+	slab->next    = class_->slabs;
+	class_->slabs = slab;
+
+	slab->avail      = true;
+	slab->next_avail = class_->avail;
+	class_->avail    = slab;
+	return (value_header_t*)ptr;
+}
+
+static void gc_free(gc_t *gc, value_header_t *header) {
+	if (header->size > GC_SLAB_MAX) {
+		free(header);
+		return;
+	}
+
+	slab_t *slab = gc_slab_of(header);
+	*(void**)header = slab->free;
+	slab->free      = header;
+	-- slab->used;
+
+	if (!slab->avail) {
+		gc_class_t *class_ = gc->classes + gc->class_of[header->size / sizeof(double)];
+
+		slab->avail      = true;
+		slab->next_avail = class_->avail;
+		class_->avail    = slab;
+	}
+}
+
+/* Gives the slabs that were emptied by the sweep back to the system. One is kept for every size
+   class, so the next allocations do not have to get it back right away */
+static void gc_release_slabs(gc_t *gc) {
+	for (size_t i = 0; i < GC_CLASSES; ++ i) {
+		gc_class_t *class_ = gc->classes + i;
+		class_->avail = NULL;
+
+		bool     kept      = false;
+		slab_t **prev_next = &class_->slabs;
+		for (slab_t *slab = class_->slabs; slab != NULL;) {
+			slab_t *next = slab->next;
+			if (slab->used == 0 && kept) {
+				free(slab);
+				*prev_next = next;
+			} else {
+				kept        = kept || slab->used == 0;
+				slab->avail = slab->free != NULL || slab->top < slab->end;
+				if (slab->avail) {
+					slab->next_avail = class_->avail;
+					class_->avail    = slab;
+				}
+
+				prev_next = &slab->next;
 			}
+
+			slab = next;
 		}
 	}
 }
 
-static void gc_mark_array(gc_t *gc, value_t val) {
-	for (size_t i = 0; i < val.as.arr.size; ++ i) {
-		if (val.as.arr.buf[i].type == VALUE_TYPE_STR || val.as.arr.buf[i].type == VALUE_TYPE_ARR)
-			gc_find_and_mark(gc, val.as.arr.buf[i]);
+void *gc_alloc(gc_t *gc, size_t size) {
+	/* Keeps the next header aligned */
+	size_t total = (sizeof(value_header_t) + size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+
+	value_header_t *header;
+	if (total <= (size_t)(gc->young_end - gc->nursery) / GC_LARGE &&
+	    total <= (size_t)(gc->young_end - gc->young_top)) {
+		header = (value_header_t*)gc->young_top;
+		gc->young_top += total;
+
+		header->next = NULL; /* Points to the promoted copy once there is one */
+	} else {
+		/* Large objects, and everything once the nursery is full, go straight to the old heap */
+		if (total <= (size_t)(gc->young_end - gc->nursery) / GC_LARGE)
+			gc->young_full = true;
+
+		header = gc_malloc(gc, total);
+		header->next = gc->root;
+		gc->root     = header;
+		gc->bytes   += total;
 	}
+
+	/* Objects allocated during a collection are kept by it */
+	header->size       = total;
+	header->mark       = gc->epoch;
+	header->remembered = false;
+	header->viewed     = false;
+	header->constant   = false;
+	header->interned   = false;
+	header->owner      = VALUE_SHARED;
+
+	gc->allocated += total;
+	return header + 1;
+}
+
+static value_t gc_str_alloc(gc_t *gc, const char *str, size_t len) {
+	value_str_t *copy = (value_str_t*)gc_alloc(gc, sizeof(value_str_t) + len + 1);
+	copy->len    = len;
+	copy->cap    = len;
+	copy->hash   = 0;
+	copy->buf    = copy->text;
+	copy->parent = value_nil();
+	if (str != NULL)
+		memcpy(copy->buf, str, len);
+
+	copy->buf[len] = '\0';
+	return value_str(copy);
+}
+
+value_t gc_str(gc_t *gc, const char *str, size_t len) {
+	if (str != NULL && len <= VALUE_SHORT_STR_MAX)
+		return value_short_str(str, len);
+
+	return gc_str_alloc(gc, str, len);
+}
+
+value_t gc_cstr(gc_t *gc, const char *str) {
+	return gc_str(gc, str, strlen(str));
+}
+
+/* New old arrays and records are about to be filled with values that may be young or white,
+   they are traced once they are */
+static void gc_fill(gc_t *gc, value_t val) {
+	if (gc_is_young(gc, value_as_ptr(val)))
+		return;
+
+	gc_remember(gc, val);
+	if (gc->phase == GC_MARKING)
+		gc_push(&gc->gray, &gc->gray_size, &gc->gray_cap, val);
+}
+
+/* Arrays only get more room than their elements when they grow, most of them never do */
+value_t gc_arr_cap(gc_t *gc, size_t size, size_t cap) {
+	assert(cap >= size);
+
+	value_arr_t *arr = (value_arr_t*)gc_alloc(gc, sizeof(value_arr_t) + cap * sizeof(value_t));
+	arr->size   = size;
+	arr->cap    = cap;
+	arr->buf    = arr->elems;
+	arr->parent = value_nil();
+
+	value_t val = value_arr(arr);
+	gc_fill(gc, val);
+	return val;
+}
+
+value_t gc_arr(gc_t *gc, size_t size) {
+	return gc_arr_cap(gc, size, size);
 }
 
-static void gc_find_and_mark_in_array(gc_t *gc, gc_elem_t *elem, value_t val) {
-	UNUSED(gc);
-	for (size_t i = 0; i < val.as.arr.size; ++ i) {
-		if (val.as.arr.buf[i].type != elem->val.type)
+value_t gc_packed(gc_t *gc, value_type_t type, size_t size) {
+	size_t width = type == VALUE_TYPE_U8S? 1 : sizeof(double);
+
+	value_packed_t *packed = (value_packed_t*)gc_alloc(gc, sizeof(value_packed_t) + size * width);
+	packed->size   = size;
+	packed->buf    = packed->data;
+	packed->parent = value_nil();
+	memset(packed->data, 0, size * width);
+	return value_packed(packed, type);
+}
+
+/* Records are allocated with the exact size of their fields, they never grow */
+value_t gc_rec(gc_t *gc, const value_shape_t *shape) {
+	value_rec_t *rec = (value_rec_t*)gc_alloc(gc, sizeof(value_rec_t) +
+	                                          shape->size * sizeof(value_t));
+	rec->shape = shape;
+	memset(rec->fields, 0, shape->size * sizeof(value_t));
+
+	value_t val = value_rec(rec);
+	gc_fill(gc, val);
+	return val;
+}
+
+/* Slots of a map with the capacity for cap keys, all of them free */
+static value_t gc_map_slots(gc_t *gc, size_t cap) {
+	value_t slots = gc_arr(gc, cap * 2);
+	memset(value_as_arr(slots)->buf, 0, cap * 2 * sizeof(value_t));
+	return slots;
+}
+
+value_t gc_map(gc_t *gc, size_t size) {
+	size_t cap = GC_MAP_MIN;
+	while (size * 4 > cap * 3)
+		cap *= 2;
+
+	value_map_t *map = (value_map_t*)gc_alloc(gc, sizeof(value_map_t));
+	map->size  = 0;
+	map->slots = gc_map_slots(gc, cap);
+
+	value_t val = value_map(map);
+	gc_barrier(gc, val, map->slots);
+	return val;
+}
+
+static void gc_map_grow(gc_t *gc, value_t map) {
+	value_map_t *ptr  = value_as_map(map);
+	value_arr_t *prev = value_as_arr(ptr->slots);
+	value_t      slots = gc_map_slots(gc, prev->size);
+
+	for (size_t i = 0; i < prev->size; i += 2) {
+		if (value_type(prev->buf[i]) == VALUE_TYPE_NIL)
 			continue;
 
-		if (elem->val.type == VALUE_TYPE_STR) {
-			if (elem->val.as.str == val.as.arr.buf[i].as.str) {
-				elem->marked = true;
-				break;
-			}
-		} else if (elem->val.type == VALUE_TYPE_ARR) {
-			if (elem->val.as.arr.buf == val.as.arr.buf[i].as.arr.buf) {
-				elem->marked = true;
-				break;
-			}
+		size_t at = value_map_probe(slots, prev->buf[i]) * 2;
+		value_as_arr(slots)->buf[at]     = prev->buf[i];
+		value_as_arr(slots)->buf[at + 1] = prev->buf[i + 1];
+	}
+
+	ptr->slots = slots;
+	gc_barrier(gc, map, slots);
+}
+
+void gc_map_set(gc_t *gc, value_t map, value_t key, value_t val) {
+	value_map_t *ptr = value_as_map(map);
+	size_t       i   = value_map_probe(ptr->slots, key);
+
+	if (value_type(value_as_arr(ptr->slots)->buf[i * 2]) == VALUE_TYPE_NIL) {
+		if ((ptr->size + 1) * 4 > value_as_arr(ptr->slots)->size / 2 * 3) {
+			gc_map_grow(gc, map);
+			i = value_map_probe(ptr->slots, key);
+		}
+
+		if (value_is_obj(key) && !VALUE_HEADER(value_as_str(key))->constant) {
+			uint64_t hash = value_str_hash(key);
+			key = gc_str_alloc(gc, value_as_str(key)->buf, value_as_str(key)->len);
+			value_as_str(key)->hash = hash;
+			VALUE_HEADER(value_as_str(key))->constant = true;
+		}
+
+		value_as_arr(ptr->slots)->buf[i * 2] = key;
+		gc_barrier(gc, ptr->slots, key);
+		++ ptr->size;
+	}
+
+	val = gc_share(gc, val);
+	value_as_arr(ptr->slots)->buf[i * 2 + 1] = val;
+	gc_barrier(gc, ptr->slots, val);
+}
+
+/* What owns the text or elements a string or array points to */
+static value_t gc_holder(value_t val) {
+	value_t parent = value_type(val) == VALUE_TYPE_STR? value_as_str(val)->parent :
+	                 value_is_packed(val)?              value_as_packed(val)->parent :
+	                                                    value_as_arr(val)->parent;
+	return value_type(parent) == VALUE_TYPE_NIL? val : parent;
+}
+
+value_t gc_slice(gc_t *gc, value_t of, size_t start, size_t size) {
+	bool   str    = value_type(of) == VALUE_TYPE_STR, packed = value_is_packed(of);
+	size_t width  = str? 1 : packed? value_packed_width(of) : sizeof(value_t);
+	size_t bytes  = size * width;
+	if (bytes < GC_VIEW_MIN) {
+		if (str)
+			return gc_str(gc, value_str_buf(&of) + start, size);
+		else if (packed) {
+			value_t copy = gc_packed(gc, value_type(of), size);
+			memcpy(value_as_packed(copy)->buf, value_as_packed(of)->buf + start * width, bytes);
+			return copy;
 		}
+
+		value_t arr = gc_arr(gc, size);
+		memcpy(value_as_arr(arr)->buf, value_as_arr(of)->buf + start, bytes);
+		return arr;
+	}
+
+	value_t parent = gc_holder(of), view;
+	if (str) {
+		value_str_t *ptr = (value_str_t*)gc_alloc(gc, sizeof(value_str_t));
+		ptr->len    = size;
+		ptr->cap    = size;
+		ptr->hash   = 0;
+		ptr->buf    = value_as_str(of)->buf + start;
+		ptr->parent = parent;
+		view = value_str(ptr);
+	} else if (packed) {
+		value_packed_t *ptr = (value_packed_t*)gc_alloc(gc, sizeof(value_packed_t));
+		ptr->size   = size;
+		ptr->buf    = value_as_packed(of)->buf + start * width;
+		ptr->parent = parent;
+		view = value_packed(ptr, value_type(of));
+	} else {
+		value_arr_t *ptr = (value_arr_t*)gc_alloc(gc, sizeof(value_arr_t));
+		ptr->size   = size;
+		ptr->cap    = size;
+		ptr->buf    = value_as_arr(of)->buf + start;
+		ptr->parent = parent;
+		view = value_arr(ptr);
+	}
+
+	VALUE_HEADER(value_as_ptr(parent))->viewed = true;
+	gc_barrier(gc, view, parent);
+	return view;
+}
+
+/* Constants only hold values without a header (see parser.c), so their copies share nothing */
+static value_t gc_copy_const(gc_t *gc, value_t val) {
+	if (value_type(val) == VALUE_TYPE_STR)
+		return gc_str_alloc(gc, value_as_str(val)->buf, value_as_str(val)->len);
+
+	value_t copy = gc_arr(gc, value_as_arr(val)->size);
+	memcpy(value_as_arr(copy)->buf, value_as_arr(val)->buf,
+	       value_as_arr(val)->size * sizeof(value_t));
+	return copy;
+}
+
+/* Slot of the interned string with the same text, or the free one where it would go */
+static size_t gc_intern_slot(gc_t *gc, value_t str, uint64_t hash) {
+	size_t mask = gc->interned_cap - 1, i = hash & mask;
+	for (; value_type(gc->interned[i]) != VALUE_TYPE_NIL; i = (i + 1) & mask) {
+		value_str_t *in = value_as_str(gc->interned[i]);
+		if (in->hash == hash && in->len == value_str_len(str) &&
+		    memcmp(in->buf, value_str_buf(&str), in->len) == 0)
+			break;
 	}
+
+	return i;
 }
 
-static void gc_mark(gc_t *gc, gc_elem_t *elem, value_t *refs, size_t size) {
-	elem->marked = false;
-	for (size_t i = 0; i < size; ++ i) {
-		if (elem->val.type != refs[i].type)
+/* Moves the table to cap slots, without the strings that were not reached if drop_white is set */
+static void gc_intern_rebuild(gc_t *gc, size_t cap, bool drop_white) {
+	value_t *prev     = gc->interned;
+	size_t   prev_cap = gc->interned_cap;
+
+	gc->interned = (value_t*)calloc(cap, sizeof(value_t));
+	if (gc->interned == NULL)
+		UNREACHABLE("calloc() fail");
+
+	gc->interned_cap  = cap;
+	gc->interned_size = 0;
+	for (size_t i = 0; i < prev_cap; ++ i) {
+		value_t str = prev[i];
+		if (value_type(str) == VALUE_TYPE_NIL)
+			continue;
+		else if (drop_white && VALUE_HEADER(value_as_str(str))->mark != gc->epoch)
 			continue;
 
-		if (elem->val.type == VALUE_TYPE_STR) {
-			if (elem->val.as.str == refs[i].as.str) {
-				elem->marked = true;
-				break;
-			}
-		} else if (elem->val.type == VALUE_TYPE_ARR) {
-			if (elem->val.as.arr.buf == refs[i].as.arr.buf) {
-				elem->marked = true;
-				break;
-			}
+		gc->interned[gc_intern_slot(gc, str, value_as_str(str)->hash)] = str;
+		++ gc->interned_size;
+	}
+
+	if (prev != NULL)
+		free(prev);
+}
+
+value_t gc_intern(gc_t *gc, value_t str) {
+	if (value_str_len(str) <= VALUE_SHORT_STR_MAX)
+		return value_short_str(value_str_buf(&str), value_str_len(str));
+	else if (VALUE_HEADER(value_as_str(str))->interned)
+		return str;
+
+	if ((gc->interned_size + 1) * 2 > gc->interned_cap)
+		gc_intern_rebuild(gc, gc->interned_cap == 0? 64 : gc->interned_cap * 2, false);
+
+	uint64_t hash = value_str_hash(str);
+	size_t   i    = gc_intern_slot(gc, str, hash);
+	if (value_type(gc->interned[i]) != VALUE_TYPE_NIL)
+		return gc->interned[i];
+
+	value_header_t *header = VALUE_HEADER(value_as_str(str));
+	if (header->constant || value_type(value_as_str(str)->parent) != VALUE_TYPE_NIL) {
+		str = gc_str_alloc(gc, value_as_str(str)->buf, value_as_str(str)->len);
+		value_as_str(str)->hash = hash;
+		header = VALUE_HEADER(value_as_str(str));
+	}
+
+	/* Nothing appends to it in place anymore */
+	header->owner    = VALUE_SHARED;
+	header->interned = true;
+
+	gc->interned[i] = str;
+	++ gc->interned_size;
+	return str;
+}
+
+/* Takes the string out of the table, moving back the ones after it that probed past its slot */
+static void gc_unintern(gc_t *gc, value_t str) {
+	size_t mask = gc->interned_cap - 1, i = gc_intern_slot(gc, str, value_as_str(str)->hash);
+	gc->interned[i] = value_nil();
+	-- gc->interned_size;
+
+	for (size_t j = (i + 1) & mask; value_type(gc->interned[j]) != VALUE_TYPE_NIL;
+	     j = (j + 1) & mask) {
+		size_t home = value_as_str(gc->interned[j])->hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			gc->interned[i] = gc->interned[j];
+			gc->interned[j] = value_nil();
+			i = j;
 		}
 	}
 
-	if (!elem->marked) {
-	for (size_t i = 0; i < size; ++ i) {
-			if (refs[i].type == VALUE_TYPE_ARR)
-				gc_find_and_mark_in_array(gc, elem, refs[i]);
+	VALUE_HEADER(value_as_str(str))->interned = false;
+}
+
+value_t gc_unview(gc_t *gc, value_t val) {
+	if (VALUE_HEADER(value_as_ptr(val))->interned)
+		gc_unintern(gc, val);
+
+	if (VALUE_HEADER(value_as_ptr(val))->constant)
+		return gc_copy_const(gc, val);
+	else if (!VALUE_HEADER(value_as_ptr(gc_holder(val)))->viewed)
+		return val;
+
+	value_t copy;
+	if (value_type(val) == VALUE_TYPE_STR) {
+		value_str_t *str = value_as_str(val);
+		copy = gc_str_alloc(gc, str->buf, str->len);
+
+		str->buf    = value_as_str(copy)->buf;
+		str->cap    = value_as_str(copy)->cap;
+		str->parent = copy;
+	} else if (value_is_packed(val)) {
+		value_packed_t *packed = value_as_packed(val);
+		copy = gc_packed(gc, value_type(val), packed->size);
+		memcpy(value_as_packed(copy)->buf, packed->buf, packed->size * value_packed_width(val));
+
+		packed->buf    = value_as_packed(copy)->buf;
+		packed->parent = copy;
+	} else {
+		value_arr_t *arr = value_as_arr(val);
+		copy = gc_arr(gc, arr->size);
+		memcpy(value_as_arr(copy)->buf, arr->buf, arr->size * sizeof(value_t));
+
+		arr->buf    = value_as_arr(copy)->buf;
+		arr->cap    = value_as_arr(copy)->cap;
+		arr->parent = copy;
+	}
+
+	gc_barrier(gc, val, copy);
+	return val;
+}
+
+value_t gc_share(gc_t *gc, value_t val) {
+	if (value_is_obj(val) && VALUE_HEADER(value_as_ptr(val))->constant)
+		val = gc_copy_const(gc, val);
+
+	value_share(val);
+	return val;
+}
+
+static void gc_mark(gc_t *gc, value_t val);
+
+void gc_barrier(gc_t *gc, value_t arr, value_t val) {
+	if (gc_is_young(gc, value_as_ptr(arr)))
+		return;
+
+	if (value_is_obj(val) && gc_is_young(gc, value_as_ptr(val)))
+		gc_remember(gc, arr);
+	else if (gc->phase == GC_MARKING)
+		gc_mark(gc, val);
+}
+
+static void gc_promote(gc_t *gc, value_t *val);
+
+/* The values held by an array or a record */
+static value_t *gc_elems(value_t val, size_t *size) {
+	if (value_type(val) == VALUE_TYPE_REC) {
+		*size = value_as_rec(val)->shape->size;
+		return value_as_rec(val)->fields;
+	}
+
+	*size = value_as_arr(val)->size;
+	return value_as_arr(val)->buf;
+}
+
+/* Strings and arrays point to their own text or elements, or into the ones of their parent,
+   which move when they are promoted. Maps point to their slots, records hold their fields */
+static void gc_promote_buf(gc_t *gc, value_t val) {
+	value_t *parent;
+	if (value_type(val) == VALUE_TYPE_REC)
+		return;
+	else if (value_type(val) == VALUE_TYPE_MAP) {
+		parent = &value_as_map(val)->slots;
+		gc_promote(gc, parent);
+	} else if (value_type(val) == VALUE_TYPE_STR) {
+		value_str_t *str = value_as_str(val);
+		if (value_type(str->parent) == VALUE_TYPE_NIL) {
+			str->buf = str->text;
+			return;
 		}
+
+		size_t offset = str->buf - value_as_str(str->parent)->text;
+		gc_promote(gc, &str->parent);
+		str->buf = value_as_str(str->parent)->text + offset;
+		parent   = &str->parent;
+	} else if (value_is_packed(val)) {
+		value_packed_t *packed = value_as_packed(val);
+		if (value_type(packed->parent) == VALUE_TYPE_NIL) {
+			packed->buf = packed->data;
+			return;
+		}
+
+		size_t offset = packed->buf - value_as_packed(packed->parent)->data;
+		gc_promote(gc, &packed->parent);
+		packed->buf = value_as_packed(packed->parent)->data + offset;
+		parent      = &packed->parent;
+	} else {
+		value_arr_t *arr = value_as_arr(val);
+		if (value_type(arr->parent) == VALUE_TYPE_NIL) {
+			arr->buf = arr->elems;
+			return;
+		}
+
+		size_t offset = arr->buf - value_as_arr(arr->parent)->elems;
+		gc_promote(gc, &arr->parent);
+		arr->buf = value_as_arr(arr->parent)->elems + offset;
+		parent   = &arr->parent;
 	}
 
-	if (elem->marked && elem->val.type == VALUE_TYPE_ARR)
-		gc_mark_array(gc, elem->val);
+	/* Promoted views can point to a white old parent, and maps to white old slots */
+	if (gc->phase == GC_MARKING)
+		gc_mark(gc, *parent);
 }
 
-void gc_mas(gc_t *gc, value_t *refs, size_t size) {
-	for (gc_elem_t *elem = gc->root; elem != NULL; elem = elem->next)
-		gc_mark(gc, elem, refs, size);
+/* Moves a young object to the old heap, or points the value to its copy if it was moved
+   already. Moved arrays and records are traced later from the gray stack */
+static void gc_promote(gc_t *gc, value_t *val) {
+	if (!value_is_obj(*val))
+		return;
 
-	gc_elem_t **prev_next = &gc->root, *elem = gc->root;
-	while (elem != NULL) {
-		if (!elem->marked) {
-			value_free(&elem->val);
+	void *ptr = value_as_ptr(*val);
+	if (!gc_is_young(gc, ptr))
+		return;
 
-			gc_elem_t *next = elem->next;
-			free(elem);
-			elem = next;
-			*prev_next = elem;
+	/* The tag stays, only the pointer changes */
+	value_header_t *header = VALUE_HEADER(ptr);
+	if (header->next == NULL) {
+		value_header_t *copy = gc_malloc(gc, header->size);
+		memcpy(copy, header, header->size);
+		copy->next = gc->root;
+		copy->mark = gc->epoch;
+		gc->root   = copy;
+		gc->bytes += copy->size;
+
+		header->next = copy;
+		*val = value_ptr(copy + 1, val->bits & VALUE_TAG_MASK);
+		gc_promote_buf(gc, *val);
+
+		if (value_type(*val) == VALUE_TYPE_ARR || value_type(*val) == VALUE_TYPE_REC)
+			gc_push(&gc->moved, &gc->moved_size, &gc->moved_cap, *val);
+	} else
+		*val = value_ptr(header->next + 1, val->bits & VALUE_TAG_MASK);
+}
+
+static void gc_collect_young(gc_t *gc, value_t **roots, size_t size) {
+	for (size_t i = 0; i < size; ++ i)
+		gc_promote(gc, roots[i]);
+
+	/* Promoted strings keep their hash, so they stay in their slot */
+	for (size_t i = 0; i < gc->interned_cap; ++ i)
+		gc_promote(gc, gc->interned + i);
+
+	/* Old views are remembered when their parent is young */
+	for (size_t i = 0; i < gc->remembered_size; ++ i) {
+		value_t val = gc->remembered[i];
+		VALUE_HEADER(value_as_ptr(val))->remembered = false;
+		gc_promote_buf(gc, val);
+
+		if (value_type(val) != VALUE_TYPE_ARR && value_type(val) != VALUE_TYPE_REC)
+			continue;
+
+		size_t   size;
+		value_t *elems = gc_elems(val, &size);
+		for (size_t j = 0; j < size; ++ j)
+			gc_promote(gc, elems + j);
+	}
+	gc->remembered_size = 0;
+
+	while (gc->moved_size > 0) {
+		value_t  arr = gc->moved[-- gc->moved_size];
+		size_t   size;
+		value_t *elems = gc_elems(arr, &size);
+		for (size_t i = 0; i < size; ++ i)
+			gc_promote(gc, elems + i);
+
+		/* Promoted arrays can point to white old objects */
+		if (gc->phase == GC_MARKING)
+			gc_push(&gc->gray, &gc->gray_size, &gc->gray_cap, arr);
+	}
+
+	gc->young_top  = gc->nursery;
+	gc->young_full = false;
+}
+
+/* Arrays are marked when they are reached and their elements are traced later from the gray
+   stack, so deeply nested arrays do not recurse. Young objects are not marked, the minor
+   collections take care of them */
+static void gc_mark(gc_t *gc, value_t val) {
+	if (!value_is_obj(val))
+		return;
+
+	if (value_type(val) == VALUE_TYPE_STR) {
+		if (gc_is_young(gc, value_as_str(val)))
+			return;
+
+		VALUE_HEADER(value_as_str(val))->mark = gc->epoch;
+		gc_mark(gc, value_as_str(val)->parent);
+	} else if (value_is_packed(val)) {
+		if (gc_is_young(gc, value_as_packed(val)))
+			return;
+
+		VALUE_HEADER(value_as_packed(val))->mark = gc->epoch;
+		gc_mark(gc, value_as_packed(val)->parent);
+	} else if (value_type(val) == VALUE_TYPE_ARR || value_type(val) == VALUE_TYPE_REC) {
+		if (gc_is_young(gc, value_as_ptr(val)))
+			return;
+
+		value_header_t *header = VALUE_HEADER(value_as_ptr(val));
+		/* Arrays and records can contain themselves */
+		if (header->mark == gc->epoch)
+			return;
+
+		header->mark = gc->epoch;
+		gc_push(&gc->gray, &gc->gray_size, &gc->gray_cap, val);
+	} else if (value_type(val) == VALUE_TYPE_MAP) {
+		if (gc_is_young(gc, value_as_map(val)))
+			return;
+
+		VALUE_HEADER(value_as_map(val))->mark = gc->epoch;
+		gc_mark(gc, value_as_map(val)->slots);
+	}
+}
+
+static uint64_t gc_now_us(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Work between the checks of the time */
+#define GC_STEP_CHECK 1024
+
+/* Traces until nothing is gray, or until the deadline when it is not 0 */
+static bool gc_trace(gc_t *gc, uint64_t deadline) {
+	size_t work = 0;
+	while (gc->gray_size > 0) {
+		value_t arr = gc->gray[-- gc->gray_size];
+
+		/* The elements of views are traced with their parent */
+		size_t   size;
+		value_t *elems = gc_elems(arr, &size);
+		if (value_type(arr) == VALUE_TYPE_ARR &&
+		    value_type(value_as_arr(arr)->parent) != VALUE_TYPE_NIL)
+			gc_mark(gc, value_as_arr(arr)->parent);
+		else {
+			for (size_t i = 0; i < size; ++ i)
+				gc_mark(gc, elems[i]);
+		}
+
+		work += size + 1;
+		if (deadline != 0 && work >= GC_STEP_CHECK) {
+			work = 0;
+			if (gc_now_us() >= deadline)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* Frees the white objects after the link, until the end of the heap or the deadline */
+static bool gc_sweep(gc_t *gc, uint64_t deadline) {
+	size_t work = 0;
+	value_header_t *header = *gc->sweep;
+	while (header != NULL) {
+		if (header->mark != gc->epoch) {
+			gc->bytes -= header->size;
+
+			value_header_t *next = header->next;
+			gc_free(gc, header);
+			header = next;
+			*gc->sweep = header;
 		} else {
-			prev_next = &elem->next;
-			elem = elem->next;
+			gc->sweep = &header->next;
+			header    = header->next;
+		}
+
+		if (deadline != 0 && ++ work >= GC_STEP_CHECK) {
+			work = 0;
+			if (gc_now_us() >= deadline)
+				return false;
 		}
 	}
+
+	return true;
 }
 
-value_t gc_add_elem(gc_t *gc, value_t val) {
-	gc_elem_t *elem = (gc_elem_t*)malloc(sizeof(gc_elem_t));
-	if (elem == NULL)
-		UNREACHABLE("malloc() fail");
+/* Every collection has its own mark, so nothing has to be unmarked */
+static void gc_start(gc_t *gc, value_t **roots, size_t size) {
+	++ gc->epoch;
+	gc->gray_size = 0;
+	gc->phase     = GC_MARKING;
+	gc->limit     = gc->threshold * 2 + GC_STEP_BYTES;
 
-	elem->marked = false;
-	elem->val    = val;
-	elem->next   = gc->root;
-	gc->root     = elem;
-	return val;
+	for (size_t i = 0; i < size; ++ i)
+		gc_mark(gc, *roots[i]);
+}
+
+/* The roots were not guarded by the barrier, so they are marked again and traced to the end
+   before sweeping */
+static void gc_remark(gc_t *gc, value_t **roots, size_t size) {
+	for (size_t i = 0; i < size; ++ i)
+		gc_mark(gc, *roots[i]);
+
+	gc_trace(gc, 0);
+	if (gc->interned_cap > 0)
+		gc_intern_rebuild(gc, gc->interned_cap, true);
+
+	gc->phase = GC_SWEEPING;
+	gc->sweep = &gc->root;
+}
+
+static void gc_finish(gc_t *gc) {
+	gc_release_slabs(gc);
+	gc->phase = GC_IDLE;
+	gc_update_threshold(gc);
+}
+
+static void gc_step(gc_t *gc, value_t **roots, size_t size) {
+	uint64_t start = gc_now_us();
+
+	if (gc->phase == GC_IDLE) {
+		gc_start(gc, roots, size);
+		return;
+	}
+
+	/* Fall back to a full pause, the program allocates faster than the steps collect */
+	if (gc->bytes > gc->limit) {
+		if (gc->phase == GC_MARKING)
+			gc_remark(gc, roots, size);
+
+		gc_sweep(gc, 0);
+		gc_finish(gc);
+
+		++ gc->full_pauses;
+		color_fg(stderr, COLOR_BYELLOW);
+		color_bold(stderr);
+		fprintf(stderr, "Warning:");
+		color_reset(stderr);
+		fprintf(stderr, " Incremental garbage collection fell behind, finished it in a full "
+		        "pause of %llu us\n", (unsigned long long)(gc_now_us() - start));
+		return;
+	}
+
+	uint64_t deadline = start + gc->max_pause;
+	if (gc->phase == GC_MARKING) {
+		if (!gc_trace(gc, deadline))
+			return;
+
+		gc_remark(gc, roots, size);
+	}
+
+	if (gc_sweep(gc, deadline))
+		gc_finish(gc);
+}
+
+void gc_collect(gc_t *gc, value_t **roots, size_t size, gc_work_t work) {
+	/* Major collections only have to deal with the old heap */
+	gc_collect_young(gc, roots, size);
+
+	switch (work) {
+	case GC_MINOR: break;
+	case GC_STEP:
+		gc_step(gc, roots, size);
+		gc->allocated = 0;
+		break;
+
+	case GC_MAJOR:
+		gc_start(gc, roots, size);
+		gc_remark(gc, roots, size);
+		gc_sweep(gc, 0);
+		gc_finish(gc);
+		gc->allocated = 0;
+		break;
+
+	default: UNREACHABLE("Unknown garbage collection work");
+	}
 }
@@ -5,28 +5,175 @@
 #include <string.h> /* strcmp, strlen, memset */
 #include <assert.h> /* static_assert */
 #include <math.h>   /* pow */
-#include <time.h>   /* time */
+#include <time.h>   /* time, timespec_get */
+#include <stdint.h> /* uint32_t, uint64_t */
 
 /* Welcome to gc.h
  * You should probably stay in the header files since you dont wanna see what the hell is going
  * on under the hood in gc.c and eval.c
  */
 
+#include <chol/colorer.h>
+
 #include "value.h"
 
-typedef struct gc_elem {
-	value_t val;
-	bool    marked;
+#define GC_MIN_HEAP   (1024 * 1024) /* Bytes that can be allocated before the first collection */
+#define GC_GROWTH     100           /* How many percent the heap can grow over the live bytes */
+#define GC_NURSERY    (256 * 1024)  /* Bytes of the young generation */
+#define GC_LARGE      16            /* Objects bigger than this fraction of the nursery are old */
+#define GC_VIEW_MIN   64            /* Bytes of the shortest slice that shares its parent */
+#define GC_STEP_BYTES (64 * 1024)   /* Allocated between the steps of incremental collections */
+#define GC_SLAB       (64 * 1024)   /* Bytes of a slab, slabs are aligned to their size */
+#define GC_SLAB_MAX   2048          /* Old objects bigger than this are allocated on their own */
+#define GC_MAP_MIN    16            /* Slots of a new map, maps get twice as many when 3/4 full */
+#define GC_CLASSES    23
+
+/* New objects are bump allocated in the nursery. Minor collections move the ones that are still
+ * reachable to the old heap and reset the nursery, so only the survivors cost anything. Old
+ * arrays that get young values stored into them are remembered (gc_barrier) and their elements
+ * become roots of the next minor collection.
+ *
+ * The old heap is a list of objects, collected by a full mark and sweep. Only the ones larger than
+ * GC_SLAB_MAX are malloc'd, the rest come from slabs (see below). Collections are paced by the
+ * allocated bytes. Once they cross the threshold, the next safe point collects, and the
+ * threshold is set again from the bytes that survived.
+ *
+ * With a maximum pause set, the old heap is collected incrementally instead. The roots are
+ * marked gray when the collection starts, and every step traces and later sweeps for at most the
+ * maximum pause. Values stored into arrays are marked too (gc_barrier), and objects that get
+ * allocated or promoted while it runs are kept, so no black (traced) array ever points to a white
+ * one. The roots are not guarded, so they are marked again once nothing is gray. If the program
+ * allocates faster than the steps keep up with, the rest is done in a single, reported pause.
+ *
+ * Old objects up to GC_SLAB_MAX bytes are allocated from slabs of their size class. Every slab
+ * keeps a list of its free cells, and the ones that end up empty after sweeping are released.
+ *
+ * Views (see gc_slice) point into the text or elements of their parent and keep it alive. They are
+ * fixed up when the parent moves, and old views of a young parent are remembered like arrays.
+ * Maps keep their slots the same way, in an array that is traced and promoted with them.
+ * Records hold their fields themselves and are traced, remembered and promoted like arrays.
+ *
+ * Interned strings are young until the next minor collection like everything else, so the table
+ * of them is a root of minor collections. Major ones drop the strings that were not reached.
+ *
+ * String and array literals are constants allocated with a header in the arena of their unit
+ * (see parser.c). They look like old objects that are never swept, and they live as long as it.
+ *
+ * Collections only happen at safe points (the end of a scope and the 'gc' builtin), where every
+ * value the program can reach is in a root. Roots are passed by pointer, since young objects move
+ */
+enum {
+	GC_IDLE = 0,
+	GC_MARKING,
+	GC_SWEEPING,
+};
+
+/* Work to do at a safe point */
+typedef enum {
+	GC_NONE = 0,
+	GC_MINOR, /* Move the survivors out of the nursery */
+	GC_STEP,  /* A minor collection and a step of the incremental collection */
+	GC_MAJOR, /* A minor collection and a whole collection of the old heap */
+} gc_work_t;
+
+typedef struct slab slab_t;
+
+struct slab {
+	slab_t *next, *next_avail; /* Of the size class, the second one only links slabs with space */
+	bool    avail;
 
-	struct gc_elem *next;
-} gc_elem_t;
+	char  *top, *end; /* Cells that were never used */
+	void  *free;      /* Cells that were freed, linked through their first bytes */
+	size_t used;
+	size_t cell;
+};
 
 typedef struct {
-	gc_elem_t *root;
+	slab_t *slabs, *avail;
+} gc_class_t;
+
+typedef struct {
+	char *nursery, *young_top, *young_end;
+	bool  young_full; /* Something did not fit in the nursery */
+
+	value_t *remembered; /* Old arrays and records with young values stored in them */
+	size_t   remembered_size, remembered_cap;
+
+	value_header_t *root;  /* Objects of the old heap */
+	gc_class_t      classes[GC_CLASSES];
+	uint8_t         class_of[GC_SLAB_MAX / sizeof(double) + 1]; /* Size class by size in doubles */
+	uint32_t        epoch; /* Of the last collection, objects with it in their header are marked */
+
+	size_t bytes, threshold; /* Of the old heap */
+	size_t min_heap, growth;
+
+	value_t *gray; /* Reached arrays and records whose elements were not traced yet */
+	size_t   gray_size, gray_cap;
+
+	value_t *moved; /* Promoted arrays and records whose elements were not promoted yet */
+	size_t   moved_size, moved_cap;
+
+	value_t *interned; /* Open addressing by the hash of the text, nil slots are free */
+	size_t   interned_size, interned_cap;
+
+	size_t           max_pause; /* Microseconds of a step, 0 collects everything at once */
+	int              phase;
+	size_t           allocated; /* Bytes since the last step */
+	size_t           limit;     /* Bytes at which the incremental collection gives up */
+	value_header_t **sweep;     /* Link to the next object to sweep */
+	size_t           full_pauses;
 } gc_t;
 
-/* Mark and sweep */
-void gc_mas(gc_t *gc, value_t *refs, size_t size);
-value_t gc_add_elem(gc_t *gc, value_t val);
+void gc_init(   gc_t *gc);
+void gc_deinit( gc_t *gc);
+void gc_set_pacing( gc_t *gc, size_t min_heap, size_t growth);
+void gc_set_nursery(gc_t *gc, size_t size);
+void gc_set_max_pause(gc_t *gc, size_t us);
+
+/* What the next safe point has to do */
+gc_work_t gc_pending(gc_t *gc);
+
+/* Memory of strings and array buffers, owned by the collector. New strings are terminated and
+   get their text from str, unless it is NULL. Text that fits makes a short string instead, the
+   ones allocated without it always have a buffer to fill */
+void   *gc_alloc(gc_t *gc, size_t size);
+value_t gc_str(  gc_t *gc, const char *str, size_t len);
+value_t gc_cstr( gc_t *gc, const char *str);
+value_t gc_arr(  gc_t *gc, size_t size); /* With room for exactly size elements */
+value_t gc_arr_cap(gc_t *gc, size_t size, size_t cap);
+value_t gc_map(  gc_t *gc, size_t size); /* Empty, with room for size keys */
+value_t gc_rec(  gc_t *gc, const value_shape_t *shape); /* Every field is nil */
+value_t gc_packed(gc_t *gc, value_type_t type, size_t size); /* Every element is 0 */
+
+/* Stores the value of the key like gc_share, adding the key if the map does not have it. String
+   keys are copied as constants, since changing a key in place would lose its slot */
+void gc_map_set(gc_t *gc, value_t map, value_t key, value_t val);
+
+/* Slices share the text or elements of what they are taken from (strings, arrays and packed
+   arrays), unless they are shorter than GC_VIEW_MIN bytes. Views keep all of their parent alive,
+   so short ones are copied instead */
+value_t gc_slice(gc_t *gc, value_t of, size_t start, size_t size);
+
+/* Has to be called before a string or array (packed or not) is changed in place, the change goes
+   to the returned value. If views share its text or elements, it gets its own copy of them, so
+   the change is not seen through the views. Constants are copied whole (see gc_share) */
+value_t gc_unview(gc_t *gc, value_t val);
+
+/* Literals are constants that every evaluation of them returns, so nothing that can change them
+   may refer to them. Values are stored through this, which gives constants a copy and shares the
+   rest (see value_share) */
+value_t gc_share(gc_t *gc, value_t val);
+
+/* Interned strings with the same text are the same object, so they are told apart by their
+   pointer. The table does not keep them alive, and changing one in place takes it out of the
+   table first (see gc_unview). Views and constants are interned as a copy */
+value_t gc_intern(gc_t *gc, value_t str);
+
+/* Has to be called when a value is stored into an array or record that already existed */
+void gc_barrier(gc_t *gc, value_t arr, value_t val);
+
+/* Minor collections only move the young objects, the rest collect the old heap too. Major ones
+   start over if an incremental collection was running */
+void gc_collect(gc_t *gc, value_t **roots, size_t size, gc_work_t work);
 
 #endif
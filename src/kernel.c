@@ -0,0 +1,193 @@
+#include "kernel.h"
+
+/* The kernels are written once over 'lanes' of doubles, which are whatever vector the compiler
+   targets, or a single double */
+#if defined(__AVX__)
+#	include <immintrin.h>
+
+#	define LANES 4
+typedef __m256d lanes_t;
+
+#	define lanes_load(PTR)       _mm256_loadu_pd(PTR)
+#	define lanes_store(PTR, VAL) _mm256_storeu_pd(PTR, VAL)
+#	define lanes_set(NUM)        _mm256_set1_pd(NUM)
+#	define lanes_add(A, B)       _mm256_add_pd(A, B)
+#	define lanes_mul(A, B)       _mm256_mul_pd(A, B)
+#	define lanes_min(A, B)       _mm256_min_pd(A, B)
+#	define lanes_max(A, B)       _mm256_max_pd(A, B)
+#	define lanes_nan(A)          _mm256_cmp_pd(A, A, _CMP_UNORD_Q)
+#	define lanes_or(A, B)        _mm256_or_pd(A, B)
+#	define lanes_any(A)          (_mm256_movemask_pd(A) != 0)
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+
+#	define LANES 2
+typedef __m128d lanes_t;
+
+#	define lanes_load(PTR)       _mm_loadu_pd(PTR)
+#	define lanes_store(PTR, VAL) _mm_storeu_pd(PTR, VAL)
+#	define lanes_set(NUM)        _mm_set1_pd(NUM)
+#	define lanes_add(A, B)       _mm_add_pd(A, B)
+#	define lanes_mul(A, B)       _mm_mul_pd(A, B)
+#	define lanes_min(A, B)       _mm_min_pd(A, B)
+#	define lanes_max(A, B)       _mm_max_pd(A, B)
+#	define lanes_nan(A)          _mm_cmpunord_pd(A, A)
+#	define lanes_or(A, B)        _mm_or_pd(A, B)
+#	define lanes_any(A)          (_mm_movemask_pd(A) != 0)
+#else
+#	define LANES 1
+typedef double lanes_t;
+
+#	define lanes_load(PTR)       (*(PTR))
+#	define lanes_store(PTR, VAL) (*(PTR) = (VAL))
+#	define lanes_set(NUM)        (NUM)
+#	define lanes_add(A, B)       ((A) + (B))
+#	define lanes_mul(A, B)       ((A) * (B))
+#	define lanes_min(A, B)       ((A) < (B)? (A) : (B))
+#	define lanes_max(A, B)       ((A) > (B)? (A) : (B))
+#	define lanes_nan(A)          ((A) != (A)? 1.0 : 0.0)
+#	define lanes_or(A, B)        ((A) != 0 || (B) != 0? 1.0 : 0.0)
+#	define lanes_any(A)          ((A) != 0)
+#endif
+
+/* Two vectors per step, so the next addition does not wait for the last one */
+#define STEP (LANES * 2)
+
+static double min(double a, double b) {return a < b? a : b;}
+static double max(double a, double b) {return a > b? a : b;}
+
+double kernel_sum(const double *xs, size_t size) {
+	lanes_t a = lanes_set(0), b = lanes_set(0);
+
+	size_t i = 0;
+	for (; i + STEP <= size; i += STEP) {
+		a = lanes_add(a, lanes_load(xs + i));
+		b = lanes_add(b, lanes_load(xs + i + LANES));
+	}
+
+	double lanes[LANES], sum = 0;
+	lanes_store(lanes, lanes_add(a, b));
+	for (size_t j = 0; j < LANES; ++ j)
+		sum += lanes[j];
+
+	for (; i < size; ++ i)
+		sum += xs[i];
+
+	return sum;
+}
+
+double kernel_min(const double *xs, size_t size) {
+	lanes_t a = lanes_set(xs[0]), b = a, nan = lanes_set(0);
+
+	size_t i = 0;
+	for (; i + STEP <= size; i += STEP) {
+		lanes_t x = lanes_load(xs + i), y = lanes_load(xs + i + LANES);
+		a   = lanes_min(x, a);
+		b   = lanes_min(y, b);
+		nan = lanes_or(nan, lanes_or(lanes_nan(x), lanes_nan(y)));
+	}
+
+	if (lanes_any(nan))
+		return NAN;
+
+	double lanes[LANES], found = xs[0];
+	lanes_store(lanes, lanes_min(a, b));
+	for (size_t j = 0; j < LANES; ++ j)
+		found = min(lanes[j], found);
+
+	for (; i < size; ++ i) {
+		if (xs[i] != xs[i])
+			return NAN;
+
+		found = min(xs[i], found);
+	}
+
+	return found;
+}
+
+double kernel_max(const double *xs, size_t size) {
+	lanes_t a = lanes_set(xs[0]), b = a, nan = lanes_set(0);
+
+	size_t i = 0;
+	for (; i + STEP <= size; i += STEP) {
+		lanes_t x = lanes_load(xs + i), y = lanes_load(xs + i + LANES);
+		a   = lanes_max(x, a);
+		b   = lanes_max(y, b);
+		nan = lanes_or(nan, lanes_or(lanes_nan(x), lanes_nan(y)));
+	}
+
+	if (lanes_any(nan))
+		return NAN;
+
+	double lanes[LANES], found = xs[0];
+	lanes_store(lanes, lanes_max(a, b));
+	for (size_t j = 0; j < LANES; ++ j)
+		found = max(lanes[j], found);
+
+	for (; i < size; ++ i) {
+		if (xs[i] != xs[i])
+			return NAN;
+
+		found = max(xs[i], found);
+	}
+
+	return found;
+}
+
+double kernel_dot(const double *a, const double *b, size_t size) {
+	lanes_t x = lanes_set(0), y = lanes_set(0);
+
+	size_t i = 0;
+	for (; i + STEP <= size; i += STEP) {
+		x = lanes_add(x, lanes_mul(lanes_load(a + i),         lanes_load(b + i)));
+		y = lanes_add(y, lanes_mul(lanes_load(a + i + LANES), lanes_load(b + i + LANES)));
+	}
+
+	double lanes[LANES], sum = 0;
+	lanes_store(lanes, lanes_add(x, y));
+	for (size_t j = 0; j < LANES; ++ j)
+		sum += lanes[j];
+
+	for (; i < size; ++ i)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+void kernel_add(double *out, const double *a, const double *b, size_t size) {
+	size_t i = 0;
+	for (; i + LANES <= size; i += LANES)
+		lanes_store(out + i, lanes_add(lanes_load(a + i), lanes_load(b + i)));
+
+	for (; i < size; ++ i)
+		out[i] = a[i] + b[i];
+}
+
+void kernel_mul(double *out, const double *a, const double *b, size_t size) {
+	size_t i = 0;
+	for (; i + LANES <= size; i += LANES)
+		lanes_store(out + i, lanes_mul(lanes_load(a + i), lanes_load(b + i)));
+
+	for (; i < size; ++ i)
+		out[i] = a[i] * b[i];
+}
+
+void kernel_scale(double *out, const double *xs, double by, size_t size) {
+	lanes_t scale = lanes_set(by);
+
+	size_t i = 0;
+	for (; i + LANES <= size; i += LANES)
+		lanes_store(out + i, lanes_mul(lanes_load(xs + i), scale));
+
+	for (; i < size; ++ i)
+		out[i] = xs[i] * by;
+}
+
+/* Every sum needs the one before it, so there is nothing to split into lanes */
+void kernel_prefix_sum(double *out, const double *xs, size_t size) {
+	double sum = 0;
+	for (size_t i = 0; i < size; ++ i) {
+		sum   += xs[i];
+		out[i] = sum;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef KERNEL_H_HEADER_GUARD
+#define KERNEL_H_HEADER_GUARD
+
+#include <stddef.h> /* size_t */
+#include <math.h>   /* NAN */
+
+#include "common.h"
+
+/* Loops over raw doubles for the numeric array builtins. They use AVX or SSE2 when the compiler
+   targets it, and plain loops otherwise. Sums are added in several lanes at once, so they can
+   round differently than adding the numbers one by one. The vector min and max instructions skip
+   a NaN depending on which side it is on, so kernel_min and kernel_max check for NaNs themselves
+   and give NaN if there is any */
+
+double kernel_sum(const double *xs, size_t size);
+double kernel_min(const double *xs, size_t size); /* The size has to be above 0 */
+double kernel_max(const double *xs, size_t size);
+double kernel_dot(const double *a, const double *b, size_t size);
+
+/* The output can be one of the inputs */
+void kernel_add(       double *out, const double *a,  const double *b, size_t size);
+void kernel_mul(       double *out, const double *a,  const double *b, size_t size);
+void kernel_scale(     double *out, const double *xs, double by,       size_t size);
+void kernel_prefix_sum(double *out, const double *xs, size_t size);
+
+#endif
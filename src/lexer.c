@@ -5,18 +5,19 @@ static void lexer_advance(lexer_t *l) {
 	if (l->ch == '\n') {
 		++ l->where.row;
 		l->where.col = 1;
-	} else
+	} else if (l->where.col < UINT16_MAX)
 		++ l->where.col;
 
 	if (l->ch != '\0')
 		++ l->it;
 }
 
-void lexer_init(lexer_t *l, const char *str, const char *path) {
+void lexer_init(lexer_t *l, const char *str, const char *path, arena_t *arena) {
 	memset(l, 0, sizeof(*l));
 
-	l->str = str;
-	l->where.path = path;
+	l->arena = arena;
+	l->str   = str;
+	l->where.file = where_file(path);
 	l->where.row  = 1;
 	lexer_advance(l);
 }
@@ -28,12 +29,26 @@ static void lexer_tok_append(lexer_t *l, char ch) {
 	l->tok[l->tok_len]    = 0;
 }
 
+/* Only the text of names and literals is kept by the parser, other tokens are known by type */
+static token_t lexer_token(lexer_t *l, token_type_t type, where_t start) {
+	if (type != TOKEN_TYPE_ID  && type != TOKEN_TYPE_STR &&
+	    type != TOKEN_TYPE_FMT && type != TOKEN_TYPE_NUM)
+		return token_new(NULL, type, start);
+
+	char *data = (char*)arena_alloc(l->arena, l->tok_len + 1);
+	memcpy(data, l->tok, l->tok_len + 1);
+
+	token_t tok = token_new(data, type, start);
+	tok.len     = l->tok_len;
+	return tok;
+}
+
 static token_t lex_simple_sym(lexer_t *l, token_type_t type) {
 	where_t start = l->where;
 
 	lexer_tok_append(l, l->ch);
 	lexer_advance(l);
-	return token_new(strcpy_to_heap(l->tok), type, start);
+	return lexer_token(l, type, start);
 }
 
 static const char *token_type_to_keyword_map[TOKEN_TYPE_COUNT] = {
@@ -55,6 +70,7 @@ static const char *token_type_to_keyword_map[TOKEN_TYPE_COUNT] = {
 	[TOKEN_TYPE_RETURN]   = "return",
 	[TOKEN_TYPE_DEFER]    = "defer",
 	[TOKEN_TYPE_FUN]      = "fun",
+	[TOKEN_TYPE_RECORD]   = "record",
 	[TOKEN_TYPE_AND]      = "and",
 	[TOKEN_TYPE_OR]       = "or",
 	[TOKEN_TYPE_NOT]      = "not",
@@ -81,7 +97,7 @@ static token_t lex_id(lexer_t *l) {
 		}
 	}
 
-	return token_new(strcpy_to_heap(l->tok), type, start);
+	return lexer_token(l, type, start);
 }
 
 static token_t lex_str(lexer_t *l, token_type_t type) {
@@ -134,7 +150,7 @@ static token_t lex_str(lexer_t *l, token_type_t type) {
 	}
 
 	lexer_advance(l);
-	return token_new(strcpy_to_heap(l->tok), type, start);
+	return lexer_token(l, type, start);
 }
 
 static token_t lex_num(lexer_t *l) {
@@ -153,7 +169,7 @@ static token_t lex_num(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 	}
 
-	return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_NUM, start);
+	return lexer_token(l, TOKEN_TYPE_NUM, start);
 }
 
 static token_t lex_greater(lexer_t *l) {
@@ -166,9 +182,9 @@ static token_t lex_greater(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_GREATER_EQU, start);
+		return lexer_token(l, TOKEN_TYPE_GREATER_EQU, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_GREATER, start);
+		return lexer_token(l, TOKEN_TYPE_GREATER, start);
 }
 
 static token_t lex_less(lexer_t *l) {
@@ -181,9 +197,9 @@ static token_t lex_less(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_LESS_EQU, start);
+		return lexer_token(l, TOKEN_TYPE_LESS_EQU, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_LESS, start);
+		return lexer_token(l, TOKEN_TYPE_LESS, start);
 }
 
 static token_t lex_slash(lexer_t *l) {
@@ -196,14 +212,14 @@ static token_t lex_slash(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_NOT_EQUALS, start);
+		return lexer_token(l, TOKEN_TYPE_NOT_EQUALS, start);
 	} else if (l->ch == '/') {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_XDEC, start);
+		return lexer_token(l, TOKEN_TYPE_XDEC, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_DIV, start);
+		return lexer_token(l, TOKEN_TYPE_DIV, start);
 }
 
 static token_t lex_equals(lexer_t *l) {
@@ -216,9 +232,9 @@ static token_t lex_equals(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_EQUALS, start);
+		return lexer_token(l, TOKEN_TYPE_EQUALS, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_ASSIGN, start);
+		return lexer_token(l, TOKEN_TYPE_ASSIGN, start);
 }
 
 static token_t lex_dot(lexer_t *l) {
@@ -235,11 +251,11 @@ static token_t lex_dot(lexer_t *l) {
 			lexer_tok_append(l, l->ch);
 			lexer_advance(l);
 
-			return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_ERANGE, start);
+			return lexer_token(l, TOKEN_TYPE_ERANGE, start);
 		} else
-			return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_RANGE, start);
+			return lexer_token(l, TOKEN_TYPE_RANGE, start);
 	} else
-		return token_new_err("Unexpected character", start);
+		return lexer_token(l, TOKEN_TYPE_DOT, start);
 }
 
 static token_t lex_add(lexer_t *l) {
@@ -252,9 +268,9 @@ static token_t lex_add(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_INC, start);
+		return lexer_token(l, TOKEN_TYPE_INC, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_ADD, start);
+		return lexer_token(l, TOKEN_TYPE_ADD, start);
 }
 
 static token_t lex_sub(lexer_t *l) {
@@ -267,9 +283,9 @@ static token_t lex_sub(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_DEC, start);
+		return lexer_token(l, TOKEN_TYPE_DEC, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_SUB, start);
+		return lexer_token(l, TOKEN_TYPE_SUB, start);
 }
 
 static token_t lex_mul(lexer_t *l) {
@@ -282,9 +298,9 @@ static token_t lex_mul(lexer_t *l) {
 		lexer_tok_append(l, l->ch);
 		lexer_advance(l);
 
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_XINC, start);
+		return lexer_token(l, TOKEN_TYPE_XINC, start);
 	} else
-		return token_new(strcpy_to_heap(l->tok), TOKEN_TYPE_MUL, start);
+		return lexer_token(l, TOKEN_TYPE_MUL, start);
 }
 
 static void lexer_skip_comment(lexer_t *l) {
@@ -302,6 +318,8 @@ token_t lexer_next(lexer_t *l) {
 		case ')': return lex_simple_sym(l, TOKEN_TYPE_RPAREN);
 		case '[': return lex_simple_sym(l, TOKEN_TYPE_LSQUARE);
 		case ']': return lex_simple_sym(l, TOKEN_TYPE_RSQUARE);
+		case '{': return lex_simple_sym(l, TOKEN_TYPE_LCURLY);
+		case '}': return lex_simple_sym(l, TOKEN_TYPE_RCURLY);
 		case ',': return lex_simple_sym(l, TOKEN_TYPE_COMMA);
 		case ';': return lex_simple_sym(l, TOKEN_TYPE_SEMICOLON);
 		case ':': return lex_simple_sym(l, TOKEN_TYPE_COLON);
@@ -9,6 +9,7 @@
 #include <stdbool.h> /* bool, true, false */
 
 #include "token.h"
+#include "arena.h"
 
 #define TOK_CAPACITY 1024
 
@@ -20,10 +21,11 @@ typedef struct {
 	char   tok[TOK_CAPACITY];
 	size_t tok_len;
 
-	where_t where;
+	where_t  where;
+	arena_t *arena; /* Of the unit, holds the text of the tokens */
 } lexer_t;
 
-void lexer_init(lexer_t *l, const char *str, const char *path);
+void lexer_init(lexer_t *l, const char *str, const char *path, arena_t *arena);
 token_t lexer_next(lexer_t *l);
 
 #endif
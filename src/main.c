@@ -24,6 +24,20 @@ static void arg_fatal(const char *fmt, ...) {
 	exit(EXIT_FAILURE);
 }
 
+/* Value of an option that takes a size, like '--gc-min-heap 1048576' */
+static size_t arg_size(args_t *a, const char *flag) {
+	const char *arg = args_shift(a);
+	if (arg == NULL)
+		arg_fatal("Flag '%s' is missing a value", flag);
+
+	char *end;
+	unsigned long long val = strtoull(arg, &end, 10);
+	if (!isdigit((unsigned char)*arg) || *end != '\0')
+		arg_fatal("Incorrect type for flag '%s'", flag);
+
+	return val;
+}
+
 void usage(void) {
 	args_print_usage(stdout, APP_NAME, USAGE);
 	exit(EXIT_SUCCESS);
@@ -42,9 +56,24 @@ int main(int argc, const char **argv) {
 
 	bool help = false;
 	bool ver  = false;
+	bool walk = false;
+
+	size_t gc_min_heap = GC_MIN_HEAP;
+	size_t gc_growth   = GC_GROWTH;
+	size_t gc_nursery  = GC_NURSERY;
+	size_t gc_pause    = 0;
 
 	flag_bool("h", "help",    "Show the usage",   &help);
 	flag_bool("v", "version", "Show the version", &ver);
+	flag_bool(NULL, "walk",   "Evaluate with the tree walker instead of the bytecode VM", &walk);
+	flag_size(NULL, "gc-min-heap", "Bytes allocated before the first garbage collection",
+	          &gc_min_heap);
+	flag_size(NULL, "gc-growth", "Percent the heap can grow over the live bytes between "
+	          "garbage collections", &gc_growth);
+	flag_size(NULL, "gc-nursery", "Bytes of the young generation, 0 allocates everything as old",
+	          &gc_nursery);
+	flag_size(NULL, "gc-max-pause-us", "Collect the old heap incrementally in steps of at most "
+	          "this many microseconds, 0 collects it all at once", &gc_pause);
 
 	/*int    where;
 	args_t stripped;
@@ -64,29 +93,58 @@ int main(int argc, const char **argv) {
 	else if (ver)
 		version();*/
 
-	args_t enva = a;
-	const char *arg = args_shift(&a);
-	if (arg == NULL)
-		arg_fatal("No input file");
-
-	if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
-		usage();
-	else if (strcmp(arg, "-v") == 0 || strcmp(arg, "--version") == 0)
-		version();
+	/* Options go before the path, everything after it belongs to the script */
+	args_t      enva;
+	const char *arg;
+	while (true) {
+		enva = a;
+		arg  = args_shift(&a);
+		if (arg == NULL)
+			arg_fatal("No input file");
+
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+			usage();
+		else if (strcmp(arg, "-v") == 0 || strcmp(arg, "--version") == 0)
+			version();
+		else if (strcmp(arg, "--walk") == 0)
+			walk = true;
+		else if (strcmp(arg, "--gc-min-heap") == 0)
+			gc_min_heap = arg_size(&a, arg);
+		else if (strcmp(arg, "--gc-growth") == 0)
+			gc_growth = arg_size(&a, arg);
+		else if (strcmp(arg, "--gc-nursery") == 0)
+			gc_nursery = arg_size(&a, arg);
+		else if (strcmp(arg, "--gc-max-pause-us") == 0)
+			gc_pause = arg_size(&a, arg);
+		else if (arg[0] == '-' && arg[1] == '-')
+			arg_fatal("Unknown option '%s'", arg);
+		else
+			break;
+	}
 
 	char *str = readfile(arg);
 	if (str == NULL)
 		arg_fatal("Could not open file '%s'", arg);
 
-	stmt_t *program = parse(str, arg);
+	arena_t arena;
+	arena_init(&arena);
+
+	stmt_t *program = parse(str, arg, &arena);
 	free(str);
 
 	env_t e;
 	env_init(&e, enva.c, enva.v);
-	eval(&e, program, arg);
+	e.walk = walk;
+	gc_set_pacing( &e.gc, gc_min_heap, gc_growth);
+	gc_set_nursery(&e.gc, gc_nursery);
+	gc_set_max_pause(&e.gc, gc_pause);
+	if (walk)
+		eval(&e, program, arg);
+	else
+		vm_run(&e, program, arg, false);
 	env_deinit(&e);
 
-	stmt_free(program);
+	arena_free(&arena);
 
 	/*free(stripped.base);*/
 	return EXIT_SUCCESS;
@@ -4,6 +4,7 @@
 #include <stdio.h>  /* printf, stderr, fprintf */
 #include <stdlib.h> /* exit, EXIT_FAILURE, EXIT_SUCCESS */
 #include <stdarg.h> /* va_list, va_start, va_end, vsnprintf */
+#include <ctype.h>  /* isdigit */
 
 #include <chol/args.h>
 #include <chol/colorer.h>
@@ -11,9 +12,10 @@
 #include "common.h"
 #include "parser.h"
 #include "eval.h"
+#include "vm.h"
 
 #define APP_NAME "toki"
-#define USAGE    "<PATH | OPTIONS> [...]"
+#define USAGE    "[OPTIONS] <PATH> [...]"
 
 #define VERSION_MAJOR 1
 #define VERSION_MINOR 3
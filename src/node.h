@@ -1,13 +1,14 @@
 #ifndef NODE_H_HEADER_GUARD
 #define NODE_H_HEADER_GUARD
 
-#include <stdlib.h> /* malloc, free */
 #include <string.h> /* memset */
 #include <assert.h> /* static_assert */
+#include <stdint.h> /* uint32_t, UINT32_MAX */
 
 #include "common.h"
 #include "token.h"
 #include "value.h"
+#include "arena.h"
 
 typedef struct expr        expr_t;
 typedef struct expr_call   expr_call_t;
@@ -19,6 +20,8 @@ typedef struct expr_fun    expr_fun_t;
 typedef struct expr_idx    expr_idx_t;
 typedef struct expr_fmt    expr_fmt_t;
 typedef struct expr_arr    expr_arr_t;
+typedef struct expr_map    expr_map_t;
+typedef struct expr_rec    expr_rec_t;
 typedef struct expr_if     expr_if_t;
 
 typedef struct stmt         stmt_t;
@@ -33,6 +36,16 @@ typedef struct stmt_defer   stmt_defer_t;
 typedef struct stmt_fun     stmt_fun_t;
 typedef struct stmt_import  stmt_import_t;
 
+typedef struct chunk chunk_t;
+
+/* Variables are resolved before they run (see compiler.c). Variables declared in scopes opened
+   by the code itself get a fixed slot, the others are declared and looked up by their symbol */
+#define SLOT_DYNAMIC UINT32_MAX
+
+typedef struct {
+	uint32_t sym, slot;
+} decl_t;
+
 typedef enum {
 	EXPR_TYPE_VALUE = 0,
 	EXPR_TYPE_CALL,
@@ -44,21 +57,25 @@ typedef enum {
 	EXPR_TYPE_IDX,
 	EXPR_TYPE_FMT,
 	EXPR_TYPE_ARR,
+	EXPR_TYPE_MAP,
+	EXPR_TYPE_REC,
 	EXPR_TYPE_IF,
 
 	EXPR_TYPE_COUNT,
 } expr_type_t;
 
-#define ARGS_CAPACITY 32
+/* Lists of nodes (arguments, elements) are allocated with their exact size */
 
 struct expr_call {
-	expr_t *expr;
-	expr_t *args[ARGS_CAPACITY];
-	size_t  args_count;
+	expr_t  *expr;
+	expr_t **args;
+	size_t   args_count;
 };
 
 struct expr_id {
-	char *name;
+	char    *name;
+	uint32_t sym;
+	uint32_t depth, slot; /* How many scopes up the variable is, and its index there */
 };
 
 typedef enum {
@@ -116,24 +133,48 @@ struct expr_do {
 };
 
 struct expr_fun {
-	char   *args[ARGS_CAPACITY];
-	size_t  args_count;
-	stmt_t *body;
+	char    **args;
+	uint32_t *args_sym; /* The arguments take the first slots of the call scope */
+	size_t    args_count;
+	stmt_t  *body;
+	chunk_t *chunk; /* Compiled body, owned by the chunk of the unit */
 };
 
+/* Records are indexed by the names of their fields ('rec.field' is 'rec["field"]'). Indexes by
+   a literal name remember where it was in the shape of the last record, so the next records of
+   that shape get to the field by its offset */
 struct expr_idx {
 	expr_t *expr, *start, *end;
+
+	const value_shape_t *shape;
+	size_t               field;
 };
 
+/* The format is split around its '%v's when it is parsed, so it is not scanned again on every
+   evaluation. Every part is followed by the next '%v', except for the last one */
 struct expr_fmt {
-	char   *str;
-	expr_t *args[ARGS_CAPACITY];
-	size_t  args_count;
+	char    *str;
+	size_t  *parts; /* Lengths of the text between the '%v's */
+	size_t   parts_count;
+	size_t   len;   /* Of all the parts */
+	expr_t **args;
+	size_t   args_count;
 };
 
 struct expr_arr {
 	expr_t **buf;
-	size_t   size, cap;
+	size_t   size;
+};
+
+struct expr_map {
+	expr_t **buf; /* Every key is followed by its value */
+	size_t   size;
+};
+
+/* The body of the constructor a record definition declares, the fields are its arguments */
+struct expr_rec {
+	const value_shape_t *shape;
+	expr_t             **fields;
 };
 
 struct expr_if {
@@ -155,11 +196,13 @@ struct expr {
 		expr_idx_t    idx;
 		expr_fmt_t    fmt;
 		expr_arr_t    arr;
+		expr_map_t    map;
+		expr_rec_t    rec;
 		expr_if_t     if_;
 	} as;
 };
 
-static_assert(EXPR_TYPE_COUNT == 11); /* Add new expressions to union */
+static_assert(EXPR_TYPE_COUNT == 13); /* Add new expressions to union */
 
 typedef enum {
 	STMT_TYPE_EXPR = 0,
@@ -184,6 +227,7 @@ struct stmt_let {
 	expr_t *val;
 	stmt_t *next;
 	bool    const_;
+	decl_t  decl;
 };
 
 struct stmt_if {
@@ -206,6 +250,7 @@ struct stmt_foreach {
 	char   *name, *it;
 	expr_t *in;
 	stmt_t *body;
+	decl_t  decl, it_decl;
 };
 
 struct stmt_return {
@@ -213,17 +258,20 @@ struct stmt_return {
 };
 
 struct stmt_defer {
-	stmt_t *stmt;
+	stmt_t  *stmt;
+	chunk_t *chunk; /* Compiled statement, owned by the chunk of the unit */
 };
 
 struct stmt_fun {
 	char   *name;
 	expr_t *def;
+	decl_t  decl;
 };
 
 struct stmt_enum {
 	char   *name;
 	stmt_t *next;
+	decl_t  decl;
 };
 
 struct stmt_import {
@@ -254,10 +302,8 @@ struct stmt {
 
 static_assert(STMT_TYPE_COUNT == 13); /* Add new statements to union */
 
-expr_t *expr_new(void);
-void    expr_free(expr_t *expr);
-
-stmt_t *stmt_new(void);
-void    stmt_free(stmt_t *stmt);
+/* Nodes belong to the arena of their unit and are freed with it */
+expr_t *expr_new(arena_t *arena);
+stmt_t *stmt_new(arena_t *arena);
 
 #endif
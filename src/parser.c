@@ -59,9 +59,28 @@ static void parser_advance(parser_t *p) {
 		error(p->tok.where, "%s", p->tok.data);
 }
 
-static void parser_skip(parser_t *p) {
-	token_free(&p->tok);
-	parser_advance(p);
+/* Lists are collected on the parser and copied to the arena once their size is known */
+static void parser_list_push(parser_t *p, void *item) {
+	if (p->list_size >= p->list_cap) {
+		p->list_cap = p->list_cap == 0? 32 : p->list_cap * 2;
+		p->list     = (void**)realloc(p->list, sizeof(void*) * p->list_cap);
+		if (p->list == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	p->list[p->list_size ++] = item;
+}
+
+static void *parser_list_end(parser_t *p, size_t base, size_t *count) {
+	*count = p->list_size - base;
+	if (*count == 0)
+		return NULL;
+
+	void **items = (void**)arena_alloc(p->arena, sizeof(void*) * *count);
+	memcpy(items, p->list + base, sizeof(void*) * *count);
+
+	p->list_size = base;
+	return items;
 }
 
 static expr_t *parse_expr( parser_t *p);
@@ -72,150 +91,231 @@ static expr_t *parse_expr_id(parser_t *p) {
 	token_t tok = p->tok;
 	parser_advance(p);
 
-	expr_t *expr     = expr_new();
+	expr_t *expr     = expr_new(p->arena);
 	expr->where      = tok.where;
 	expr->type       = EXPR_TYPE_ID;
 	expr->as.id.name = tok.data;
 	return expr;
 }
 
-static expr_t *new_value_expr(where_t where) {
-	expr_t *expr = expr_new();
+static expr_t *new_value_expr(parser_t *p, where_t where) {
+	expr_t *expr = expr_new(p->arena);
 	expr->where  = where;
 	expr->type   = EXPR_TYPE_VALUE;
 	return expr;
 }
 
+/* Literals are allocated with a header like the objects of the GC heap, marked as constants so
+   nothing changes them in place (see gc_share). They only hold values without a header, so a
+   copy of one is a whole new value */
+static void *parser_const(parser_t *p, size_t size) {
+	value_header_t *header = (value_header_t*)arena_alloc(p->arena, sizeof(value_header_t) + size);
+	memset(header, 0, sizeof(value_header_t));
+	header->size     = sizeof(value_header_t) + size;
+	header->constant = true;
+	return header + 1;
+}
+
 static expr_t *parse_expr_str(parser_t *p) {
-	expr_t *expr = new_value_expr(p->tok.where);
-	expr->as.val.type   = VALUE_TYPE_STR;
-	expr->as.val.as.str = p->tok.data;
+	expr_t *expr = new_value_expr(p, p->tok.where);
+	if (p->tok.len <= VALUE_SHORT_STR_MAX) {
+		expr->as.val = value_short_str(p->tok.data, p->tok.len);
+		parser_advance(p);
+		return expr;
+	}
+
+	value_str_t *str = (value_str_t*)parser_const(p, sizeof(value_str_t) + p->tok.len + 1);
+	str->len    = p->tok.len;
+	str->cap    = p->tok.len;
+	str->hash   = value_hash_bytes(p->tok.data, p->tok.len);
+	str->buf    = str->text;
+	str->parent = value_nil();
+	memcpy(str->buf, p->tok.data, p->tok.len + 1);
+	expr->as.val = value_str(str);
 
 	parser_advance(p);
 	return expr;
 }
 
+/* A '%' right after another one does not start a '%v' */
+static bool fmt_is_arg(const char *str, size_t i) {
+	return str[i] == '%' && str[i + 1] == 'v' && (i == 0 || str[i - 1] != '%');
+}
+
 static expr_t *parse_expr_fmt(parser_t *p) {
-	expr_t *expr = expr_new();
+	expr_t *expr = expr_new(p->arena);
 	expr->where  = p->tok.where;
 	expr->type   = EXPR_TYPE_FMT;
 
-	expr->as.fmt.str = p->tok.data;
+	expr_fmt_t *fmt = &expr->as.fmt;
+	fmt->str         = p->tok.data;
+	fmt->parts_count = 1;
+	for (size_t i = 0; i + 1 < p->tok.len; ++ i) {
+		if (fmt_is_arg(fmt->str, i)) {
+			++ fmt->parts_count;
+			++ i;
+		}
+	}
+
+	fmt->parts = (size_t*)arena_alloc(p->arena, sizeof(size_t) * fmt->parts_count);
+	fmt->len   = 0;
+
+	size_t part = 0, start = 0;
+	for (size_t i = 0; i + 1 < p->tok.len; ++ i) {
+		if (fmt_is_arg(fmt->str, i)) {
+			fmt->parts[part ++] = i - start;
+			fmt->len += i - start;
+			start     = i + 2;
+			++ i;
+		}
+	}
+
+	fmt->parts[part] = p->tok.len - start;
+	fmt->len        += p->tok.len - start;
 	parser_advance(p);
 
 	if (p->tok.type != TOKEN_TYPE_LPAREN)
 		error(p->tok.where, "Expected '(', got '%s'", token_type_to_cstr(p->tok.type));
 
-	parser_skip(p);
+	size_t base = p->list_size;
+	parser_advance(p);
 	while (p->tok.type != TOKEN_TYPE_RPAREN) {
-		assert(expr->as.fmt.args_count < ARGS_CAPACITY);
-
-		expr->as.fmt.args[expr->as.fmt.args_count ++] = parse_expr(p);
+		parser_list_push(p, parse_expr(p));
 
 		if (p->tok.type == TOKEN_TYPE_RPAREN)
 			break;
 		else if (p->tok.type != TOKEN_TYPE_COMMA)
 			error(p->tok.where, "Expected ',', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
 	}
 
-	parser_skip(p);
+	parser_advance(p);
+	expr->as.fmt.args = (expr_t**)parser_list_end(p, base, &expr->as.fmt.args_count);
 	return expr;
 }
 
 static expr_t *parse_expr_num(parser_t *p) {
-	expr_t *expr = new_value_expr(p->tok.where);
-	expr->as.val.type   = VALUE_TYPE_NUM;
-	expr->as.val.as.num = atof(p->tok.data);
+	expr_t *expr = new_value_expr(p, p->tok.where);
+	expr->as.val = value_num(atof(p->tok.data));
 
-	parser_skip(p);
+	parser_advance(p);
 	return expr;
 }
 
 static expr_t *parse_expr_nil(parser_t *p) {
-	expr_t *expr = new_value_expr(p->tok.where);
-	expr->as.val.type = VALUE_TYPE_NIL;
+	expr_t *expr = new_value_expr(p, p->tok.where);
+	expr->as.val = value_nil();
 
-	parser_skip(p);
+	parser_advance(p);
 	return expr;
 }
 
 static expr_t *parse_expr_arr(parser_t *p) {
-	expr_t *expr = expr_new();
+	expr_t *expr = expr_new(p->arena);
 	expr->where  = p->tok.where;
 	expr->type   = EXPR_TYPE_ARR;
 
-	expr->as.arr.cap = ARRAY_CHUNK_SIZE;
-	expr->as.arr.buf = (expr_t**)malloc(expr->as.arr.cap * sizeof(expr_t*));
-	if (expr->as.arr.buf == NULL)
-		UNREACHABLE("malloc() fail");
-
-	parser_skip(p);
+	size_t base = p->list_size;
+	parser_advance(p);
 	while (p->tok.type != TOKEN_TYPE_RSQUARE) {
-		if (expr->as.arr.size >= expr->as.arr.cap) {
-			expr->as.arr.cap *= 2;
-			expr->as.arr.buf  = (expr_t**)realloc(expr->as.arr.buf,
-			                                      expr->as.arr.cap * sizeof(expr_t*));
-			if (expr->as.arr.buf == NULL)
-				UNREACHABLE("realloc() fail");
-		}
-
-		expr->as.arr.buf[expr->as.arr.size ++] = parse_expr(p);
+		parser_list_push(p, parse_expr(p));
 
 		if (p->tok.type == TOKEN_TYPE_RSQUARE)
 			break;
 		else if (p->tok.type != TOKEN_TYPE_COMMA)
 			error(p->tok.where, "Expected ',', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
+	}
+
+	parser_advance(p);
+	expr->as.arr.buf = (expr_t**)parser_list_end(p, base, &expr->as.arr.size);
+
+	/* Arrays of numbers, booleans, nils and short strings become constants */
+	for (size_t i = 0; i < expr->as.arr.size; ++ i) {
+		expr_t *elem = expr->as.arr.buf[i];
+		if (elem->type != EXPR_TYPE_VALUE || value_is_obj(elem->as.val))
+			return expr;
 	}
 
-	parser_skip(p);
+	size_t       size = expr->as.arr.size;
+	value_arr_t *arr  = (value_arr_t*)parser_const(p, sizeof(value_arr_t) + size * sizeof(value_t));
+	arr->size   = size;
+	arr->cap    = size;
+	arr->buf    = arr->elems;
+	arr->parent = value_nil();
+	for (size_t i = 0; i < size; ++ i)
+		arr->buf[i] = expr->as.arr.buf[i]->as.val;
+
+	expr->type   = EXPR_TYPE_VALUE;
+	expr->as.val = value_arr(arr);
+	return expr;
+}
+
+static expr_t *parse_expr_inc(parser_t *p);
+
+/* Keys are parsed without assignments, so the '=' after them is not taken as one */
+static expr_t *parse_expr_map(parser_t *p) {
+	expr_t *expr = expr_new(p->arena);
+	expr->where  = p->tok.where;
+	expr->type   = EXPR_TYPE_MAP;
+
+	size_t base = p->list_size;
+	parser_advance(p);
+	while (p->tok.type != TOKEN_TYPE_RCURLY) {
+		parser_list_push(p, parse_expr_inc(p));
+
+		if (p->tok.type != TOKEN_TYPE_ASSIGN)
+			error(p->tok.where, "Expected '=', got '%s'", token_type_to_cstr(p->tok.type));
+
+		parser_advance(p);
+		parser_list_push(p, parse_expr(p));
+
+		if (p->tok.type == TOKEN_TYPE_RCURLY)
+			break;
+		else if (p->tok.type != TOKEN_TYPE_COMMA)
+			error(p->tok.where, "Expected ',', got '%s'", token_type_to_cstr(p->tok.type));
+
+		parser_advance(p);
+	}
+
+	parser_advance(p);
+	expr->as.map.buf   = (expr_t**)parser_list_end(p, base, &expr->as.map.size);
+	expr->as.map.size /= 2;
 	return expr;
 }
 
 static expr_t *parse_expr_bool(parser_t *p) {
-	expr_t *expr = new_value_expr(p->tok.where);
-	expr->as.val.type     = VALUE_TYPE_BOOL;
-	expr->as.val.as.bool_ = strcmp(p->tok.data, "true") == 0;
+	expr_t *expr = new_value_expr(p, p->tok.where);
+	expr->as.val = value_bool(p->tok.type == TOKEN_TYPE_TRUE);
 
-	parser_skip(p);
+	parser_advance(p);
 	return expr;
 }
 
 static expr_t *parse_expr_do(parser_t *p) {
-	expr_t *expr = expr_new();
+	expr_t *expr = expr_new(p->arena);
 	expr->where  = p->tok.where;
 	expr->type   = EXPR_TYPE_DO;
 
-	parser_skip(p);
+	parser_advance(p);
 	expr->as.do_.body = parse_stmts(p);
 	return expr;
 }
 
-static expr_t *parse_expr_fun(parser_t *p) {
-	expr_t *expr = expr_new();
-	expr->where  = p->tok.where;
-	expr->type   = EXPR_TYPE_FUN;
-
-	if (p->tok.type == TOKEN_TYPE_FUN)
-		parser_skip(p);
-	else
-		parser_advance(p);
-
+static void parse_fun_args(parser_t *p, expr_fun_t *fun) {
 	if (p->tok.type != TOKEN_TYPE_LPAREN)
 		error(p->tok.where, "Expected '(', got '%s'", token_type_to_cstr(p->tok.type));
 
-	parser_skip(p);
+	size_t base = p->list_size;
+	parser_advance(p);
 	while (p->tok.type != TOKEN_TYPE_RPAREN) {
-		assert(expr->as.fun.args_count < ARGS_CAPACITY);
-
 		if (p->tok.type != TOKEN_TYPE_ID)
 			error(p->tok.where, "Expected argument name, got '%s'",
 			      token_type_to_cstr(p->tok.type));
 
-		expr->as.fun.args[expr->as.fun.args_count ++] = p->tok.data;
+		parser_list_push(p, p->tok.data);
 
 		parser_advance(p);
 		if (p->tok.type == TOKEN_TYPE_RPAREN)
@@ -223,21 +323,37 @@ static expr_t *parse_expr_fun(parser_t *p) {
 		else if (p->tok.type != TOKEN_TYPE_COMMA)
 			error(p->tok.where, "Expected ',', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
 	}
 
-	parser_skip(p);
+	parser_advance(p);
+	fun->args     = (char**)parser_list_end(p, base, &fun->args_count);
+	fun->args_sym = (uint32_t*)arena_alloc(p->arena, sizeof(uint32_t) * fun->args_count);
+}
+
+static expr_t *parse_expr_fun(parser_t *p) {
+	expr_t *expr = expr_new(p->arena);
+	expr->where  = p->tok.where;
+	expr->type   = EXPR_TYPE_FUN;
+
+	parser_advance(p);
+	parse_fun_args(p, &expr->as.fun);
+
+	size_t loops = p->loops;
+	p->loops = 0;
 
 	if (p->tok.type == TOKEN_TYPE_ASSIGN) {
-		stmt_t *return_ = stmt_new();
+		stmt_t *return_ = stmt_new(p->arena);
 		return_->type   = STMT_TYPE_RETURN;
 		return_->where  = p->tok.where;
 
-		parser_skip(p);
+		parser_advance(p);
 		return_->as.return_.expr     = parse_expr(p);
 		expr->as.fun.body = return_;
 	} else
 		expr->as.fun.body = parse_stmts(p);
+
+	p->loops = loops;
 	return expr;
 }
 
@@ -246,9 +362,9 @@ static expr_t *parse_expr_factor(parser_t *p);
 static expr_t *parse_expr_if(parser_t *p) {
 	if (p->tok.type == TOKEN_TYPE_IF) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_IF;
 		node->where = tok.where;
 
@@ -257,13 +373,13 @@ static expr_t *parse_expr_if(parser_t *p) {
 		if (p->tok.type != TOKEN_TYPE_THEN)
 			error(p->tok.where, "Expected 'then', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
 		node->as.if_.a = parse_expr(p);
 
 		if (p->tok.type != TOKEN_TYPE_ELSE)
 			error(p->tok.where, "Expected 'else', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
 		node->as.if_.b = parse_expr(p);
 
 		return node;
@@ -281,14 +397,15 @@ static expr_t *parse_expr_factor(parser_t *p) {
 	case TOKEN_TYPE_NUM:     return parse_expr_num(p);
 	case TOKEN_TYPE_NIL:     return parse_expr_nil(p);
 	case TOKEN_TYPE_LSQUARE: return parse_expr_arr(p);
+	case TOKEN_TYPE_LCURLY:  return parse_expr_map(p);
 	case TOKEN_TYPE_IF:      return parse_expr_if(p);
 	case TOKEN_TYPE_LPAREN: {
-		parser_skip(p);
+		parser_advance(p);
 		expr_t *expr = parse_expr(p);
 		if (p->tok.type != TOKEN_TYPE_RPAREN)
 			error(p->tok.where, "Expected matching ')', got '%s'", token_type_to_cstr(p->tok.type));
 
-		parser_skip(p);
+		parser_advance(p);
 		return expr;
 	}
 
@@ -310,55 +427,71 @@ static expr_t *parse_expr_call_idx(parser_t *p) {
 colon:
 	if (p->tok.type == TOKEN_TYPE_COLON) {
 		arg = expr;
-		parser_skip(p);
+		parser_advance(p);
 		expr = parse_expr_factor(p);
 	}
 
-	while (p->tok.type == TOKEN_TYPE_LSQUARE || p->tok.type == TOKEN_TYPE_LPAREN) {
+	while (p->tok.type == TOKEN_TYPE_LSQUARE || p->tok.type == TOKEN_TYPE_LPAREN ||
+	       p->tok.type == TOKEN_TYPE_DOT) {
 		if (p->tok.type == TOKEN_TYPE_LPAREN) {
-			expr_t *call       = expr_new();
+			expr_t *call       = expr_new(p->arena);
 			call->where        = p->tok.where;
 			call->type         = EXPR_TYPE_CALL;
 			call->as.call.expr = expr;
 
-			parser_skip(p);
-			while (p->tok.type != TOKEN_TYPE_RPAREN) {
-				assert(call->as.call.args_count < ARGS_CAPACITY);
+			/* Method calls pass the value before the colon first */
+			size_t base = p->list_size;
+			if (arg != NULL) {
+				parser_list_push(p, arg);
+				arg = NULL;
+			}
 
-				call->as.call.args[call->as.call.args_count ++] = parse_expr(p);
+			parser_advance(p);
+			while (p->tok.type != TOKEN_TYPE_RPAREN) {
+				parser_list_push(p, parse_expr(p));
 
 				if (p->tok.type == TOKEN_TYPE_RPAREN)
 					break;
 				else if (p->tok.type != TOKEN_TYPE_COMMA)
 					error(p->tok.where, "Expected ',', got '%s'", token_type_to_cstr(p->tok.type));
 
-				parser_skip(p);
+				parser_advance(p);
 			}
 
-			parser_skip(p);
+			parser_advance(p);
+			call->as.call.args = (expr_t**)parser_list_end(p, base, &call->as.call.args_count);
+			expr = call;
+		} else if (p->tok.type == TOKEN_TYPE_DOT) {
+			if (arg != NULL)
+				error(expr->where, "Invalid method call");
 
-			if (arg != NULL) {
-				for (size_t i = call->as.call.args_count ++; i --> 0;)
-					call->as.call.args[i + 1] = call->as.call.args[i];
+			expr_t *idx      = expr_new(p->arena);
+			idx->where       = p->tok.where;
+			idx->type        = EXPR_TYPE_IDX;
+			idx->as.idx.expr = expr;
 
-				call->as.call.args[0] = arg;
-				arg = NULL;
-			}
-			expr = call;
+			parser_advance(p);
+			if (p->tok.type != TOKEN_TYPE_ID)
+				error(p->tok.where, "Expected field name, got '%s'",
+				      token_type_to_cstr(p->tok.type));
+
+			/* The name of the field is the index */
+			idx->as.idx.start = parse_expr_str(p);
+			expr = idx;
 		} else {
 			if (arg != NULL)
 				error(expr->where, "Invalid method call");
 
-			expr_t *idx      = expr_new();
+			expr_t *idx      = expr_new(p->arena);
 			idx->where       = p->tok.where;
 			idx->type        = EXPR_TYPE_IDX;
 			idx->as.idx.expr = expr;
 
-			parser_skip(p);
+			parser_advance(p);
 			idx->as.idx.start = parse_expr(p);
 
 			if (p->tok.type == TOKEN_TYPE_COMMA) {
-				parser_skip(p);
+				parser_advance(p);
 				idx->as.idx.end = parse_expr(p);
 			}
 
@@ -366,7 +499,7 @@ colon:
 				error(p->tok.where, "Expected matching ']', got '%s'",
 				      token_type_to_cstr(p->tok.type));
 
-			parser_skip(p);
+			parser_advance(p);
 			expr = idx;
 		}
 	}
@@ -385,9 +518,9 @@ static expr_t *parse_expr_pow(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_POW) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -404,12 +537,12 @@ static expr_t *parse_expr_pow(parser_t *p) {
 static expr_t *parse_expr_un_op(parser_t *p) {
 	if (p->tok.type == TOKEN_TYPE_ADD || p->tok.type == TOKEN_TYPE_SUB ||
 	    p->tok.type == TOKEN_TYPE_NOT) {
-		expr_t *node        = expr_new();
+		expr_t *node        = expr_new(p->arena);
 		node->type          = EXPR_TYPE_UN_OP;
 		node->where         = p->tok.where;
 		node->as.un_op.type = token_type_to_un_op_type(p->tok.type);
 
-		parser_skip(p);
+		parser_advance(p);
 		node->as.un_op.expr = parse_expr_pow(p);
 
 		return node;
@@ -423,9 +556,9 @@ static expr_t *parse_expr_term(parser_t *p) {
 	while (p->tok.type == TOKEN_TYPE_MUL || p->tok.type == TOKEN_TYPE_DIV ||
 	       p->tok.type == TOKEN_TYPE_MOD) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -444,9 +577,9 @@ static expr_t *parse_expr_arith(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_ADD || p->tok.type == TOKEN_TYPE_SUB) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -465,9 +598,9 @@ static expr_t *parse_expr_in(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_IN) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -499,9 +632,9 @@ static expr_t *parse_expr_comp(parser_t *p) {
 
 	while (token_type_is_comp(p->tok.type)) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -520,9 +653,9 @@ static expr_t *parse_expr_logic(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_AND || p->tok.type == TOKEN_TYPE_OR) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -541,9 +674,9 @@ static expr_t *parse_expr_range(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_RANGE || p->tok.type == TOKEN_TYPE_ERANGE) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -563,9 +696,9 @@ static expr_t *parse_expr_inc(parser_t *p) {
 	while (p->tok.type == TOKEN_TYPE_INC || p->tok.type == TOKEN_TYPE_XINC ||
 	       p->tok.type == TOKEN_TYPE_DEC || p->tok.type == TOKEN_TYPE_XDEC) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
@@ -584,15 +717,15 @@ static expr_t *parse_expr_assign(parser_t *p) {
 
 	while (p->tok.type == TOKEN_TYPE_ASSIGN) {
 		token_t tok = p->tok;
-		parser_skip(p);
+		parser_advance(p);
 
-		expr_t *node = expr_new();
+		expr_t *node = expr_new(p->arena);
 		node->type  = EXPR_TYPE_BIN_OP;
 		node->where = tok.where;
 
 		/*if (token_type_is_bin_op(p->tok.type)) {
 			node->as.bin_op.type = token_type_to_bin_op_type(p->tok.type);
-			parser_skip(p);
+			parser_advance(p);
 		} else
 			node->as.bin_op.type = BIN_OP_ASSIGN;*/
 
@@ -611,7 +744,7 @@ static expr_t *parse_expr(parser_t *p) {
 }
 
 static stmt_t *parse_stmt_expr(parser_t *p) {
-	stmt_t *stmt  = stmt_new();
+	stmt_t *stmt  = stmt_new(p->arena);
 	stmt->type    = STMT_TYPE_EXPR;
 	stmt->where   = p->tok.where;
 	stmt->as.expr = parse_expr(p);
@@ -620,13 +753,13 @@ static stmt_t *parse_stmt_expr(parser_t *p) {
 }
 
 static stmt_t *parse_stmt_let(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_LET;
 	stmt->where  = p->tok.where;
 
 	stmt->as.let.const_ = p->tok.type == TOKEN_TYPE_CONST;
 
-	parser_skip(p);
+	parser_advance(p);
 	if (p->tok.type != TOKEN_TYPE_ID)
 		error(p->tok.where, "Expected identifier, got '%s'", token_type_to_cstr(p->tok.type));
 
@@ -634,7 +767,7 @@ static stmt_t *parse_stmt_let(parser_t *p) {
 
 	parser_advance(p);
 	if (p->tok.type == TOKEN_TYPE_ASSIGN) {
-		parser_skip(p);
+		parser_advance(p);
 		stmt->as.let.val = parse_expr(p);
 	}
 
@@ -645,11 +778,11 @@ static stmt_t *parse_stmt_let(parser_t *p) {
 }
 
 static stmt_t *parse_stmt_enum(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_ENUM;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	if (p->tok.type != TOKEN_TYPE_ID)
 		error(p->tok.where, "Expected identifier, got '%s'", token_type_to_cstr(p->tok.type));
 
@@ -683,24 +816,24 @@ static stmt_t *parse_stmts(parser_t *p) {
 	}
 
 	if (p->tok.type == TOKEN_TYPE_END)
-		parser_skip(p);
+		parser_advance(p);
 
 	return stmts;
 }
 
 static stmt_t *parse_stmt_if(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_IF;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.if_.cond = parse_expr(p);
 	stmt->as.if_.body = parse_stmts(p);
 
 	if (p->tok.type == TOKEN_TYPE_ELIF)
 		stmt->as.if_.next = parse_stmt_if(p);
 	else if (p->tok.type == TOKEN_TYPE_ELSE) {
-		parser_skip(p);
+		parser_advance(p);
 		stmt->as.if_.else_ = parse_stmts(p);
 	}
 
@@ -708,52 +841,58 @@ static stmt_t *parse_stmt_if(parser_t *p) {
 }
 
 static stmt_t *parse_stmt_while(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_WHILE;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.while_.cond = parse_expr(p);
+
+	++ p->loops;
 	stmt->as.while_.body = parse_stmts(p);
+	-- p->loops;
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_for(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_FOR;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.for_.init = parse_stmt(p);
 
 	if (p->tok.type != TOKEN_TYPE_SEMICOLON)
 		error(p->tok.where, "Expected ';', got '%s'", token_type_to_cstr(p->tok.type));
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.for_.cond = parse_expr(p);
 
 	if (p->tok.type != TOKEN_TYPE_SEMICOLON)
 		error(p->tok.where, "Expected ';', got '%s'", token_type_to_cstr(p->tok.type));
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.for_.step = parse_stmt(p);
+
+	++ p->loops;
 	stmt->as.for_.body = parse_stmts(p);
+	-- p->loops;
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_foreach(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_FOREACH;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	char *name = p->tok.data;
 
 	parser_advance(p);
 	if (p->tok.type == TOKEN_TYPE_COMMA) {
-		parser_skip(p);
+		parser_advance(p);
 		stmt->as.foreach.it   = name;
 		stmt->as.foreach.name = p->tok.data;
 		parser_advance(p);
@@ -763,71 +902,139 @@ static stmt_t *parse_stmt_foreach(parser_t *p) {
 	if (p->tok.type != TOKEN_TYPE_IN)
 		error(p->tok.where, "Expected 'in', got '%s'", token_type_to_cstr(p->tok.type));
 
-	parser_skip(p);
-	stmt->as.foreach.in   = parse_expr(p);
+	parser_advance(p);
+	stmt->as.foreach.in = parse_expr(p);
+
+	++ p->loops;
 	stmt->as.foreach.body = parse_stmts(p);
+	-- p->loops;
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_return(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_RETURN;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.return_.expr = parse_expr(p);
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_defer(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_DEFER;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
+
+	size_t loops = p->loops;
+	p->loops = 0;
 	stmt->as.defer.stmt = parse_stmt(p);
+	p->loops = loops;
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_break(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_BREAK;
 	stmt->where  = p->tok.where;
-	parser_skip(p);
+	parser_advance(p);
+
+	if (p->loops == 0)
+		error(stmt->where, "Unexpected break");
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_continue(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_CONTINUE;
 	stmt->where  = p->tok.where;
-	parser_skip(p);
+	parser_advance(p);
+
+	if (p->loops == 0)
+		error(stmt->where, "Unexpected continue");
 
 	return stmt;
 }
 
 static stmt_t *parse_stmt_fun(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_FUN;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.fun.name = p->tok.data;
 	stmt->as.fun.def  = parse_expr_fun(p);
 
 	return stmt;
 }
 
+/* Records are defined by their constructor, a function that takes the fields in order and
+   returns a new record of them */
+static stmt_t *parse_stmt_record(parser_t *p) {
+	stmt_t *stmt = stmt_new(p->arena);
+	stmt->type   = STMT_TYPE_FUN;
+	stmt->where  = p->tok.where;
+
+	parser_advance(p);
+	if (p->tok.type != TOKEN_TYPE_ID)
+		error(p->tok.where, "Expected record name, got '%s'", token_type_to_cstr(p->tok.type));
+
+	expr_t *def = expr_new(p->arena);
+	def->where  = p->tok.where;
+	def->type   = EXPR_TYPE_FUN;
+
+	stmt->as.fun.name = p->tok.data;
+	stmt->as.fun.def  = def;
+
+	parser_advance(p);
+	parse_fun_args(p, &def->as.fun);
+
+	value_shape_t *shape = (value_shape_t*)arena_alloc(p->arena, sizeof(value_shape_t));
+	shape->name   = stmt->as.fun.name;
+	shape->fields = def->as.fun.args;
+	shape->size   = def->as.fun.args_count;
+
+	expr_t *rec = expr_new(p->arena);
+	rec->where  = def->where;
+	rec->type   = EXPR_TYPE_REC;
+
+	rec->as.rec.shape  = shape;
+	rec->as.rec.fields = (expr_t**)arena_alloc(p->arena, sizeof(expr_t*) * shape->size);
+	for (size_t i = 0; i < shape->size; ++ i) {
+		for (size_t j = 0; j < i; ++ j) {
+			if (strcmp(shape->fields[i], shape->fields[j]) == 0)
+				error(def->where, "Field '%s' of record '%s' declared twice",
+				      shape->fields[i], shape->name);
+		}
+
+		expr_t *field = expr_new(p->arena);
+		field->where      = def->where;
+		field->type       = EXPR_TYPE_ID;
+		field->as.id.name = shape->fields[i];
+		rec->as.rec.fields[i] = field;
+	}
+
+	stmt_t *return_ = stmt_new(p->arena);
+	return_->type   = STMT_TYPE_RETURN;
+	return_->where  = def->where;
+	return_->as.return_.expr = rec;
+
+	def->as.fun.body = return_;
+	return stmt;
+}
+
 static stmt_t *parse_stmt_import(parser_t *p) {
-	stmt_t *stmt = stmt_new();
+	stmt_t *stmt = stmt_new(p->arena);
 	stmt->type   = STMT_TYPE_IMPORT;
 	stmt->where  = p->tok.where;
 
-	parser_skip(p);
+	parser_advance(p);
 	stmt->as.import.path = p->tok.data;
 
 	parser_advance(p);
@@ -851,6 +1058,7 @@ static stmt_t *parse_stmt(parser_t *p) {
 	case TOKEN_TYPE_BREAK:    return parse_stmt_break(p);
 	case TOKEN_TYPE_CONTINUE: return parse_stmt_continue(p);
 	case TOKEN_TYPE_FUN:      return parse_stmt_fun(p);
+	case TOKEN_TYPE_RECORD:   return parse_stmt_record(p);
 	case TOKEN_TYPE_IMPORT:   return parse_stmt_import(p);
 
 	default: return parse_stmt_expr(p);
@@ -859,10 +1067,11 @@ static stmt_t *parse_stmt(parser_t *p) {
 	return NULL;
 }
 
-stmt_t *parse(const char *str, const char *path) {
+stmt_t *parse(const char *str, const char *path, arena_t *arena) {
 	parser_t p = {0};
+	p.arena    = arena;
 
-	lexer_init(&p.l, str, path);
+	lexer_init(&p.l, str, path, arena);
 
 	p.tok.type = !TOKEN_TYPE_EOF;
 	parser_advance(&p);
@@ -879,5 +1088,6 @@ stmt_t *parse(const char *str, const char *path) {
 		}
 	}
 
+	free(p.list);
 	return program;
 }
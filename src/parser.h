@@ -1,19 +1,31 @@
 #ifndef PARSER_H_HEADER_GUARD
 #define PARSER_H_HEADER_GUARD
 
-#include <stdlib.h> /* atof */
+#include <stdlib.h> /* atof, realloc, free */
+#include <string.h> /* memcpy */
 
 #include "common.h"
 #include "error.h"
 #include "lexer.h"
 #include "token.h"
 #include "node.h"
+#include "arena.h"
 
 typedef struct {
-	lexer_t l;
-	token_t tok;
+	lexer_t  l;
+	token_t  tok;
+	arena_t *arena;
+
+	/* Items of the lists being parsed, nested lists go on top of the ones they are in */
+	void **list;
+	size_t list_size, list_cap;
+
+	/* Loops around the statement being parsed. Function bodies and deferred statements start
+	   from none, so 'break' and 'continue' can not leave them */
+	size_t loops;
 } parser_t;
 
-stmt_t *parse(const char *str, const char *path);
+/* The nodes and every string they point to are allocated in the arena */
+stmt_t *parse(const char *str, const char *path, arena_t *arena);
 
 #endif
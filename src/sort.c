@@ -0,0 +1,185 @@
+#include "sort.h"
+
+/* Ranges this short are left to the insertion sort */
+#define SORT_SMALL   16
+#define SORT_NINTHER 128 /* Ranges above this take the median of 3 medians as the pivot */
+
+#define SWAP(TYPE, A, B) \
+	do {                 \
+		TYPE tmp_ = (A); \
+		(A) = (B);       \
+		(B) = tmp_;      \
+	} while (0)
+
+/* Defines NAME(xs, size, ctx) sorting an array of TYPE, where LESS(ctx, a, b) tells if a goes
+   before b */
+#define SORT_DEFINE(NAME, TYPE, LESS)                                                          \
+	static void NAME##_insertion(TYPE *xs, size_t size, void *ctx) {                           \
+		for (size_t i = 1; i < size; ++ i) {                                                   \
+			TYPE   x = xs[i];                                                                  \
+			size_t j = i;                                                                      \
+			for (; j > 0 && LESS(ctx, x, xs[j - 1]); -- j)                                     \
+				xs[j] = xs[j - 1];                                                             \
+                                                                                               \
+			xs[j] = x;                                                                         \
+		}                                                                                      \
+	}                                                                                          \
+                                                                                               \
+	static void NAME##_sift(TYPE *xs, size_t root, size_t size, void *ctx) {                   \
+		for (;;) {                                                                             \
+			size_t child = root * 2 + 1;                                                       \
+			if (child >= size)                                                                 \
+				return;                                                                        \
+                                                                                               \
+			if (child + 1 < size && LESS(ctx, xs[child], xs[child + 1]))                       \
+				++ child;                                                                      \
+                                                                                               \
+			if (!LESS(ctx, xs[root], xs[child]))                                               \
+				return;                                                                        \
+                                                                                               \
+			SWAP(TYPE, xs[root], xs[child]);                                                   \
+			root = child;                                                                      \
+		}                                                                                      \
+	}                                                                                          \
+                                                                                               \
+	static void NAME##_heap(TYPE *xs, size_t size, void *ctx) {                                \
+		for (size_t i = size / 2; i -- > 0;)                                                   \
+			NAME##_sift(xs, i, size, ctx);                                                     \
+                                                                                               \
+		for (size_t end = size; end -- > 1;) {                                                 \
+			SWAP(TYPE, xs[0], xs[end]);                                                        \
+			NAME##_sift(xs, 0, end, ctx);                                                      \
+		}                                                                                      \
+	}                                                                                          \
+                                                                                               \
+	static size_t NAME##_median(TYPE *xs, size_t a, size_t b, size_t c, void *ctx) {           \
+		if (LESS(ctx, xs[a], xs[b]))                                                           \
+			return LESS(ctx, xs[b], xs[c])? b : LESS(ctx, xs[a], xs[c])? c : a;                \
+		else                                                                                   \
+			return LESS(ctx, xs[a], xs[c])? a : LESS(ctx, xs[b], xs[c])? c : b;                \
+	}                                                                                          \
+                                                                                               \
+	/* Partitions around the first element and gives where it ends up */                       \
+	static size_t NAME##_partition(TYPE *xs, size_t size, void *ctx) {                         \
+		size_t i = 0, j = size;                                                                \
+		for (;;) {                                                                             \
+			do ++ i; while (i < size && LESS(ctx, xs[i], xs[0]));                              \
+			do -- j; while (j > 0    && LESS(ctx, xs[0], xs[j]));                              \
+			if (i >= j)                                                                        \
+				break;                                                                         \
+                                                                                               \
+			SWAP(TYPE, xs[i], xs[j]);                                                          \
+		}                                                                                      \
+                                                                                               \
+		SWAP(TYPE, xs[0], xs[j]);                                                              \
+		return j;                                                                              \
+	}                                                                                          \
+                                                                                               \
+	static void NAME##_intro(TYPE *xs, size_t size, size_t depth, void *ctx) {                 \
+		while (size > SORT_SMALL) {                                                            \
+			if (depth -- == 0) {                                                               \
+				NAME##_heap(xs, size, ctx);                                                    \
+				return;                                                                        \
+			}                                                                                  \
+                                                                                               \
+			size_t last = size - 1, mid = size / 2, pivot;                                     \
+			if (size > SORT_NINTHER) {                                                         \
+				size_t step = size / 8;                                                        \
+				pivot = NAME##_median(xs,                                                      \
+				                      NAME##_median(xs, 0, step, step * 2, ctx),               \
+				                      NAME##_median(xs, mid - step, mid, mid + step, ctx),     \
+				                      NAME##_median(xs, last - step * 2, last - step, last,    \
+				                                    ctx), ctx);                                \
+			} else                                                                             \
+				pivot = NAME##_median(xs, 0, mid, last, ctx);                                  \
+                                                                                               \
+			SWAP(TYPE, xs[0], xs[pivot]);                                                      \
+			size_t at = NAME##_partition(xs, size, ctx);                                       \
+                                                                                               \
+			/* The shorter side is sorted first, so the recursion stays shallow */             \
+			if (at < size - at - 1) {                                                          \
+				NAME##_intro(xs, at, depth, ctx);                                              \
+				xs   += at + 1;                                                                \
+				size -= at + 1;                                                                \
+			} else {                                                                           \
+				NAME##_intro(xs + at + 1, size - at - 1, depth, ctx);                          \
+				size = at;                                                                     \
+			}                                                                                  \
+		}                                                                                      \
+                                                                                               \
+		NAME##_insertion(xs, size, ctx);                                                       \
+	}                                                                                          \
+                                                                                               \
+	static void NAME(TYPE *xs, size_t size, void *ctx) {                                       \
+		size_t ascending = 1, descending = 1;                                                  \
+		for (size_t i = 1; i < size; ++ i) {                                                   \
+			bool less   = LESS(ctx, xs[i], xs[i - 1]);                                         \
+			ascending  += !less;                                                               \
+			descending +=  less;                                                               \
+			if (ascending < i + 1 && descending < i + 1)                                       \
+				break;                                                                         \
+		}                                                                                      \
+                                                                                               \
+		if (ascending >= size)                                                                 \
+			return;                                                                            \
+		else if (descending >= size) {                                                         \
+			/* Strictly descending, so reversing it keeps nothing equal out of order */        \
+			for (size_t i = 0; i < size / 2; ++ i)                                             \
+				SWAP(TYPE, xs[i], xs[size - i - 1]);                                           \
+                                                                                               \
+			return;                                                                            \
+		}                                                                                      \
+                                                                                               \
+		size_t depth = 0;                                                                      \
+		for (size_t n = size; n > 1; n /= 2)                                                   \
+			depth += 2;                                                                        \
+                                                                                               \
+		NAME##_intro(xs, size, depth, ctx);                                                    \
+	}
+
+#define NUM_LESS(CTX, A, B) ((void)(CTX), (A) < (B))
+SORT_DEFINE(sort_nums_by, double, NUM_LESS)
+
+void sort_nums(double *xs, size_t size) {
+	sort_nums_by(xs, size, NULL);
+}
+
+/* Bytes only have 256 values, so they are counted instead */
+void sort_bytes(unsigned char *xs, size_t size) {
+	size_t counts[256];
+	memset(counts, 0, sizeof(counts));
+	for (size_t i = 0; i < size; ++ i)
+		++ counts[xs[i]];
+
+	size_t at = 0;
+	for (size_t byte = 0; byte < 256; ++ byte) {
+		memset(xs + at, (int)byte, counts[byte]);
+		at += counts[byte];
+	}
+}
+
+bool str_less(value_t a, value_t b) {
+	size_t a_len = value_str_len(a), b_len = value_str_len(b);
+	int    cmp   = memcmp(value_str_buf(&a), value_str_buf(&b), a_len < b_len? a_len : b_len);
+	return cmp < 0 || (cmp == 0 && a_len < b_len);
+}
+
+#define STR_LESS(CTX, A, B) ((void)(CTX), str_less(A, B))
+SORT_DEFINE(sort_strs_by, value_t, STR_LESS)
+
+void sort_strs(value_t *xs, size_t size) {
+	sort_strs_by(xs, size, NULL);
+}
+
+typedef struct {
+	sort_less_t less;
+	void       *ctx;
+} by_idx_t;
+
+#define IDX_LESS(CTX, A, B) ((by_idx_t*)(CTX))->less(((by_idx_t*)(CTX))->ctx, A, B)
+SORT_DEFINE(sort_idxs_by, size_t, IDX_LESS)
+
+void sort_idxs(size_t *idxs, size_t size, sort_less_t less, void *ctx) {
+	by_idx_t by = {.less = less, .ctx = ctx};
+	sort_idxs_by(idxs, size, &by);
+}
@@ -0,0 +1,26 @@
+#ifndef SORT_H_HEADER_GUARD
+#define SORT_H_HEADER_GUARD
+
+#include <stddef.h> /* size_t */
+#include <string.h> /* memcmp, memset */
+
+#include "common.h"
+#include "value.h"
+
+/* Introsort for the 'sort' builtin: quicksort with a median of 3 (or 9) pivot, insertion sort
+   for short ranges, and heapsort once the partitions go too deep. Runs that are already sorted
+   or reversed are handled in one pass. The partitions never leave the range, even when the
+   order is not consistent, like with NaNs or a bad comparator */
+
+typedef bool (*sort_less_t)(void *ctx, size_t a, size_t b);
+
+void sort_nums( double        *xs, size_t size);
+void sort_bytes(unsigned char *xs, size_t size);
+void sort_strs( value_t       *xs, size_t size); /* By their bytes, a prefix comes first */
+
+/* Sorts indexes of elements that only the comparator knows about */
+void sort_idxs(size_t *idxs, size_t size, sort_less_t less, void *ctx);
+
+bool str_less(value_t a, value_t b);
+
+#endif
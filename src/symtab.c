@@ -0,0 +1,82 @@
+#include "symtab.h"
+
+static size_t hash_cstr(const char *str) {
+	/* FNV-1a */
+	size_t hash = 2166136261u;
+	for (; *str != '\0'; ++ str) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+void symtab_init(symtab_t *tab) {
+	memset(tab, 0, sizeof(*tab));
+
+	tab->cap   = 64;
+	tab->names = (char**)malloc(sizeof(char*) * tab->cap);
+	if (tab->names == NULL)
+		UNREACHABLE("malloc() fail");
+
+	tab->buckets_cap = 128;
+	tab->buckets     = (uint32_t*)calloc(tab->buckets_cap, sizeof(uint32_t));
+	if (tab->buckets == NULL)
+		UNREACHABLE("malloc() fail");
+}
+
+void symtab_deinit(symtab_t *tab) {
+	for (size_t i = 0; i < tab->count; ++ i)
+		free(tab->names[i]);
+
+	free(tab->names);
+	free(tab->buckets);
+}
+
+static uint32_t *symtab_bucket(symtab_t *tab, const char *name) {
+	size_t mask = tab->buckets_cap - 1;
+	for (size_t i = hash_cstr(name) & mask;; i = (i + 1) & mask) {
+		uint32_t *bucket = tab->buckets + i;
+		if (*bucket == 0 || strcmp(tab->names[*bucket - 1], name) == 0)
+			return bucket;
+	}
+}
+
+static void symtab_grow(symtab_t *tab) {
+	free(tab->buckets);
+
+	tab->buckets_cap *= 2;
+	tab->buckets      = (uint32_t*)calloc(tab->buckets_cap, sizeof(uint32_t));
+	if (tab->buckets == NULL)
+		UNREACHABLE("malloc() fail");
+
+	for (size_t i = 0; i < tab->count; ++ i)
+		*symtab_bucket(tab, tab->names[i]) = i + 1;
+}
+
+uint32_t symtab_find(symtab_t *tab, const char *name) {
+	uint32_t *bucket = symtab_bucket(tab, name);
+	return *bucket == 0? SYM_NONE : *bucket - 1;
+}
+
+uint32_t symtab_intern(symtab_t *tab, const char *name) {
+	uint32_t *bucket = symtab_bucket(tab, name);
+	if (*bucket != 0)
+		return *bucket - 1;
+
+	if (tab->count >= tab->cap) {
+		tab->cap  *= 2;
+		tab->names = (char**)realloc(tab->names, sizeof(char*) * tab->cap);
+		if (tab->names == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	tab->names[tab->count] = strcpy_to_heap(name);
+	*bucket = ++ tab->count;
+
+	/* Keep the load factor under a half */
+	if (tab->count * 2 > tab->buckets_cap)
+		symtab_grow(tab);
+
+	return tab->count - 1;
+}
@@ -0,0 +1,29 @@
+#ifndef SYMTAB_H_HEADER_GUARD
+#define SYMTAB_H_HEADER_GUARD
+
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* strcmp, memset */
+#include <stdint.h> /* uint32_t */
+
+#include "common.h"
+
+/* Every variable name gets a small integer symbol, so variables can be bound and looked up by
+   index instead of comparing names */
+
+#define SYM_NONE UINT32_MAX
+
+typedef struct {
+	char  **names; /* Indexed by the symbol, owned by the table */
+	size_t  count, cap;
+
+	uint32_t *buckets; /* Open addressing index of the names, holds symbol + 1 or 0 when empty */
+	size_t    buckets_cap;
+} symtab_t;
+
+void symtab_init(  symtab_t *tab);
+void symtab_deinit(symtab_t *tab);
+
+uint32_t symtab_intern(symtab_t *tab, const char *name);
+uint32_t symtab_find(  symtab_t *tab, const char *name); /* SYM_NONE if it was never interned */
+
+#endif
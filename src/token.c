@@ -1,12 +1,5 @@
 #include "token.h"
 
-void token_free(token_t *tok) {
-	if (tok->data != NULL) {
-		free(tok->data);
-		tok->data = NULL;
-	}
-}
-
 static const char *token_type_to_cstr_map[TOKEN_TYPE_COUNT] = {
 	[TOKEN_TYPE_EOF] = "end of file",
 
@@ -35,6 +28,7 @@ static const char *token_type_to_cstr_map[TOKEN_TYPE_COUNT] = {
 	[TOKEN_TYPE_RETURN]   = "return",
 	[TOKEN_TYPE_DEFER]    = "defer",
 	[TOKEN_TYPE_FUN]      = "fun",
+	[TOKEN_TYPE_RECORD]   = "record",
 	[TOKEN_TYPE_BREAK]    = "break",
 	[TOKEN_TYPE_CONTINUE] = "continue",
 
@@ -65,18 +59,21 @@ static const char *token_type_to_cstr_map[TOKEN_TYPE_COUNT] = {
 	[TOKEN_TYPE_RANGE]  = "..",
 	[TOKEN_TYPE_ERANGE] = "..!",
 	[TOKEN_TYPE_COLON]  = ":",
+	[TOKEN_TYPE_DOT]    = ".",
 
 	[TOKEN_TYPE_LPAREN]    = "(",
 	[TOKEN_TYPE_RPAREN]    = ")",
 	[TOKEN_TYPE_LSQUARE]   = "[",
 	[TOKEN_TYPE_RSQUARE]   = "]",
+	[TOKEN_TYPE_LCURLY]    = "{",
+	[TOKEN_TYPE_RCURLY]    = "}",
 	[TOKEN_TYPE_COMMA]     = ",",
 	[TOKEN_TYPE_SEMICOLON] = ";",
 
 	[TOKEN_TYPE_ERR] = "error",
 };
 
-static_assert(TOKEN_TYPE_COUNT == 57); /* Add the new token type to the map */
+static_assert(TOKEN_TYPE_COUNT == 61); /* Add the new token type to the map */
 
 bool token_type_is_bin_op(token_type_t type) {
 	switch (type) {
@@ -113,9 +110,36 @@ const char *token_type_to_cstr(token_type_t type) {
 	return token_type_to_cstr_map[type];
 }
 
+static const char **paths;
+static size_t        paths_count, paths_cap;
+
+uint16_t where_file(const char *path) {
+	for (size_t i = 0; i < paths_count; ++ i) {
+		if (strcmp(paths[i], path) == 0)
+			return i;
+	}
+
+	assert(paths_count < UINT16_MAX);
+	if (paths_count >= paths_cap) {
+		paths_cap = paths_cap == 0? 8 : paths_cap * 2;
+		paths     = (const char**)realloc(paths, sizeof(const char*) * paths_cap);
+		if (paths == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	paths[paths_count] = path;
+	return paths_count ++;
+}
+
+const char *where_path(where_t where) {
+	assert(where.file < paths_count);
+	return paths[where.file];
+}
+
 token_t token_new(char *data, token_type_t type, where_t where) {
 	return (token_t){
 		.data  = data,
+		.len   = data == NULL? 0 : strlen(data),
 		.type  = type,
 		.where = where,
 	};
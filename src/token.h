@@ -2,7 +2,8 @@
 #define TOKEN_H_HEADER_GUARD
 
 #include <assert.h> /* static_assert */
-#include <stdlib.h> /* free */
+#include <stdint.h> /* uint16_t, uint32_t, UINT16_MAX */
+#include <string.h> /* strcmp, strlen */
 
 #include "common.h"
 
@@ -34,6 +35,7 @@ typedef enum {
 	TOKEN_TYPE_RETURN,
 	TOKEN_TYPE_DEFER,
 	TOKEN_TYPE_FUN,
+	TOKEN_TYPE_RECORD,
 	TOKEN_TYPE_BREAK,
 	TOKEN_TYPE_CONTINUE,
 
@@ -64,11 +66,14 @@ typedef enum {
 	TOKEN_TYPE_RANGE,
 	TOKEN_TYPE_ERANGE,
 	TOKEN_TYPE_COLON,
+	TOKEN_TYPE_DOT,
 
 	TOKEN_TYPE_LPAREN,
 	TOKEN_TYPE_RPAREN,
 	TOKEN_TYPE_LSQUARE,
 	TOKEN_TYPE_RSQUARE,
+	TOKEN_TYPE_LCURLY,
+	TOKEN_TYPE_RCURLY,
 	TOKEN_TYPE_COMMA,
 	TOKEN_TYPE_SEMICOLON,
 
@@ -82,19 +87,23 @@ const char *token_type_to_cstr(token_type_t type);
 bool token_type_is_bin_op(   token_type_t type);
 bool token_type_is_stmts_end(token_type_t type);
 
+/* Locations refer to their file by its index in a table of paths, so they fit in 8 bytes */
 typedef struct {
-	const char *path;
-	int         row, col;
+	uint32_t row;
+	uint16_t col;
+	uint16_t file;
 } where_t;
 
+uint16_t    where_file(const char *path); /* Adds the path to the table if it is not there */
+const char *where_path(where_t where);
+
 typedef struct {
 	char        *data;
+	size_t       len; /* Of the data, string literals can have zero bytes in them */
 	token_type_t type;
 	where_t      where;
 } token_t;
 
-void token_free(token_t *tok);
-
 token_t token_new(char *data, token_type_t type, where_t where);
 token_t token_new_eof(where_t where);
 token_t token_new_err(char *msg, where_t where);
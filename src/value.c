@@ -8,9 +8,13 @@ static const char *value_type_to_cstr_map[] = {
 	[VALUE_TYPE_FUN]  = "function",
 	[VALUE_TYPE_NAT]  = "native",
 	[VALUE_TYPE_ARR]  = "array",
+	[VALUE_TYPE_MAP]  = "map",
+	[VALUE_TYPE_REC]  = "record",
+	[VALUE_TYPE_U8S]  = "u8 array",
+	[VALUE_TYPE_F64S] = "f64 array",
 };
 
-static_assert(VALUE_TYPE_COUNT == 7); /* Add the new value type to the map */
+static_assert(VALUE_TYPE_COUNT == 11); /* Add the new value type to the map */
 
 const char *value_type_to_cstr(value_type_t type) {
 	if (type >= VALUE_TYPE_COUNT)
@@ -19,49 +23,96 @@ const char *value_type_to_cstr(value_type_t type) {
 	return value_type_to_cstr_map[type];
 }
 
-value_t value_nil(void) {
-	return (value_t){.type = VALUE_TYPE_NIL};
-}
+const value_type_t value_tag_types[16] = {
+	[VALUE_TAG_NIL]  = VALUE_TYPE_NIL,
+	[VALUE_TAG_STR]  = VALUE_TYPE_STR,
+	[VALUE_TAG_ARR]  = VALUE_TYPE_ARR,
+	[VALUE_TAG_FUN]  = VALUE_TYPE_FUN,
+	[VALUE_TAG_NAT]  = VALUE_TYPE_NAT,
+	[VALUE_TAG_BOOL] = VALUE_TYPE_BOOL,
+	[VALUE_TAG_MAP]  = VALUE_TYPE_MAP,
 
-value_t value_num(double val) {
-	return (value_t){.type = VALUE_TYPE_NUM, .as = {.num = val}};
-}
+	[VALUE_TAG_SHORT_STR] = VALUE_TYPE_STR,
+
+	[VALUE_TAG_INDEX(VALUE_TAG_REC)]  = VALUE_TYPE_REC,
+	[VALUE_TAG_INDEX(VALUE_TAG_U8S)]  = VALUE_TYPE_U8S,
+	[VALUE_TAG_INDEX(VALUE_TAG_F64S)] = VALUE_TYPE_F64S,
+};
+
+uint64_t value_hash_bytes(const char *buf, size_t len) {
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < len; ++ i) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 0x100000001B3;
+	}
 
-value_t value_bool(bool val) {
-	return (value_t){.type = VALUE_TYPE_BOOL, .as = {.bool_ = val}};
+	return hash == 0? 1 : hash;
 }
 
-value_t value_str(char *val) {
-	return (value_t){.type = VALUE_TYPE_STR, .as = {.str = val}};
+uint64_t value_str_hash(value_t val) {
+	if (value_is_short_str(val))
+		return value_hash_bytes(value_str_buf(&val), value_str_len(val));
+
+	value_str_t *str = value_as_str(val);
+	if (str->hash == 0)
+		str->hash = value_hash_bytes(str->buf, str->len);
+
+	return str->hash;
 }
 
-value_t value_fun(void *val) {
-	return (value_t){.type = VALUE_TYPE_FUN, .as = {.fun = val}};
+bool value_str_equal(value_t left, value_t right) {
+	if (left.bits == right.bits)
+		return true;
+	else if (value_str_len(left) != value_str_len(right))
+		return false;
+
+	if (value_is_obj(left) && value_is_obj(right)) {
+		value_str_t *a = value_as_str(left), *b = value_as_str(right);
+		if (VALUE_HEADER(a)->interned && VALUE_HEADER(b)->interned)
+			return false;
+		else if (a->hash != 0 && b->hash != 0 && a->hash != b->hash)
+			return false;
+	}
+
+	return memcmp(value_str_buf(&left), value_str_buf(&right), value_str_len(left)) == 0;
 }
 
-value_t value_nat(value_t (*val)()) {
-	return (value_t){.type = VALUE_TYPE_NAT, .as = {.nat = val}};
+/* Numbers that are equal have to hash the same, so -0 is hashed as 0. The bits are mixed, since
+   whole numbers only differ in their top bits */
+static uint64_t value_key_hash(value_t key) {
+	if (value_type(key) == VALUE_TYPE_STR)
+		return value_str_hash(key);
+
+	uint64_t hash = value_as_num(key) == 0? 0 : key.bits;
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EB;
+	return hash ^ (hash >> 31);
 }
 
-value_t value_arr(size_t size) {
-	value_t val = {0};
-	val.type = VALUE_TYPE_ARR;
+size_t value_map_probe(value_t slots, value_t key) {
+	value_arr_t *arr  = value_as_arr(slots);
+	size_t       mask = arr->size / 2 - 1, i = value_key_hash(key) & mask;
+	bool         str  = value_type(key) == VALUE_TYPE_STR;
 
-	val.as.arr.cap  = ARRAY_CHUNK_SIZE;
-	val.as.arr.size = size;
-	while (val.as.arr.cap < size)
-		val.as.arr.cap *= 2;
+	for (;; i = (i + 1) & mask) {
+		value_t at = arr->buf[i * 2];
+		if (value_type(at) == VALUE_TYPE_NIL)
+			break;
+		else if (value_type(at) != value_type(key))
+			continue;
 
-	val.as.arr.buf = (value_t*)malloc(val.as.arr.cap * sizeof(value_t));
-	if (val.as.arr.buf == NULL)
-		UNREACHABLE("malloc() fail");
+		if (str? value_str_equal(at, key) : value_as_num(at) == value_as_num(key))
+			break;
+	}
 
-	return val;
+	return i;
 }
 
-void value_free(value_t *val) {
-	if (val->type == VALUE_TYPE_STR)
-		free(val->as.str);
-	else if (val->type == VALUE_TYPE_ARR)
-		free(val->as.arr.buf);
+value_t *value_map_find(value_t map, value_t key) {
+	if (value_type(key) != VALUE_TYPE_NUM && value_type(key) != VALUE_TYPE_STR)
+		return NULL;
+
+	value_arr_t *slots = value_as_arr(value_as_map(map)->slots);
+	size_t       i     = value_map_probe(value_as_map(map)->slots, key);
+	return value_type(slots->buf[i * 2]) == VALUE_TYPE_NIL? NULL : slots->buf + i * 2 + 1;
 }
@@ -3,6 +3,9 @@
 
 #include <stdbool.h> /* bool, true, false */
 #include <stdlib.h>  /* free */
+#include <stdint.h>  /* uint32_t, uint64_t, uintptr_t */
+#include <string.h>  /* memcpy */
+#include <stddef.h>  /* offsetof */
 #include <assert.h>  /* static_assert */
 
 #include "common.h"
@@ -15,41 +18,304 @@ typedef enum {
 	VALUE_TYPE_FUN,
 	VALUE_TYPE_NAT,
 	VALUE_TYPE_ARR,
+	VALUE_TYPE_MAP,
+	VALUE_TYPE_REC,
+	VALUE_TYPE_U8S,
+	VALUE_TYPE_F64S,
 
 	VALUE_TYPE_COUNT,
 } value_type_t;
 
 const char *value_type_to_cstr(value_type_t type);
 
-#define ARRAY_CHUNK_SIZE 32
+#define ARRAY_MIN_GROWTH 4 /* Capacity of an array that grows, at the least */
 
+/* Values are NaN-boxed into 8 bytes. Numbers are kept as their bits plus VALUE_NUM_OFFSET, which
+ * moves every double out of the range where the top 16 bits are 0. The rest lives in that range:
+ * pointers, which fit in 48 bits and are 8-byte aligned, with the type as a tag in the low 3 bits,
+ * and booleans above the tag. Nil is all zero bits, so zeroed memory is full of nils. Once the low
+ * bits ran out, the bit above the pointers (VALUE_TAG_EXT) started a second set of tags.
+ *
+ * Strings of up to VALUE_SHORT_STR_MAX bytes are not allocated at all. Their length sits above the
+ * tag and the text in the next bytes, followed by the 2 top bytes, which are 0 and terminate it */
 typedef struct value {
-	value_type_t type;
-
-	union {
-		double         num;
-		char          *str;
-		bool           bool_;
-		void          *fun;
-		struct value (*nat)();
-		struct {
-			struct value *buf;
-			size_t        size, cap;
-		} arr;
-	} as;
+	uint64_t bits;
 } value_t;
 
-static_assert(VALUE_TYPE_COUNT == 7); /* Add new values to union */
+static_assert(sizeof(void*) == sizeof(uint64_t)); /* Pointers are boxed with their tag */
 
-value_t value_nil(void);
+#define VALUE_NUM_OFFSET ((uint64_t)1 << 49)
+#define VALUE_TAG_EXT    ((uint64_t)1 << 48)
+#define VALUE_TAG_MASK   (VALUE_TAG_EXT | 7)
 
-value_t value_num( double    val);
-value_t value_bool(bool      val);
-value_t value_str( char     *val);
-value_t value_fun( void     *val);
-value_t value_nat( value_t (*val)());
-value_t value_arr( size_t    size);
+/* Index of the tag in value_tag_types, the extended tags come after the 8 others */
+#define VALUE_TAG_INDEX(BITS) (((BITS) & 7) | ((BITS) >> 45 & 8))
 
-void value_free(value_t *val);
+#define VALUE_SHORT_STR_MAX 5
+
+/* The text of short strings is read in place, in the order of the bytes in memory */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#	error "Short strings expect a little endian target"
+#endif
+
+enum {
+	VALUE_TAG_NIL = 0,
+	VALUE_TAG_STR,
+	VALUE_TAG_ARR,
+	VALUE_TAG_FUN,
+	VALUE_TAG_NAT,
+	VALUE_TAG_BOOL,
+	VALUE_TAG_SHORT_STR,
+	VALUE_TAG_MAP,
+};
+
+#define VALUE_TAG_REC  (VALUE_TAG_EXT | VALUE_TAG_NIL)
+#define VALUE_TAG_U8S  (VALUE_TAG_EXT | VALUE_TAG_STR)
+#define VALUE_TAG_F64S (VALUE_TAG_EXT | VALUE_TAG_ARR)
+
+typedef struct value (*value_nat_t)();
+
+/* Arrays keep their size and capacity with the elements, behind the pointer of the value. Views
+   (see gc_slice) point into the elements of their parent instead of their own */
+typedef struct {
+	size_t   size, cap;
+	value_t *buf;
+	value_t  parent; /* Nil unless the elements belong to another array */
+	value_t  elems[];
+} value_arr_t;
+
+/* Strings keep their length, so they can hold zero bytes and nothing has to scan them for it.
+   Strings that own their text still terminate it, for the C functions that only read it */
+typedef struct {
+	size_t   len, cap; /* Capacity does not count the terminator */
+	uint64_t hash;     /* 0 until something hashes the string */
+	char    *buf;
+	value_t  parent;   /* Nil unless the text belongs to another string */
+	char     text[];
+} value_str_t;
+
+/* Maps are hash tables with open addressing. Their slots are an array of their own, with every
+   key followed by its value and nil keys in the free slots, so a map stays the same object when
+   it grows. Keys are numbers and strings */
+typedef struct {
+	size_t  size;  /* Of the keys */
+	value_t slots; /* Of a power of 2 capacity */
+} value_map_t;
+
+/* The fields of a record are laid out when it is defined, its shape keeps their names in that
+   order. Shapes belong to the unit of the definition, like functions */
+typedef struct {
+	const char *name;
+	char      **fields;
+	size_t      size;
+} value_shape_t;
+
+typedef struct {
+	const value_shape_t *shape;
+	value_t              fields[];
+} value_rec_t;
+
+/* Packed arrays hold raw bytes (u8 arrays) or doubles (f64 arrays) instead of values, so there is
+   nothing in them for the garbage collector to trace. Their size is fixed, and slices of them are
+   views like the ones of strings */
+typedef struct {
+	size_t  size;   /* Of the elements */
+	char   *buf;
+	value_t parent; /* Nil unless the elements belong to another packed array */
+	char    data[];
+} value_packed_t;
+
+static_assert(offsetof(value_packed_t, data) % sizeof(double) == 0); /* Doubles are aligned */
+
+static_assert(VALUE_TYPE_COUNT == 11); /* Add new values to the tags */
+
+/* Objects (strings, array buffers, maps, records, packed arrays) are allocated right after a
+   header (see gc.c), so the garbage collector gets to its bookkeeping straight from the pointer
+   in the value */
+typedef struct value_header {
+	struct value_header *next; /* Next old object, or the promoted copy of a young one */
+	size_t               size; /* Of the whole allocation */
+	uint32_t             mark; /* Collection that last marked the object */
+	bool                 remembered : 1;
+	bool                 viewed     : 1; /* Views point into its text or elements */
+	bool                 constant   : 1; /* A literal or the key of a map, see gc_share */
+	bool                 interned   : 1; /* In the table of gc_intern */
+	uint8_t              owner;          /* What refers to a string or array, see below */
+} value_header_t;
+
+static_assert(sizeof(value_header_t) % sizeof(double) == 0); /* Keeps the data aligned */
+static_assert(sizeof(value_header_t) == 24);                  /* The flags fit in the padding */
+
+#define VALUE_HEADER(PTR) ((value_header_t*)(PTR) - 1)
+
+/* Strings and arrays that only one place refers to can be appended to in place */
+enum {
+	VALUE_SHARED = 0, /* Stored somewhere, possibly in more than one place */
+	VALUE_OWNED,      /* By the place '++' made it for or a temporary was stored in, and maybe
+	                     temporaries read from it */
+	VALUE_TEMPORARY,  /* By the temporary '+' or 'reserve' made it for, and nothing else */
+};
+
+static inline value_t value_nil(void) {
+	return (value_t){0};
+}
+
+static inline value_t value_num(double val) {
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+
+	/* NaNs with a payload could overflow the offset, only their sign is kept */
+	if (val != val)
+		bits = (bits & 0x8000000000000000) | 0x7FF8000000000000;
+
+	return (value_t){bits + VALUE_NUM_OFFSET};
+}
+
+static inline value_t value_ptr(const void *ptr, uint64_t tag) {
+	assert(((uintptr_t)ptr & VALUE_TAG_MASK) == 0 && (uintptr_t)ptr < VALUE_NUM_OFFSET);
+	return (value_t){(uintptr_t)ptr | tag};
+}
+
+static inline value_t value_bool(bool val) {
+	return (value_t){(uint64_t)val << 3 | VALUE_TAG_BOOL};
+}
+
+static inline value_t value_short_str(const char *str, size_t len) {
+	assert(len <= VALUE_SHORT_STR_MAX);
+	value_t val = {(uint64_t)len << 3 | VALUE_TAG_SHORT_STR};
+	memcpy((char*)&val.bits + 1, str, len);
+	return val;
+}
+
+static inline value_t value_str(value_str_t *val) {return value_ptr(val, VALUE_TAG_STR);}
+static inline value_t value_arr(value_arr_t *val) {return value_ptr(val, VALUE_TAG_ARR);}
+static inline value_t value_map(value_map_t *val) {return value_ptr(val, VALUE_TAG_MAP);}
+static inline value_t value_rec(value_rec_t *val) {return value_ptr(val, VALUE_TAG_REC);}
+
+static inline value_t value_packed(value_packed_t *val, value_type_t type) {
+	return value_ptr(val, type == VALUE_TYPE_U8S? VALUE_TAG_U8S : VALUE_TAG_F64S);
+}
+static inline value_t value_fun(void        *val) {return value_ptr(val, VALUE_TAG_FUN);}
+
+/* Natives are boxed by a pointer to where their function is stored, since function pointers do
+   not have to be aligned */
+static inline value_t value_nat(const value_nat_t *val) {return value_ptr(val, VALUE_TAG_NAT);}
+
+extern const value_type_t value_tag_types[16];
+
+static inline value_type_t value_type(value_t val) {
+	if (val.bits >= VALUE_NUM_OFFSET)
+		return VALUE_TYPE_NUM;
+
+	return value_tag_types[VALUE_TAG_INDEX(val.bits)];
+}
+
+static inline double value_as_num(value_t val) {
+	uint64_t bits = val.bits - VALUE_NUM_OFFSET;
+	double   num;
+	memcpy(&num, &bits, sizeof(num));
+	return num;
+}
+
+static inline void *value_as_ptr(value_t val) {
+	return (void*)(uintptr_t)(val.bits & ~VALUE_TAG_MASK);
+}
+
+static inline bool         value_as_bool(value_t val) {return val.bits >> 3;}
+static inline value_str_t *value_as_str( value_t val) {return (value_str_t*)value_as_ptr(val);}
+static inline value_arr_t *value_as_arr( value_t val) {return (value_arr_t*)value_as_ptr(val);}
+static inline value_map_t *value_as_map( value_t val) {return (value_map_t*)value_as_ptr(val);}
+static inline value_rec_t *value_as_rec( value_t val) {return (value_rec_t*)value_as_ptr(val);}
+
+static inline value_packed_t *value_as_packed(value_t val) {
+	return (value_packed_t*)value_as_ptr(val);
+}
+static inline void        *value_as_fun( value_t val) {return value_as_ptr(val);}
+static inline value_nat_t  value_as_nat( value_t val) {return *(value_nat_t*)value_as_ptr(val);}
+
+static inline bool value_is_short_str(value_t val) {
+	return val.bits < VALUE_NUM_OFFSET && (val.bits & VALUE_TAG_MASK) == VALUE_TAG_SHORT_STR;
+}
+
+/* Types of the values with a header, everything else is copied with the value */
+#define VALUE_OBJ_TYPES (1 << VALUE_TYPE_STR | 1 << VALUE_TYPE_ARR | 1 << VALUE_TYPE_MAP | \
+                         1 << VALUE_TYPE_REC | 1 << VALUE_TYPE_U8S | 1 << VALUE_TYPE_F64S)
+
+static inline bool value_is_obj(value_t val) {
+	return (VALUE_OBJ_TYPES >> value_type(val) & 1) && !value_is_short_str(val);
+}
+
+static inline bool value_is_packed(value_t val) {
+	return value_type(val) == VALUE_TYPE_U8S || value_type(val) == VALUE_TYPE_F64S;
+}
+
+/* Bytes of an element of a packed array */
+static inline size_t value_packed_width(value_t val) {
+	return value_type(val) == VALUE_TYPE_U8S? 1 : sizeof(double);
+}
+
+static inline value_t value_packed_get(value_t val, size_t i) {
+	value_packed_t *packed = value_as_packed(val);
+	if (value_type(val) == VALUE_TYPE_U8S)
+		return value_num((unsigned char)packed->buf[i]);
+
+	double num;
+	memcpy(&num, packed->buf + i * sizeof(double), sizeof(num));
+	return value_num(num);
+}
+
+/* Bytes are truncated, range checks are up to the caller */
+static inline void value_packed_set(value_t val, size_t i, double num) {
+	value_packed_t *packed = value_as_packed(val);
+	if (value_type(val) == VALUE_TYPE_U8S)
+		packed->buf[i] = (char)(unsigned char)num;
+	else
+		memcpy(packed->buf + i * sizeof(double), &num, sizeof(num));
+}
+
+/* Work with both kinds of strings. The text of a short string is inside of the value, so it is
+   only valid as long as the value it was read from */
+static inline size_t value_str_len(value_t val) {
+	return value_is_short_str(val)? (val.bits & 0xFF) >> 3 : value_as_str(val)->len;
+}
+
+static inline const char *value_str_buf(const value_t *val) {
+	return value_is_short_str(*val)? (const char*)&val->bits + 1 : value_as_str(*val)->buf;
+}
+
+/* FNV-1a of the text, never 0. Strings cache theirs until they are changed */
+uint64_t value_hash_bytes(const char *buf, size_t len);
+uint64_t value_str_hash(value_t val);
+
+/* Interned strings are only equal to themselves, and known hashes tell most others apart before
+   their text is compared */
+bool value_str_equal(value_t left, value_t right);
+
+/* Slot of the key in the slots of a map, or of the free slot where it would go. The map always
+   has a free one. Keys are compared by value, like '==' does. Finding gives the value of the key,
+   or NULL if the map does not have it */
+size_t   value_map_probe(value_t slots, value_t key);
+value_t *value_map_find( value_t map,   value_t key);
+
+/* The first slot in use from slot i on, or the capacity. The slots of a map are iterated as they
+   were when the iteration started, a map that grows gets new ones */
+static inline size_t value_map_next(value_t slots, size_t i) {
+	value_arr_t *arr = value_as_arr(slots);
+	while (i * 2 < arr->size && value_type(arr->buf[i * 2]) == VALUE_TYPE_NIL)
+		++ i;
+
+	return i;
+}
+
+/* Has to be called when a value is stored anywhere, since it can then be reached from more than
+   one place and nothing can grow it in place anymore. A temporary only becomes owned by the first
+   place it is stored in. Stores go through gc_share, which copies constants first */
+static inline void value_share(value_t val) {
+	if (!value_is_obj(val))
+		return;
+
+	value_header_t *header = VALUE_HEADER(value_as_ptr(val));
+	header->owner = header->owner == VALUE_TEMPORARY? VALUE_OWNED : VALUE_SHARED;
+}
 
 #endif
@@ -0,0 +1,361 @@
+#include "vm.h"
+
+static const char *cond_msgs[COND_COUNT] = {
+	[COND_IF]    = "if statement condition",
+	[COND_WHILE] = "while statement condition",
+	[COND_FOR]   = "for statement condition",
+};
+
+static_assert(COND_COUNT == 3); /* Add new conditions to the messages */
+
+static const char *decl_name(stmt_t *stmt, uint8_t kind, bool *const_, decl_t **decl) {
+	*const_ = true;
+	switch (kind) {
+	case DECL_LET:
+		*const_ = stmt->as.let.const_;
+		*decl   = &stmt->as.let.decl;
+		return stmt->as.let.name;
+
+	case DECL_ENUM:       *decl = &stmt->as.enum_.decl;     return stmt->as.enum_.name;
+	case DECL_FUN:        *decl = &stmt->as.fun.decl;       return stmt->as.fun.name;
+	case DECL_ITER_VALUE: *decl = &stmt->as.foreach.decl;    return stmt->as.foreach.name;
+	case DECL_ITERATOR:   *decl = &stmt->as.foreach.it_decl; return stmt->as.foreach.it;
+
+	default: UNREACHABLE("Unknown declaration kind");
+	}
+
+	return NULL;
+}
+
+/* Resolved slots are only used while nothing is declared by name outside of the global scope,
+   since those declarations could shadow the variable. The binds always see the innermost one */
+static var_t *vm_var(env_t *e, expr_id_t *id) {
+	if (id->slot == SLOT_DYNAMIC || e->dynamic_vars > 0)
+		return e->binds[id->sym];
+
+	return &(e->scope - id->depth)->vars[id->slot];
+}
+
+static var_t *vm_decl_var(env_t *e, decl_t *decl) {
+	return decl->slot == SLOT_DYNAMIC? e->binds[decl->sym] : &e->scope->vars[decl->slot];
+}
+
+static void vm_exec(env_t *e, chunk_t *chunk, where_t where) {
+	if (e->stack_size + chunk->max_depth + 1 > STACK_CAPACITY)
+		error(where, "Stack overflow");
+
+	size_t   base = e->stack_size;
+	value_t *sp   = e->stack + base;
+	inst_t  *code = chunk->code, *inst;
+
+/* The stack pointer is kept in a local, the environment only needs to see it before anything
+   that can run code or collect garbage */
+#define SYNC() (e->stack_size = sp - e->stack)
+
+	for (size_t ip = 0;;) {
+		inst = code + ip ++;
+
+		switch ((opcode_t)inst->op) {
+		case OP_NIL:   *sp ++ = value_nil();                    break;
+		case OP_VALUE: *sp ++ = op_value(e, (expr_t*)inst->node); break;
+		case OP_FUN:   *sp ++ = value_fun(&((expr_t*)inst->node)->as.fun); break;
+		case OP_POP:   -- sp;                                   break;
+		case OP_POPN:  sp -= inst->arg;                         break;
+		case OP_SLIDE:
+			sp[-1 - (long)inst->arg] = sp[-1];
+			sp -= inst->arg;
+			break;
+
+		case OP_GET: {
+			expr_t *expr = (expr_t*)inst->node;
+			var_t  *var  = vm_var(e, &expr->as.id);
+			if (var == NULL)
+				undefined(expr->where, expr->as.id.name);
+
+			*sp ++ = var->val;
+		} break;
+
+		case OP_ARR: {
+			value_t val = gc_arr(&e->gc, inst->arg);
+			sp -= inst->arg;
+			for (size_t i = 0; i < inst->arg; ++ i)
+				value_as_arr(val)->buf[i] = gc_share(&e->gc, sp[i]);
+
+			*sp ++ = val;
+		} break;
+
+		case OP_MAP: {
+			value_t val = op_map(e, (expr_t*)inst->node, sp - inst->arg * 2);
+			sp -= inst->arg * 2;
+			*sp ++ = val;
+		} break;
+
+		case OP_REC: {
+			value_t val = op_rec(e, (expr_t*)inst->node, sp - inst->arg);
+			sp -= inst->arg;
+			*sp ++ = val;
+		} break;
+
+		case OP_FMT: {
+			value_t val = op_fmt(e, (expr_t*)inst->node, sp - inst->arg);
+			sp -= inst->arg;
+			*sp ++ = val;
+		} break;
+
+		case OP_CALL: {
+			expr_t  *expr = (expr_t*)inst->node;
+			value_t *args = sp - inst->arg, to_call = args[-1];
+
+			SYNC();
+			switch (value_type(to_call)) {
+			case VALUE_TYPE_NAT: args[-1] = value_as_nat(to_call)(e, expr, args); break;
+			case VALUE_TYPE_FUN: {
+				expr_fun_t *fun = (expr_fun_t*)value_as_fun(to_call);
+
+				if (fun->args_count != inst->arg)
+					error(expr->where, "Function expected %i arguments, got %i",
+					      (int)fun->args_count, (int)inst->arg);
+
+				env_call_begin(e, expr, fun, args);
+				/* The result stays on the stack while the scope ends, so the GC sees it */
+				vm_exec(e, fun->chunk, expr->where);
+				env_call_end(e);
+
+				args[-1] = e->stack[e->stack_size - 1];
+			} break;
+
+			default: wrong_type(expr->where, value_type(to_call), "'()' operation");
+			}
+
+			sp = args;
+		} break;
+
+		case OP_IDX:
+			sp[-2] = op_idx(e, (expr_t*)inst->node, sp[-2], sp[-1]);
+			-- sp;
+			break;
+
+		case OP_SLICE:
+			sp[-3] = op_slice(e, (expr_t*)inst->node, sp[-3], sp[-2], sp[-1]);
+			sp -= 2;
+			break;
+
+		case OP_BIN_OP:
+			sp[-2] = op_bin(e, (expr_t*)inst->node, sp[-2], sp[-1]);
+			-- sp;
+			break;
+
+		case OP_UN_OP: sp[-1] = op_un(e, (expr_t*)inst->node, sp[-1]); break;
+
+		case OP_AND:
+		case OP_OR: {
+			bool and = inst->op == OP_AND;
+			if (value_type(sp[-1]) != VALUE_TYPE_BOOL)
+				wrong_type(((expr_t*)inst->node)->where, value_type(sp[-1]),
+				           and? "left side of 'and' operation" : "left side of 'or' operation");
+
+			if (value_as_bool(sp[-1]) != and)
+				ip = inst->arg;
+			else
+				-- sp;
+		} break;
+
+		case OP_CHECK_BOOL:
+			if (value_type(sp[-1]) != VALUE_TYPE_BOOL)
+				wrong_type(((expr_t*)inst->node)->where, value_type(sp[-1]), inst->sub == BIN_OP_AND?
+				           "right side of 'and' operation, expected same as left side" :
+				           "right side of 'or' operation, expected same as left side");
+			break;
+
+		case OP_SET:
+		case OP_UPDATE: {
+			expr_t *expr = (expr_t*)inst->node;
+			var_t  *var  = vm_var(e, &expr->as.bin_op.left->as.id);
+
+			SYNC(); /* '++' checks that no temporary holds the string it appends to */
+			sp[-1] = inst->op == OP_SET? op_assign(e, expr, var, sp[-1]) :
+			                             op_update(e, expr, var, sp[-1]);
+		} break;
+
+		case OP_SET_IDX: {
+			expr_t *expr = (expr_t*)inst->node, *target = expr->as.bin_op.left->as.idx.expr;
+
+			/* A string is only changed in place if no temporary below the operands holds it */
+			e->stack_size = sp - e->stack - (inst->sub? 4 : 3);
+			if (inst->sub) {
+				sp[-4] = op_assign_idx_elem(e, expr, sp[-4], sp[-3], sp[-2], sp[-1]);
+				sp -= 3;
+				break;
+			}
+
+			value_t prev = sp[-1];
+			sp[-3] = op_assign_idx(e, expr, sp[-3], sp[-2], &sp[-1]);
+			if (sp[-1].bits != prev.bits && target->type == EXPR_TYPE_ID)
+				vm_var(e, &target->as.id)->val = sp[-1];
+
+			sp -= 2;
+		} break;
+
+		case OP_UPDATE_IDX:
+			SYNC(); /* '++' checks that no temporary holds the element it appends to */
+			sp[-3] = op_update_idx(e, (expr_t*)inst->node, sp[-3], sp[-2], sp[-1]);
+			sp -= 2;
+			break;
+
+		case OP_JUMP: ip = inst->arg; break;
+		case OP_JUMP_IF_FALSE: {
+			value_t cond = *-- sp;
+			if (value_type(cond) != VALUE_TYPE_BOOL)
+				wrong_type(((stmt_t*)inst->node)->where, value_type(cond), cond_msgs[inst->sub]);
+
+			if (!value_as_bool(cond))
+				ip = inst->arg;
+		} break;
+
+		case OP_SCOPE_BEGIN:
+			env_scope_begin(e);
+			env_scope_reserve(e, inst->arg);
+			break;
+
+		case OP_SCOPE_END:
+			SYNC();
+			env_scope_end(e);
+			break;
+
+		case OP_DECLARE: {
+			stmt_t *stmt = (stmt_t*)inst->node;
+
+			bool        const_;
+			decl_t     *decl;
+			const char *name = decl_name(stmt, inst->sub, &const_, &decl);
+
+			var_t *var = decl->slot == SLOT_DYNAMIC? env_new_var(e, name, const_) :
+			             env_new_static(e, name, decl->sym, decl->slot, const_);
+			if (var == NULL)
+				error(stmt->where, decl_redeclared_msg(inst->sub, const_), name);
+
+			if (inst->sub == DECL_ENUM)
+				var->val = value_num(inst->arg);
+		} break;
+
+		case OP_DEFINE: {
+			bool    const_;
+			decl_t *decl;
+			decl_name((stmt_t*)inst->node, inst->sub, &const_, &decl);
+			-- sp;
+			vm_decl_var(e, decl)->val = gc_share(&e->gc, *sp);
+		} break;
+
+		case OP_FOREACH_INIT: {
+			value_t in = sp[-1];
+			if (value_type(in) == VALUE_TYPE_MAP) {
+				*sp ++ = value_as_map(in)->slots;
+				*sp ++ = value_num(0);
+				break;
+			}
+
+			if (value_type(in) != VALUE_TYPE_STR && value_type(in) != VALUE_TYPE_ARR &&
+			    !value_is_packed(in))
+				error(((stmt_t*)inst->node)->where,
+				      "'foreach' can only iterate over strings, arrays and maps");
+
+			*sp ++ = value_num(value_type(in) == VALUE_TYPE_STR? value_str_len(in) :
+			                   value_is_packed(in)?              value_as_packed(in)->size :
+			                                                     value_as_arr(in)->size);
+			*sp ++ = value_num(0);
+		} break;
+
+		case OP_FOREACH_NEXT: {
+			size_t  i = value_as_num(sp[-1]);
+			value_t it, val;
+
+			/* Maps are iterated by their slots, with the keys in place of the indexes */
+			if (value_type(sp[-2]) == VALUE_TYPE_ARR) {
+				i = value_map_next(sp[-2], i);
+				if (i * 2 >= value_as_arr(sp[-2])->size) {
+					ip = inst->arg;
+					break;
+				}
+
+				it  = value_as_arr(sp[-2])->buf[i * 2];
+				val = value_as_arr(sp[-2])->buf[i * 2 + 1];
+			} else {
+				if (i >= (size_t)value_as_num(sp[-2])) {
+					ip = inst->arg;
+					break;
+				}
+
+				it  = value_num(i);
+				val = op_foreach(e, sp[-3], i);
+			}
+
+			stmt_foreach_t *foreach = &((stmt_t*)inst->node)->as.foreach;
+			if (foreach->it != NULL)
+				e->scope->vars[foreach->it_decl.slot].val = it;
+
+			/* The element is in a variable now, so '++' on it in the collection has to copy it */
+			value_share(val);
+			e->scope->vars[foreach->decl.slot].val = val;
+			sp[-1] = value_num(i + 1);
+		} break;
+
+		case OP_DEFER: env_defer(e, (stmt_t*)inst->node); break;
+
+		case OP_IMPORT: {
+			stmt_t *imported;
+			char   *path = env_import(e, (stmt_t*)inst->node, &imported);
+			if (path == NULL)
+				break;
+
+			const char *prev_path = e->path;
+			SYNC();
+			vm_run(e, imported, path, false);
+			e->path = prev_path;
+		} break;
+
+		case OP_ERROR: error(*(where_t*)inst->node, "%s", compile_errors[inst->arg]); break;
+
+		case OP_RETURN: {
+			value_t val = sp[-1];
+			sp = e->stack + base;
+			*sp ++ = val;
+			SYNC();
+			return;
+		}
+
+		default: UNREACHABLE("Unknown opcode");
+		}
+	}
+
+#undef SYNC
+}
+
+static_assert(OP_COUNT == 35); /* Add new opcodes to vm_exec */
+
+value_t vm_run(env_t *e, stmt_t *program, const char *path, bool can_return) {
+	chunk_t *chunk = compile(program, &e->syms, can_return);
+	env_sync_binds(e);
+
+	if (e->chunks_size >= e->chunks_cap) {
+		e->chunks_cap *= 2;
+		e->chunks      = (chunk_t**)realloc(e->chunks, sizeof(chunk_t*) * e->chunks_cap);
+		if (e->chunks == NULL)
+			UNREACHABLE("realloc() fail");
+	}
+
+	e->chunks[e->chunks_size ++] = chunk;
+
+	e->path = path;
+	where_t where = {.file = where_file(path), .row = 1, .col = 1};
+	vm_exec(e, chunk, where);
+	return e->stack[-- e->stack_size];
+}
+
+void vm_run_defer(env_t *e, stmt_t *defer) {
+	vm_exec(e, defer->as.defer.chunk, defer->where);
+	-- e->stack_size;
+}
+
+void vm_run_fun(env_t *e, expr_fun_t *fun, where_t where) {
+	vm_exec(e, fun->chunk, where);
+}
@@ -0,0 +1,16 @@
+#ifndef VM_H_HEADER_GUARD
+#define VM_H_HEADER_GUARD
+
+#include "common.h"
+#include "compiler.h"
+#include "eval.h"
+
+/* Compiles the unit and runs it on the value stack of the environment. The chunk is kept alive
+   by the environment, since functions declared in the unit can outlive the call */
+value_t vm_run(      env_t *e, stmt_t *program, const char *path, bool can_return);
+void    vm_run_defer(env_t *e, stmt_t *defer);
+
+/* Runs the body of a function whose call scope was begun, and leaves its result on the stack */
+void vm_run_fun(env_t *e, expr_fun_t *fun, where_t where);
+
+#endif